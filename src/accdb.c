@@ -26,6 +26,8 @@
 
 #define SECT_TYPE_INDEX		0xf
 #define SECT_TYPE_BLOB		0xe
+#define SECT_TYPE_NODE		0xd
+#define SECT_TYPE_LEAF		0xc
 #define SECT_HEADER_SIZE_TYPE 	0
 #define SECT_HEADER_PREV 	2
 #define SECT_HEADER_NEXT 	4
@@ -34,7 +36,8 @@
 
 #define REC_INDEX_SIZE_TYPE	0
 #define REC_INDEX_ENTRY		1
-#define REC_INDEX_ENTRY_MAX	128
+// the size of a record, less its size byte, is 7 bits
+#define REC_INDEX_ENTRY_MAX	127
 
 #define REC_BLOB_USERNAME	0
 #define REC_BLOB_PASSWORD	1
@@ -44,8 +47,16 @@
 #define REC_BLOB_ENTRY_MAX	(SECT_PAYLOAD_MAX - 2)
 
 #define BITMAP_START(db)	(0 + (db)->sect_start)
-#define BITMAP_MAX(db)		(16 + (db)->sect_start)
+#define BITMAP_MAX(db)		(ACCDB_BITMAP_SECTORS + (db)->sect_start)
 #define INDEX_START(db)		BITMAP_MAX(db)
+// the index root has no neighbours, so its prev link holds the layout
+// version. 0 is a tree from before slotted leaves, 1 one from before
+// nodes counted the records under each child.
+#define INDEX_VERSION		2
+// a child in a tree node is its sector and the records under it. before
+// the counts, it was only the sector.
+#define NODE_CHILD_SIZE		6
+#define NODE_CHILD_SIZE_V1	2
 #define SECT_NULL 		0
 #define ACCDB_MAX		0xffff
 #define SECT_IS_NULL(i)		((i) == SECT_NULL)
@@ -59,6 +70,8 @@ static inline uint16_t buf_get_size(const uint8_t *sector);
 static inline uint8_t buf_get_type(const uint8_t *sector);
 static inline uint16_t buf_get_next(const uint8_t *sector);
 static inline uint16_t buf_get_prev(const uint8_t *sector);
+static inline void find_invalidate(struct accdb *db);
+static uint8_t *leaf_allocate(struct accdb *db);
 
 #ifdef DBGPRINT
 #define LOG(x) outf(x)
@@ -175,6 +188,20 @@ buf_allocate_record(uint8_t *sector, uint16_t size)
 	return buf_get_payload(sector) + used;
 }
 
+// like buf_allocate_record, but the space is made at payload offset off
+static uint8_t *
+buf_insert_record(uint8_t *sector, uint16_t off, uint16_t size)
+{
+	uint16_t used = buf_get_size(sector);
+	uint8_t *at = buf_get_payload(sector) + off;
+
+	if (buf_allocate_record(sector, size) == NULL)
+		return NULL;
+	memmove(at + size, at, used - off);
+
+	return at;
+}
+
 static void
 buf_deallocate_record(uint8_t *sector, uint8_t *top, uint16_t size)
 {
@@ -240,32 +267,40 @@ index_rec_set_size(uint8_t *payload, uint8_t size)
 }
 
 #define CHECK(ex) if (!(ex)) return -1
+// the brief, user and password of a record that isn't extended, with
+// their lengths, found on the way
 static int8_t
-index_rec_parse(const uint8_t *payload, const char **brief,
-	        const char **user, const char **pass)
+index_rec_views(const uint8_t *payload, struct accdb_view *v)
 {
 	size_t size = index_rec_get_size(payload);
 	const uint8_t *p = payload + REC_INDEX_ENTRY;
 	const uint8_t *end = p + size;
+	const uint8_t *nul;
+	uint8_t i;
 
 	CHECK(!index_rec_get_extended(payload));
-	*brief = (const char *)p;
-
-	p = memchr(p, '\0', size);
-	CHECK(p != NULL);
-	++p;
+	for (i = 0; i < 3; ++i) {
+		nul = memchr(p, '\0', end - p);
+		CHECK(nul != NULL);
+		v[i].data = (const char *)p;
+		v[i].len = nul - p;
+		p = nul + 1;
+	}
+	CHECK(p == end);
 
-	*user = (const char *)p;
-	
-	p = memchr(p, '\0', end - p);
-	CHECK(p != NULL);
-	++p;
+	return 0;
+}
 
-	*pass = (const char *)p;
+static int8_t
+index_rec_parse(const uint8_t *payload, const char **brief,
+	        const char **user, const char **pass)
+{
+	struct accdb_view v[3];
 
-	p = memchr(p, '\0', end - p);
-	CHECK(p != NULL);
-	CHECK(++p == end);
+	CHECK(index_rec_views(payload, v) == 0);
+	*brief = v[0].data;
+	*user = v[1].data;
+	*pass = v[2].data;
 
 	return 0;
 }
@@ -290,6 +325,18 @@ index_rec_parse_extended(const uint8_t *payload, const char **brief,
 
 	return 0;
 }
+
+// the brief of an extended record, which is all of it but its
+// terminator and the blob pointer
+static int8_t
+index_rec_brief_view(const uint8_t *payload, struct accdb_view *brief,
+		     uint16_t *ptr)
+{
+	CHECK(index_rec_parse_extended(payload, &brief->data, ptr) == 0);
+	brief->len = index_rec_get_size(payload) - 1 - 2;
+
+	return 0;
+}
 #undef CHECK
 
 enum index_type {
@@ -428,8 +475,13 @@ Cache
 
 ACCDB cache is a crude LRU and MRU system. Cache items are organized in a list.
 The most recently requested item is at the front, and the oldest item is
-at the end. The list may contain up to ACCDB_CACHE_MAX buffers. Searching
-is linear, since there're only a handful of slots in practice.
+at the end. The list may contain up to ACCDB_CACHE_MAX buffers.
+
+Lookups by sector number go through db->hash, an open addressed table
+with linear probing. A slot is in the table exactly when it holds valid
+sector data (buf != NULL and !empty); anything that fills or empties a
+slot must add it to or drop it from the table. Removal shifts later
+entries of the probe run back, so no tombstones are needed.
 
 LRU replacement works by scaning the cache list back to front, looking for
 the first item that is not referenced. The item is either reused for
@@ -439,6 +491,48 @@ with unallocated buffers are sent to the back of the list.
 
 MRU is just the reverse process.
 
+LIRS ranks sectors by reuse distance, the number of other sectors seen
+between the last two accesses, rather than by recency alone. Most of the
+cache holds LIR (low inter-reference recency) sectors, and only
+LIRS_HIR_SLOTS hold HIR sectors, which are the only ones replaced while
+any are available. The LIRS stack is every sector accessed since the
+least recently used LIR sector (the bottom). Each access stamps the
+slot with db->clock, so a sector is in the stack when its stamp is newer
+than the bottom's, and pruning the stack is implicit. A HIR sector hit
+while in the stack has a shorter reuse distance than the bottom, so it
+becomes LIR and the bottom is demoted to HIR. HIR sectors evicted while
+in the stack are remembered as ghosts, so one read back in soon enough
+still gets promoted. A one-time scan only cycles through the HIR slots,
+and a loop larger than the cache keeps hitting its LIR part instead of
+missing every time like LRU.
+
+Chain walks (index pages, blob lists) read ahead: when the next link of the
+sector in hand is the sector right after it and isn't cached, it is read
+along with the sectors following it, up to db->readahead in all, in one
+vfs_read_sectors. Sectors are allocated first free, so chains built in one
+go are mostly laid out in order. Read ahead only takes slots that are empty
+or that the strategy gives up first: the back of the LRU list, or HIR
+sectors under LIRS; MRU's next victim is the sector just read, so it gets
+nothing. Prefetched sectors go in as HIR and don't count as accessed until
+someone asks for them. LIRS replaces them only after the HIR sectors that
+have been used, so a walk that does other I/O in between steps doesn't lose
+its read ahead.
+
+The LRU list above doubles as the LIRS recency order, so the bottom is
+found by walking back from db->lru past the few HIR and empty slots.
+Resident HIR sectors are also on their own queue from db->hir_head,
+oldest first, which gives the LIRS victim.
+
+A pinned sector holds a reference of its own, so no strategy picks it and
+the pool cleanup callback can't take its buffer. At most ACCDB_PIN_MAX
+slots are pinned, which leaves the rest of the cache to the strategy.
+After accdb_open the index head, which every lookup and add starts from,
+and the bitmap sector allocations are coming out of are pinned the first
+time they're used; the bitmap pin moves along as that sector fills up.
+That's only done in caches of ACCDB_AUTOPIN_MIN slots or more: in the
+default 8, giving up two of them to pins made adds miss more often than
+the pins saved.
+
 MRU ->
 newest -\
 	[0] [1] [2] [3] [4]
@@ -462,34 +556,305 @@ sector_list_pop(struct sector *s)
 	s->next = NULL;
 }
 
+// each gets its own queue entry, in the order they were made HIR
 static void
-accdb_cache_init(struct accdb *db)
+hir_push(struct accdb *db, struct sector *s)
 {
-	size_t i;
-	struct sector *s, *prev = NULL;
+	s->qnext = NULL;
+	s->qprev = db->hir_tail;
+	if (db->hir_tail)
+		db->hir_tail->qnext = s;
+	else
+		db->hir_head = s;
+	db->hir_tail = s;
+}
 
-	db->run_init = 1;	
-	for (i = 0; i < ACCDB_CACHE_SIZE; ++i) {
-		s = &db->cache[i];
-		memset(s, 0, sizeof(*s));
-		if (prev)
-			prev->next = s;
-		s->prev = prev;
-		prev = s;
+static void
+hir_pop(struct accdb *db, struct sector *s)
+{
+	if (s->qprev)
+		s->qprev->qnext = s->qnext;
+	else
+		db->hir_head = s->qnext;
+	if (s->qnext)
+		s->qnext->qprev = s->qprev;
+	else
+		db->hir_tail = s->qprev;
+	s->qprev = s->qnext = NULL;
+}
 
-		//attempt to preallocate a block from the pool
-		//it's not an error if we can't fill every cache
-		//slot; allocation can be attempted later.
-		s->buf = pool_allocate_block(db->pool, s);
-		s->empty = 1;
+static inline size_t
+accdb_hash_slot(struct accdb *db, uint16_t sector)
+{
+	// fibonacci hashing, take the top bits of the product
+	return ((uint32_t)sector * 2654435769u) >> (32 - db->hash_bits);
+}
+
+// smallest table keeping a cache of ncache sectors at most half full
+static uint8_t
+accdb_hash_bits(uint16_t ncache)
+{
+	uint8_t bits = 1;
+
+	while ((1UL << bits) < 2UL * ncache)
+		++bits;
+
+	return bits;
+}
+
+static struct sector *
+accdb_hash_find(struct accdb *db, uint16_t sector)
+{
+	size_t i = accdb_hash_slot(db, sector);
+	struct sector *s;
+
+	while ((s = db->hash[i]) != NULL) {
+		if (s->sector == sector)
+			return s;
+		i = (i + 1) & (ACCDB_HASH_SIZE(db) - 1);
 	}
-	db->mru = &db->cache[0];
-	db->lru = &db->cache[ACCDB_CACHE_SIZE - 1];
-	db->run_init = 0;	
 
-#ifdef CACHE_MEASURE
-	db->cache_hits = db->cache_misses = 0;
-#endif
+	return NULL;
+}
+
+static void
+accdb_hash_insert(struct accdb *db, struct sector *s)
+{
+	size_t i = accdb_hash_slot(db, s->sector);
+
+	while (db->hash[i] != NULL) {
+		chDbgAssert(db->hash[i] != s, "accdb_hash_insert #1",
+			    "sector already hashed");
+		i = (i + 1) & (ACCDB_HASH_SIZE(db) - 1);
+	}
+	db->hash[i] = s;
+}
+
+static void
+accdb_hash_remove(struct accdb *db, struct sector *s)
+{
+	size_t i = accdb_hash_slot(db, s->sector);
+	size_t j, home;
+
+	while (db->hash[i] != s) {
+		chDbgAssert(db->hash[i] != NULL, "accdb_hash_remove #1",
+			    "sector not hashed");
+		i = (i + 1) & (ACCDB_HASH_SIZE(db) - 1);
+	}
+
+	// pull back any entry further along the run that would become
+	// unreachable with a hole at i
+	j = i;
+	while (1) {
+		db->hash[i] = NULL;
+		do {
+			j = (j + 1) & (ACCDB_HASH_SIZE(db) - 1);
+			if (db->hash[j] == NULL)
+				return;
+			home = accdb_hash_slot(db, db->hash[j]->sector);
+		} while (i <= j ? (i < home && home <= j) :
+				  (i < home || home <= j));
+		db->hash[i] = db->hash[j];
+		i = j;
+	}
+}
+
+// mark a slot as not holding any sector
+static inline void
+accdb_cache_invalidate(struct accdb *db, struct sector *s)
+{
+	if (s->buf && !s->empty) {
+		accdb_hash_remove(db, s);
+		if (s->lir)
+			db->nlir--;
+		else
+			hir_pop(db, s);
+		if (s == db->lir_bottom)
+			db->lir_bottom = NULL;
+	}
+	s->lir = 0;
+	s->prefetched = 0;
+	s->empty = 1;
+}
+
+// invalidate a slot to reuse it for another sector
+static inline void
+accdb_cache_evict(struct accdb *db, struct sector *s)
+{
+	if (s->buf && !s->empty)
+		db->stats.evictions++;
+	accdb_cache_invalidate(db, s);
+}
+
+static inline uint8_t
+accdb_kind(struct accdb *db, struct sector *s)
+{
+	if (s->sector >= BITMAP_START(db) && s->sector < BITMAP_MAX(db))
+		return ACCDB_KIND_BITMAP;
+	switch (buf_get_type(s->buf)) {
+	case SECT_TYPE_INDEX:
+	case SECT_TYPE_NODE:
+	case SECT_TYPE_LEAF:
+		return ACCDB_KIND_INDEX;
+	case SECT_TYPE_BLOB:
+		return ACCDB_KIND_BLOB;
+	}
+	return ACCDB_KIND_OTHER;
+}
+
+#define LIRS_HIR_SLOTS(n) ((n) / 16 + 1)
+#define LIRS_LIR_MAX(db) ((db)->ncache - LIRS_HIR_SLOTS((db)->ncache))
+// clock stamps are compared modulo wraparound
+#define CLOCK_AFTER(a, b) ((int32_t)((a) - (b)) > 0)
+
+static void
+ghost_push(struct accdb *db, uint16_t sector, uint32_t last)
+{
+	struct ghost *g = &db->ghosts[db->ghost_head];
+
+	// when full, the oldest entry is the one overwritten
+	g->sector = sector;
+	g->last = last;
+	db->ghost_head = (db->ghost_head + 1) % db->ncache;
+	if (db->ghost_len < db->ncache)
+		db->ghost_len++;
+}
+
+// remove sector from the ghosts, returning its stamp in last
+static uint8_t
+ghost_take(struct accdb *db, uint16_t sector, uint32_t *last)
+{
+	struct ghost *g;
+	uint16_t i;
+
+	for (i = 1; i <= db->ghost_len; ++i) {
+		g = &db->ghosts[(db->ghost_head + db->ncache - i) % db->ncache];
+		if (g->sector == sector) {
+			g->sector = 0;
+			*last = g->last;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+ghost_reset(struct accdb *db)
+{
+	db->ghost_head = db->ghost_len = 0;
+}
+
+// least recently used LIR sector
+static struct sector *
+lirs_bottom(struct accdb *db)
+{
+	struct sector *s;
+
+	if (db->lir_bottom)
+		return db->lir_bottom;
+	for (s = db->lru; s != NULL; s = s->prev) {
+		if (s->lir)
+			return db->lir_bottom = s;
+	}
+
+	return NULL;
+}
+
+static uint8_t
+lirs_in_stack(struct accdb *db, uint32_t last)
+{
+	struct sector *b = lirs_bottom(db);
+
+	return b == NULL || CLOCK_AFTER(last, b->last);
+}
+
+// make s LIR, demoting the bottom if there's no room
+static void
+lirs_promote(struct accdb *db, struct sector *s)
+{
+	struct sector *b;
+
+	if (db->nlir >= LIRS_LIR_MAX(db) && (b = lirs_bottom(db)) != NULL) {
+		b->lir = 0;
+		db->nlir--;
+		hir_push(db, b);
+		db->lir_bottom = NULL;
+	}
+	s->lir = 1;
+	db->nlir++;
+}
+
+// s, a valid slot, was hit
+static void
+accdb_lirs_hit(struct accdb *db, struct sector *s)
+{
+	if (!s->lir) {
+		hir_pop(db, s);
+		if (lirs_in_stack(db, s->last))
+			lirs_promote(db, s);
+		else
+			hir_push(db, s);
+	} else if (s == db->lir_bottom) {
+		db->lir_bottom = NULL;
+	}
+	s->last = ++db->clock;
+}
+
+// s was just filled with a sector read from disk
+static void
+accdb_lirs_fill(struct accdb *db, struct sector *s)
+{
+	uint32_t last;
+
+	if (ghost_take(db, s->sector, &last) && lirs_in_stack(db, last)) {
+		lirs_promote(db, s);
+	} else if (db->nlir < LIRS_LIR_MAX(db)) {
+		s->lir = 1;
+		db->nlir++;
+	} else {
+		hir_push(db, s);
+	}
+	s->last = ++db->clock;
+}
+
+// the oldest unreferenced HIR sector. read ahead sectors waiting to be
+// used are skipped unless prefetched is set.
+static struct sector *
+accdb_lirs_hir_victim(struct accdb *db, uint8_t prefetched)
+{
+	struct sector *s;
+
+	for (s = db->hir_head; s != NULL; s = s->qnext) {
+		if (s->refcount || (s->prefetched && !prefetched))
+			continue;
+		if (!s->prefetched && lirs_in_stack(db, s->last))
+			ghost_push(db, s->sector, s->last);
+		return s;
+	}
+
+	return NULL;
+}
+
+// the oldest unreferenced HIR sector, preferring ones that have been
+// used, or failing that the least recently used unreferenced slot with
+// a buffer
+static struct sector *
+accdb_lirs_victim(struct accdb *db)
+{
+	struct sector *s;
+
+	s = accdb_lirs_hir_victim(db, 0);
+	if (s == NULL)
+		s = accdb_lirs_hir_victim(db, 1);
+	if (s != NULL)
+		return s;
+	for (s = db->lru; s != NULL; s = s->prev) {
+		if (s->refcount == 0 && s->buf)
+			return s;
+	}
+
+	return NULL;
 }
 
 // find a spot in the cache going by the chosen strategy
@@ -500,19 +865,29 @@ accdb_cache_provision(struct accdb *db, uint8_t cleanup)
 {
 	struct sector *s;
 
-	// empty slots, if present, are at the end of the list
-	// attempt to fill one if we're not doing a cleanup
+	// empty slots, if present, are at the end of the list. use one
+	// that already has a buffer, or attempt to fill one if we're not
+	// doing a cleanup
 	if (!cleanup) {
-		s = db->lru;
-		if (!s->buf && (s->buf = pool_allocate_block(db->pool, s))) {
-			s->empty = 1;
-			return s;
+		uint8_t tried = 0;
+
+		for (s = db->lru; s && s->empty && !s->refcount; s = s->prev) {
+			if (s->buf)
+				return s;
+			if (!tried) {
+				tried = 1;
+				s->buf = pool_allocate_block(db->pool, s);
+				if (s->buf)
+					return s;
+			}
 		}
 	}
 
 	// can't allocate memory? attempt to reclaim a an item that
 	// has a buffer already
-	if (db->strategy == CACHE_LRU) {
+	if (db->strategy == CACHE_LIRS) {
+		return accdb_lirs_victim(db);
+	} else if (db->strategy == CACHE_LRU) {
 		for (s = db->lru; s != NULL; s = s->prev) {
 			if (s->refcount == 0 && s->buf) {
 				return s;
@@ -577,14 +952,9 @@ accdb_cache_print(struct accdb *db, int quiet)
 		if (!s->refcount && s->buf)
 			avail++;
 	}
-	outf("available, %d/%d\r\n", avail, ACCDB_CACHE_SIZE);
+	outf("available, %d/%d\r\n", avail, (int)db->ncache);
 	outf("-------------------\r\n");
-#ifdef CACHE_MEASURE
-	outf("Total: %lu, Hits: %lu, Misses: %lu\r\n",
-	       (unsigned long)(db->cache_hits + db->cache_misses),
-	       (unsigned long)db->cache_hits,
-	       (unsigned long)db->cache_misses);
-#endif
+	accdb_stats_print(db);
 }
 
 static int8_t
@@ -598,8 +968,11 @@ accdb_cache_flush_one(struct accdb *db, struct sector *sector)
 		rv = vfs_write_sector(db->fp, sector->buf,
 				      sector->sector);
 		LOG(("WRITE %s\r\n", _s(sector->buf)));
-		if (rv == 0)
+		if (rv == 0) {
 			sector->dirty = 0;
+			db->stats.kind[accdb_kind(db, sector)].writes++;
+			db->stats.writebacks++;
+		}
 	}
 
 	return rv;
@@ -620,46 +993,264 @@ accdb_cache_do_cleanup(struct pool *pool, struct accdb *db)
 		// XXX graceful way to handle error here?
 		if (accdb_cache_flush_one(db, GET_SECTOR(s->buf)) < 0)
 			return;
+		accdb_cache_evict(db, s);
 		pool_deallocate_block(pool, s->buf);
 		s->buf = NULL;
-		s->empty = 1;
+		db->stats.reclaims++;
 		// keep unallocated cache entries at the back of the list
 		accdb_cache_lru(db, s);
 	}
 }
 
+static void
+accdb_cache_unpin_all(struct accdb *db)
+{
+	uint16_t i;
+
+	for (i = 0; i < db->ncache; ++i) {
+		if (db->cache[i].pinned) {
+			db->cache[i].pinned = 0;
+			db->cache[i].refcount--;
+		}
+	}
+	db->npinned = 0;
+}
+
+// references s will still hold once pins are dropped
+#define SLOT_REFS(s, unpin) ((s)->refcount - ((unpin) && (s)->pinned))
+
+// (re)build the slot array with room for ncache sectors. slots holding
+// references are always carried over, then the most recently used ones
+// while there's room; the rest are written back and their buffers go back
+// to the pool. any new slots are filled from the pool if possible.
+// if the new size allows fewer pins than there are, or is too small for
+// the automatic ones, they're all dropped; the automatic ones come back as
+// their sectors are used, when the cache is big enough.
+int8_t
+accdb_cache_resize(struct accdb *db, uint16_t ncache)
+{
+	struct sector *cache, *s, *d, *next, *prev = NULL;
+	struct sector **hash;
+	struct ghost *ghosts;
+	uint8_t **flush_bufs;
+	uint16_t i, n = 0, refs = 0, avail;
+	uint8_t bits, unpin;
+
+	if (ncache == 0)
+		return -1;
+
+	unpin = db->npinned > ACCDB_PIN_MAX(ncache) ||
+		(db->autopin && db->npinned && ncache < ACCDB_AUTOPIN_MIN);
+	for (s = db->mru; s != NULL; s = s->next) {
+		if (SLOT_REFS(s, unpin))
+			refs++;
+	}
+	if (refs > ncache)
+		return -1;
+
+	// write back whatever is going away before changing anything,
+	// so a failed write leaves the cache as it was
+	avail = ncache - refs;
+	for (s = db->mru; s != NULL; s = s->next) {
+		if (SLOT_REFS(s, unpin))
+			continue;
+		if (avail) {
+			avail--;
+			continue;
+		}
+		if (s->buf && accdb_cache_flush_one(db, s) < 0)
+			return -1;
+	}
+
+	bits = accdb_hash_bits(ncache);
+	cache = fast_mallocz(sizeof(*cache) * ncache);
+	hash = fast_mallocz(sizeof(*hash) << bits);
+	ghosts = fast_mallocz(sizeof(*ghosts) * ncache);
+	flush_bufs = fast_mallocz(sizeof(*flush_bufs) * ncache);
+	if (cache == NULL || hash == NULL || ghosts == NULL ||
+	    flush_bufs == NULL) {
+		if (cache)
+			fast_free(cache);
+		if (hash)
+			fast_free(hash);
+		if (ghosts)
+			fast_free(ghosts);
+		if (flush_bufs)
+			fast_free(flush_bufs);
+		return -1;
+	}
+	if (unpin)
+		accdb_cache_unpin_all(db);
+
+	avail = ncache - refs;
+	for (s = db->mru; s != NULL; s = next) {
+		next = s->next;
+		if (s->refcount == 0) {
+			if (!avail) {
+				if (s->buf)
+					pool_deallocate_block(db->pool, s->buf);
+				continue;
+			}
+			avail--;
+		}
+		d = &cache[n++];
+		*d = *s;
+		d->prev = prev;
+		d->next = NULL;
+		if (prev)
+			prev->next = d;
+		prev = d;
+		if (d->buf)
+			USER_PTR(d->buf) = d;
+	}
+	for (i = n; i < ncache; ++i) {
+		d = &cache[i];
+		d->empty = 1;
+		d->prev = prev;
+		if (prev)
+			prev->next = d;
+		prev = d;
+	}
+
+	if (db->cache)
+		fast_free(db->cache);
+	if (db->hash)
+		fast_free(db->hash);
+	if (db->ghosts)
+		fast_free(db->ghosts);
+	if (db->flush_bufs)
+		fast_free(db->flush_bufs);
+	db->cache = cache;
+	db->flush_bufs = flush_bufs;
+	db->ncache = ncache;
+	db->hash = hash;
+	db->hash_bits = bits;
+	db->mru = &cache[0];
+	db->lru = &cache[ncache - 1];
+
+	for (i = 0; i < ncache; ++i) {
+		s = &cache[i];
+		if (s->buf && !s->empty)
+			accdb_hash_insert(db, s);
+	}
+
+	// the HIR queue pointed into the old array. requeue in recency
+	// order, and trim LIR to fit if the cache shrank.
+	db->ghosts = ghosts;
+	ghost_reset(db);
+	db->hir_head = db->hir_tail = NULL;
+	db->lir_bottom = NULL;
+	db->nlir = 0;
+	for (s = db->mru; s != NULL; s = s->next) {
+		if (!s->buf || s->empty)
+			continue;
+		if (s->lir && db->nlir < LIRS_LIR_MAX(db))
+			db->nlir++;
+		else
+			s->lir = 0;
+	}
+	for (s = db->lru; s != NULL; s = s->prev) {
+		if (s->buf && !s->empty && !s->lir)
+			hir_push(db, s);
+	}
+
+	//attempt to preallocate a block from the pool for new slots.
+	//it's not an error if we can't fill every cache slot;
+	//allocation can be attempted later.
+	db->run_init = 1;
+	for (i = n; i < ncache; ++i) {
+		s = &cache[i];
+		s->buf = pool_allocate_block(db->pool, s);
+	}
+	db->run_init = 0;
+
+	return 0;
+}
+
+void
+accdb_cache_strategy(struct accdb *db, enum cache_strategy strategy)
+{
+	db->strategy = strategy;
+}
+
+static int8_t
+accdb_cache_init(struct accdb *db, uint16_t ncache)
+{
+	db->cache = NULL;
+	db->ncache = 0;
+	db->hash = NULL;
+	db->hash_bits = 0;
+	db->mru = db->lru = NULL;
+	db->clock = 0;
+	db->lir_bottom = NULL;
+	db->ghosts = NULL;
+	db->flush_bufs = NULL;
+	db->autopin = 0;
+	db->npinned = 0;
+	db->pin_bitmap = 0;
+	accdb_stats_reset(db);
+
+	return accdb_cache_resize(db, ncache);
+}
+
+// pin s if it's the index head or the bitmap sector being allocated
+// from and there's room, in a cache of at least ACCDB_AUTOPIN_MIN.
+// pinning on access rather than at open costs no reads, and brings the
+// pins back after a resize drops them.
+static inline void
+accdb_cache_autopin(struct accdb *db, struct sector *s)
+{
+	if (db->autopin && db->ncache >= ACCDB_AUTOPIN_MIN && !s->pinned &&
+	    (s->sector == INDEX_START(db) || s->sector == db->pin_bitmap) &&
+	    db->npinned < ACCDB_PIN_MAX(db->ncache)) {
+		s->pinned = 1;
+		s->refcount++;
+		db->npinned++;
+	}
+}
+
 static uint8_t *
 accdb_cache_get(struct accdb *db, uint16_t sector)
 {
 	struct sector *s;
 
 	// is sector in cache?	
-	for (s = db->mru; s != NULL; s = s->next) {
-		if (s->sector == sector && s->buf && !s->empty) {
-			s->refcount++;
-			LOG(("REF %s\r\n", _s(s->buf)));
-			accdb_cache_mru(db, s);
-#ifdef CACHE_MEASURE
-			db->cache_hits++;
-#endif
-			return s->buf;
-		}	
+	s = accdb_hash_find(db, sector);
+	if (s) {
+		s->refcount++;
+		LOG(("REF %s\r\n", _s(s->buf)));
+		if (s->prefetched) {
+			// first real access, as if it had just been read
+			s->prefetched = 0;
+			hir_pop(db, s);
+			accdb_lirs_fill(db, s);
+			db->stats.readahead_hits++;
+		} else {
+			accdb_lirs_hit(db, s);
+		}
+		accdb_cache_mru(db, s);
+		accdb_cache_autopin(db, s);
+		db->stats.kind[accdb_kind(db, s)].hits++;
+		return s->buf;
 	}
 
 	// no. find a spot in the cache, and read sector.
-#ifdef CACHE_MEASURE
-	db->cache_misses++;
-#endif
 	s = accdb_cache_provision(db, 0);
 	if (s) {	
 		if (accdb_cache_flush_one(db, s) < 0)
 			return NULL;
+		accdb_cache_evict(db, s);
 		if (vfs_read_sector(db->fp, s->buf, sector) < 0)
 			return NULL;
 		s->sector = sector;
 		s->refcount = 1;
 		s->empty = 0;
+		db->stats.kind[accdb_kind(db, s)].misses++;
+		db->stats.kind[accdb_kind(db, s)].reads++;
+		accdb_hash_insert(db, s);
+		accdb_lirs_fill(db, s);
 		accdb_cache_mru(db, s);
+		accdb_cache_autopin(db, s);
 		LOG(("READ %s\r\n", _s(s->buf)));
 		return s->buf;
 	}
@@ -668,33 +1259,165 @@ accdb_cache_get(struct accdb *db, uint16_t sector)
 	return NULL;
 }
 
-static int8_t
-accdb_cache_flush(struct accdb *db)
+// a slot read ahead can have without costing anything cached that's
+// likely to be used
+static struct sector *
+accdb_cache_spare(struct accdb *db)
 {
-	size_t i;
 	struct sector *s;
 
-	for (i = 0; i < ACCDB_CACHE_SIZE; ++i) {
-		s = &db->cache[i];
-		if (s->buf && accdb_cache_flush_one(db, s) < 0)
-			return -1;
+	for (s = db->lru; s != NULL && s->empty; s = s->prev) {
+		if (s->buf && s->refcount == 0)
+			return s;
 	}
 
-	return 0;
+	if (db->strategy == CACHE_LIRS) {
+		return accdb_lirs_hir_victim(db, 0);
+	} else if (db->strategy == CACHE_LRU) {
+		for (s = db->lru; s != NULL; s = s->prev) {
+			if (s->refcount == 0 && s->buf)
+				return s;
+		}
+	}
+
+	return NULL;
 }
 
-static int8_t
-accdb_cache_clear(struct accdb *db)
+// buf is the sector in hand of a chain being walked. if its next link
+// isn't cached and directly follows it, read it and the uncached sectors
+// right after it. a chain that isn't laid out in order gets no read ahead,
+// the sectors after the link would most likely belong to something else.
+static void
+accdb_cache_prefetch(struct accdb *db, uint8_t *buf)
 {
-	size_t i;
+	struct sector *slots[ACCDB_READAHEAD_MAX];
+	uint8_t *bufs[ACCDB_READAHEAD_MAX];
+	uint16_t next = buf_get_next(buf);
+	uint8_t i, n = 0;
+	struct sector *s;
 
-	if (accdb_cache_flush(db) < 0)
-		return -1;
+	if (next != GET_SECTOR(buf)->sector + 1 || accdb_hash_find(db, next))
+		return;
 
-	for (i = 0; i < ACCDB_CACHE_SIZE; ++i) {
-		struct sector *s = &db->cache[i];
-		if (s->refcount == 0) {
-			s->empty = 1;
+	while (n < db->readahead && next + n <= 0xffff &&
+	       (n == 0 || !accdb_hash_find(db, next + n))) {
+		s = accdb_cache_spare(db);
+		if (s == NULL || accdb_cache_flush_one(db, s) < 0)
+			break;
+		accdb_cache_evict(db, s);
+		// hold it so it isn't handed out twice
+		s->refcount = 1;
+		slots[n] = s;
+		bufs[n++] = s->buf;
+	}
+	if (n == 0)
+		return;
+
+	if (vfs_read_sectors(db->fp, (void *const *)bufs, next, n) < 0) {
+		for (i = 0; i < n; ++i) {
+			slots[i]->refcount = 0;
+			accdb_cache_lru(db, slots[i]);
+		}
+		return;
+	}
+
+	// last first, so the next link ends up most recently used
+	for (i = n; i-- > 0; ) {
+		s = slots[i];
+		s->sector = next + i;
+		s->refcount = 0;
+		s->empty = 0;
+		s->prefetched = 1;
+		s->last = db->clock;
+		accdb_hash_insert(db, s);
+		hir_push(db, s);
+		accdb_cache_mru(db, s);
+		db->stats.kind[accdb_kind(db, s)].reads++;
+		LOG(("READ AHEAD %s\r\n", _s(s->buf)));
+	}
+	db->stats.readahead_sectors += n;
+}
+
+// sectors read at once by chain walks, 0 turns read ahead off
+void
+accdb_cache_readahead(struct accdb *db, uint8_t count)
+{
+	if (count > ACCDB_READAHEAD_MAX)
+		count = ACCDB_READAHEAD_MAX;
+	db->readahead = count;
+}
+
+static int
+flush_cmp(const void *a, const void *b)
+{
+	uint16_t x = GET_SECTOR(*(uint8_t *const *)a)->sector;
+	uint16_t y = GET_SECTOR(*(uint8_t *const *)b)->sector;
+
+	return (x > y) - (x < y);
+}
+
+// write back every dirty sector, in sector order, with each run of
+// consecutive sectors going out in one vfs_write_sectors call
+int8_t
+accdb_cache_flush(struct accdb *db)
+{
+	uint8_t **bufs = db->flush_bufs;
+	uint16_t i, j, k, n = 0;
+	struct sector *s;
+	int8_t rv = 0;
+	systime_t start = chTimeNow();
+
+	for (i = 0; i < db->ncache; ++i) {
+		s = &db->cache[i];
+		if (s->buf && s->dirty)
+			bufs[n++] = s->buf;
+	}
+	if (n == 0)
+		return 0;
+	// a bulk load or a big cache can leave thousands dirty
+	qsort(bufs, n, sizeof(*bufs), flush_cmp);
+
+	for (i = 0; i < n; i = j) {
+		s = GET_SECTOR(bufs[i]);
+		for (j = i + 1; j < n; ++j) {
+			if (GET_SECTOR(bufs[j])->sector != s->sector + (j - i))
+				break;
+		}
+		rv = vfs_write_sectors(db->fp, (const void *const *)&bufs[i],
+				       s->sector, j - i);
+		if (rv < 0)
+			break;
+		for (k = i; k < j; ++k) {
+			LOG(("WRITE %s\r\n", _s(bufs[k])));
+			s = GET_SECTOR(bufs[k]);
+			s->dirty = 0;
+			db->stats.kind[accdb_kind(db, s)].writes++;
+		}
+		db->stats.flush_sectors += j - i;
+		db->stats.flush_writes++;
+	}
+
+	db->stats.flushes++;
+	db->stats.flush_ticks += chTimeNow() - start;
+
+	return rv;
+}
+
+// write back and drop everything not referenced, pins included
+static int8_t
+accdb_cache_clear(struct accdb *db)
+{
+	size_t i;
+
+	if (accdb_cache_flush(db) < 0)
+		return -1;
+	accdb_cache_unpin_all(db);
+
+	for (i = 0; i < db->ncache; ++i) {
+		struct sector *s = &db->cache[i];
+		if (s->refcount == 0) {
+			accdb_cache_invalidate(db, s);
+			accdb_cache_lru(db, s);
 			if (s->buf)
 				memset(s->buf, 0, VFS_SECT_SIZE);
 			//pool_deallocate_block(db->pool, s->buf);
@@ -704,6 +1427,26 @@ accdb_cache_clear(struct accdb *db)
 	return 0;
 }
 
+// drop everything not referenced without writing it back, dirty or not,
+// so what's cached next comes from the file as it is
+static void
+accdb_cache_discard(struct accdb *db)
+{
+	size_t i;
+
+	accdb_cache_unpin_all(db);
+	for (i = 0; i < db->ncache; ++i) {
+		struct sector *s = &db->cache[i];
+		if (s->refcount == 0) {
+			s->dirty = 0;
+			accdb_cache_invalidate(db, s);
+			accdb_cache_lru(db, s);
+			if (s->buf)
+				memset(s->buf, 0, VFS_SECT_SIZE);
+		}
+	}
+}
+
 static inline uint8_t *
 accdb_cache_ref(uint8_t *buf)
 {
@@ -749,35 +1492,161 @@ accdb_cache_put_dirty(uint8_t *buf)
 	accdb_cache_put(buf);
 }
 
+// keep sector cached until it's unpinned. fails once ACCDB_PIN_MAX
+// sectors are pinned.
+int8_t
+accdb_cache_pin(struct accdb *db, uint16_t sector)
+{
+	struct sector *s = accdb_hash_find(db, sector);
+	uint8_t *buf;
+
+	if (s != NULL && s->pinned)
+		return 0;
+	if (db->npinned >= ACCDB_PIN_MAX(db->ncache))
+		return -1;
+	buf = accdb_cache_get(db, sector);
+	if (buf == NULL)
+		return -1;
+	s = GET_SECTOR(buf);
+	if (s->pinned) {
+		// accdb_cache_autopin got there first
+		accdb_cache_put(buf);
+		return 0;
+	}
+	// the reference from accdb_cache_get is the pin's
+	s->pinned = 1;
+	db->npinned++;
+
+	return 0;
+}
+
+int8_t
+accdb_cache_unpin(struct accdb *db, uint16_t sector)
+{
+	struct sector *s = accdb_hash_find(db, sector);
+
+	if (s == NULL || !s->pinned)
+		return -1;
+	s->pinned = 0;
+	db->npinned--;
+	accdb_cache_put(s->buf);
+
+	return 0;
+}
+
+
+// allocations now come out of bitmap sector, move the automatic pin
+// there. it's made on the next access.
+static void
+accdb_cache_pin_bitmap(struct accdb *db, uint16_t sector)
+{
+	if (!db->autopin || sector == db->pin_bitmap)
+		return;
+	(void)accdb_cache_unpin(db, db->pin_bitmap);
+	db->pin_bitmap = sector;
+}
+
+#define BITMAP_WORDS		(VFS_SECT_SIZE / 4)
+
+// first clear bit at or after bit from, or -1. bits are numbered lsb
+// first, so a little endian word's trailing zeros count them.
+static int16_t
+bitmap_find_free(const uint8_t *buf, uint16_t from)
+{
+	uint16_t w = from / 32;
+	uint32_t word;
+
+	word = ~get_uint32_le(buf, w * 4) &
+	       ((uint32_t)0xffffffff << (from % 32));
+	while (word == 0) {
+		if (++w == BITMAP_WORDS)
+			return -1;
+		word = ~get_uint32_le(buf, w * 4);
+	}
+
+	return w * 32 + __builtin_ctz(word);
+}
+
+static uint16_t
+bitmap_count_free(const uint8_t *buf)
+{
+	uint16_t w, n = 0;
+
+	for (w = 0; w < BITMAP_WORDS; ++w)
+		n += __builtin_popcount(~get_uint32_le(buf, w * 4));
+
+	return n;
+}
+
+// forget what's known about the bitmap, after open or format
+static void
+accdb_bitmap_reset(struct accdb *db)
+{
+	uint16_t i;
+
+	for (i = 0; i < ACCDB_BITMAP_SECTORS; ++i)
+		db->bitmap_free[i] = ACCDB_FREE_UNKNOWN;
+	db->alloc_next = 0;
+}
+
+// first fit in the sectors from from up to to. bitmap sectors known to
+// be full are skipped without being read, so the cost doesn't grow as the
+// db fills up. 1 if there's no free sector there.
 static int8_t
-accdb_allocate_sector(struct accdb *db, uint16_t *free_sect)
+accdb_allocate_range(struct accdb *db, uint32_t from, uint32_t to,
+		     uint16_t *free_sect)
 {
-	uint16_t sector, byte, bit;
+	uint32_t next = from;
+	uint16_t i, sector;
+	int16_t bit;
 	uint8_t *buf;
 
-	// search for a free sector
-	for (sector = BITMAP_START(db); sector < BITMAP_MAX(db); ++sector) {
+	for (i = next / SECT_PER_BITMAP; i < ACCDB_BITMAP_SECTORS && next < to;
+	     next = (uint32_t)++i * SECT_PER_BITMAP) {
+		if (db->bitmap_free[i] == 0)
+			continue;
+		sector = BITMAP_START(db) + i;
 		buf = accdb_cache_get(db, sector);
 		if (!buf)
 			return -1;
-		for (byte = 0; byte < VFS_SECT_SIZE; ++byte) {
-			for (bit = 0; bit < 8; ++bit) {
-				if (!(buf[byte] & (1 << bit))) {
-					*free_sect = BITMAP_OFFSET_TO_SECT(db,
-									   sector,
-								           byte,
-									   bit);
-					buf[byte] |= (1 << bit);
-					accdb_cache_put_dirty(buf);
-					return 0;
-				}
-			}
+		if (db->bitmap_free[i] == ACCDB_FREE_UNKNOWN)
+			db->bitmap_free[i] = bitmap_count_free(buf);
+		bit = bitmap_find_free(buf, next % SECT_PER_BITMAP);
+		if (bit < 0) {
+			accdb_cache_put(buf);
+			continue;
+		}
+		if ((uint32_t)BITMAP_OFFSET_TO_SECT(db, sector, bit / 8,
+					     bit % 8) >= to) {
+			accdb_cache_put(buf);
+			return 1;
 		}
+		buf[bit / 8] |= (1 << (bit % 8));
+		db->bitmap_free[i]--;
+		*free_sect = BITMAP_OFFSET_TO_SECT(db, sector, bit / 8,
+						   bit % 8);
+		// nothing before the cursor is free, so the first free
+		// sector after it is the new one
+		if (from <= db->alloc_next)
+			db->alloc_next = (uint32_t)*free_sect + 1;
+		accdb_cache_put_dirty(buf);
+		accdb_cache_pin_bitmap(db, sector);
+		return 0;
 	}
 
 	// file is full!
+	if (from <= db->alloc_next && to > ACCDB_MAX)
+		db->alloc_next = next;
 
-	return -1;
+	return 1;
+}
+
+// first fit, starting from db->alloc_next
+static int8_t
+accdb_allocate_sector(struct accdb *db, uint16_t *free_sect)
+{
+	return accdb_allocate_range(db, db->alloc_next, (uint32_t)ACCDB_MAX + 1,
+				    free_sect) == 0 ? 0 : -1;
 }
 
 static uint8_t *
@@ -815,27 +1684,95 @@ accdb_deallocate_sector(struct accdb *db, uint16_t sect)
 	buf = accdb_cache_get(db, bitmap);
 	if (buf == NULL)
 		return -1;
-	buf[byte] &= ~(1 << bit);
+	if (buf[byte] & (1 << bit)) {
+		buf[byte] &= ~(1 << bit);
+		if (db->bitmap_free[bitmap - BITMAP_START(db)] !=
+		    ACCDB_FREE_UNKNOWN)
+			db->bitmap_free[bitmap - BITMAP_START(db)]++;
+	}
+	if (sect < db->alloc_next)
+		db->alloc_next = sect;
 	accdb_cache_put_dirty(buf);
 
 	return 0;
 }
 
+// allocate n sectors in a row, the first such run after the cursor. 1 if
+// there's none.
+static int8_t
+accdb_allocate_run(struct accdb *db, uint16_t n, uint16_t *first)
+{
+	uint32_t from = db->alloc_next, end;
+	uint16_t sector;
+	int8_t rv;
+
+	while (1) {
+		rv = accdb_allocate_range(db, from, (uint32_t)ACCDB_MAX + 1,
+					  first);
+		if (rv != 0)
+			return rv;
+		for (end = (uint32_t)*first + 1;
+		     end < (uint32_t)*first + n; ++end) {
+			rv = accdb_allocate_range(db, end, end + 1, &sector);
+			if (rv != 0)
+				break;
+		}
+		if (rv == 0)
+			return 0;
+
+		// end isn't free, give back the ones before it and look
+		// after it
+		for (sector = *first; sector < end; ++sector)
+			if (accdb_deallocate_sector(db, sector) < 0)
+				return -1;
+		if (rv < 0)
+			return -1;
+		from = end + 1;
+	}
+}
+
 static int8_t
 accdb_deallocate_buf(struct accdb *db, uint8_t *buf)
 {
 	struct sector *s = GET_SECTOR(buf);
+	if (s->pinned)
+		(void)accdb_cache_unpin(db, s->sector);
 	chDbgAssert(s->refcount == 1, "dealloc buf", "buf still has refs");
 	s->dirty = 0;
 	accdb_cache_put(buf);
 	return accdb_deallocate_sector(db, s->sector);
 }
 
-static int8_t
+// a tree's root, with its only, empty, leaf. the root is returned
+// referenced.
+static uint8_t *
+tree_create(struct accdb *db)
+{
+	uint8_t *root, *leaf, *pl;
+
+	root = accdb_allocate_buf(db, SECT_TYPE_NODE);
+	if (root == NULL)
+		return NULL;
+	leaf = leaf_allocate(db);
+	if (leaf == NULL) {
+		accdb_deallocate_buf(db, root);
+		return NULL;
+	}
+	pl = buf_allocate_record(root, NODE_CHILD_SIZE);
+	set_uint16(pl, 0, accdb_cache_sector(leaf));
+	set_uint32(pl, 2, 0);
+	buf_set_prev(root, INDEX_VERSION);
+	accdb_cache_put_dirty(leaf);
+	accdb_cache_dirty(root);
+
+	return root;
+}
+
+int8_t
 accdb_format(struct accdb *db)
 {
 	uint16_t i, count, byte;
-	uint8_t *buf;
+	uint8_t *buf, *root;
 
 	count = db->sect_start;
 
@@ -859,9 +1796,18 @@ accdb_format(struct accdb *db)
 		}
 		accdb_cache_put_dirty(buf);
 	}
-
-	buf = accdb_allocate_buf(db, SECT_TYPE_INDEX);
-	accdb_cache_put_dirty(buf);
+	accdb_bitmap_reset(db);
+	db->find_state = ACCDB_FIND_UNBUILT;
+	db->count = 0;
+	db->compact_next = 0;
+	db->tail = 0;
+
+	root = tree_create(db);
+	if (root == NULL)
+		return -1;
+	chDbgAssert(accdb_cache_sector(root) == INDEX_START(db),
+		    "accdb_format #1", "root not at INDEX_START");
+	accdb_cache_put_dirty(root);
 
 	return accdb_cache_flush(db);
 }
@@ -905,8 +1851,11 @@ accdb_list_remove(struct accdb *db, uint8_t *a)
 		return -1;
 
 	if (!SECT_IS_NULL(prev) &&
-	    !(prev_buf = accdb_cache_get(db, prev)))
+	    !(prev_buf = accdb_cache_get(db, prev))) {
+		if (next_buf)
+			accdb_cache_put(next_buf);
 		return -1;
+	}
 
 	if (prev_buf) {
 		buf_set_next(prev_buf, next);
@@ -924,6 +1873,48 @@ accdb_list_remove(struct accdb *db, uint8_t *a)
 	return 0;
 }
 
+// put b in a's place in its list
+static int8_t
+accdb_list_replace(struct accdb *db, uint8_t *a, uint8_t *b)
+{
+	uint16_t new_sector = accdb_cache_sector(b);
+	uint16_t next = buf_get_next(a);
+	uint16_t prev = buf_get_prev(a);
+	uint8_t *next_buf = NULL;
+	uint8_t *prev_buf = NULL;
+
+	// both are had before either changes, so a failure leaves the list
+	// as it was
+	if (!SECT_IS_NULL(next) &&
+	    !(next_buf = accdb_cache_get(db, next)))
+		return -1;
+
+	if (!SECT_IS_NULL(prev) &&
+	    !(prev_buf = accdb_cache_get(db, prev))) {
+		if (next_buf)
+			accdb_cache_put(next_buf);
+		return -1;
+	}
+
+	if (prev_buf) {
+		buf_set_next(prev_buf, new_sector);
+		accdb_cache_put_dirty(prev_buf);
+	}
+	if (next_buf) {
+		buf_set_prev(next_buf, new_sector);
+		accdb_cache_put_dirty(next_buf);
+	}
+
+	buf_set_next(b, next);
+	buf_set_prev(b, prev);
+	buf_set_next(a, SECT_NULL);
+	buf_set_prev(a, SECT_NULL);
+	accdb_cache_dirty(a);
+	accdb_cache_dirty(b);
+
+	return 0;
+}
+
 static int8_t
 accdb_list_clear(struct accdb *db, uint16_t ptr)
 {
@@ -933,6 +1924,7 @@ accdb_list_clear(struct accdb *db, uint16_t ptr)
 		buf = accdb_cache_get(db, ptr);
 		if (buf == NULL)
 			return -1;
+		accdb_cache_prefetch(db, buf);
 		ptr = buf_get_next(buf);
 		if (accdb_deallocate_buf(db, buf) < 0)
 			return -1;
@@ -955,558 +1947,871 @@ accdb_index_clear(struct accdb_index *idx)
 	memset(idx, 0, sizeof(*idx));
 }
 
-static int8_t
-accdb_index_init_internal(struct accdb *db, struct accdb_index *idx)
-{
-	accdb_index_clear(idx);
+/*
+Index
+
+The index is a B+tree ordered by brief, with its root at INDEX_START. The
+leaves are SECT_TYPE_LEAF pages holding index records, sorted, and
+linked in order through the sector header like any other list, so
+walking the index is walking the leaf list. There's always at least one
+leaf; only the last one can be empty.
+
+A leaf is a slotted page. After the header come a record count and a
+byte per record, in brief order, holding half its sector offset:
+
+	count | slot0 slot1 ... | free | records, in any order
+
+Records are padded to an even size. Slots grow up from the front and
+records down from the end, so record k of a leaf, and the ones either
+side of it, are had without walking the page, and a leaf is binary
+searched. Deleting a record only closes up the slots, leaving a hole
+where it was. The header size counts the bytes in use, holes not
+included, and when a record doesn't fit between the slots and the
+lowest record the holes are squeezed out first. Index positions and ids
+are a leaf and a slot.
+
+Interior pages are SECT_TYPE_NODE. Their payload is a child followed by
+(key, child) pairs, where a key is a length byte and that many bytes of
+separator, with no terminator, and a child is a sector and, in 32 bits,
+the number of records under it:
+
+	child0 | len key1 child1 | len key2 child2 | ...
+
+Every brief under childN is >= keyN and < keyN+1. A separator is the
+shortest prefix of the first brief on its right that is greater than the
+last one on its left. When those two are equal, which takes duplicate
+briefs, the separator is the whole brief and has NODE_KEY_DUP set: the
+left side can hold briefs equal to it too.
+
+The root never moves. When it's full, its contents go to a new node that
+becomes its only child, and that one is split. Leaves and nodes split in
+half by size. A leaf that's emptied is unlinked and freed, and so is a
+node that loses its last child, but pages are never merged. The tree
+gets lower again when the root is left with a single child node.
+
+Adding or deleting a record moves other records and slots around, so
+index positions and ids taken before it may no longer be valid. It also
+changes the count of every child on the way down to its leaf, so those
+nodes are written too. The counts let accdb_index_seek go down the tree
+to record n.
+
+The tree_ functions take the root to work on, so the user index below is
+kept by the same code.
+*/
 
-	idx->db = db;
-	idx->buf = accdb_cache_get(db, INDEX_START(db));
-	if (idx->buf == NULL)
-		return -1;
-	if (buf_get_type(idx->buf) != SECT_TYPE_INDEX) {
-		accdb_cache_put(idx->buf);
-		return -1;
-	}
-	idx->rec = buf_get_payload(idx->buf);
+#define LEAF_COUNT		0
+#define LEAF_SLOTS		1
+// records start on even sector offsets, a slot holds half of one
+#define LEAF_SLOT_OFF(s)	((uint16_t)(s) * 2)
+#define LEAF_REC_SIZE(len)	(((len) + 1) & ~1)
 
-	return 0;
-}
+#define NODE_KEY_DUP		0x80
+#define NODE_KEY_LEN(p)		((p)[0] & 0x7f)
+#define NODE_ENTRY_SIZE(p)	(1 + NODE_KEY_LEN(p) + NODE_CHILD_SIZE)
+#define ACCDB_TREE_DEPTH	16
 
-int8_t
-accdb_index_init(struct accdb *db, struct accdb_index *idx)
+struct tree_step {
+	uint16_t sector;
+	// payload offsets of the child pointer taken, and of the key in
+	// front of it, 0 for the first child
+	uint16_t child;
+	uint16_t key;
+};
+
+// the nodes passed on the way from the root to a leaf
+struct tree_path {
+	struct tree_step step[ACCDB_TREE_DEPTH];
+	uint8_t depth;
+	// a NODE_KEY_DUP separator equal to the brief was passed
+	uint8_t dup;
+};
+
+static inline const char *
+index_rec_brief(const uint8_t *payload)
 {
-	accdb_index_init_internal(db, idx);
+	return (const char *)payload + REC_INDEX_ENTRY;
+}
 
-	// INDEX_START may have been emptied
-	if (buf_get_size(idx->buf) == 0 && buf_get_next(idx->buf)) {
-		uint16_t next = buf_get_next(idx->buf);
-		accdb_cache_put(idx->buf);
-		idx->buf = accdb_cache_get(db, next);
-		if (idx->buf == NULL)
-			return -1;
-		idx->rec = buf_get_payload(idx->buf);
-	}
+// compare brief, blen bytes long, to a separator key
+static int
+node_key_cmp(const char *brief, size_t blen, const uint8_t *key)
+{
+	uint8_t klen = NODE_KEY_LEN(key);
+	int c = memcmp(brief, key + 1, blen < klen ? blen : klen);
 
-	return 0;
+	if (c != 0)
+		return c;
+	return blen < klen ? -1 : blen > klen;
 }
 
-// construct an id from an index as follows:
-// 	id = (sector_of_rec << 16) | off_of_rec_in_page
-int8_t
-accdb_index_to_id(struct accdb_index *idx, accdb_id_t *id)
+// the child to take for brief, the last one whose separator isn't
+// greater than it. step gets where it was found.
+static uint16_t
+node_find_child(uint8_t *node, const char *brief, size_t blen,
+		struct tree_step *step, uint8_t *dup)
 {
-	if (idx->db == NULL || idx->buf == NULL) {
-		return -1;
+	uint8_t *pl = buf_get_payload(node);
+	uint8_t *end = buf_get_end(node);
+	uint8_t *p = pl + NODE_CHILD_SIZE;
+	int c;
+
+	step->child = step->key = 0;
+	while (p < end) {
+		c = node_key_cmp(brief, blen, p);
+		if (c < 0)
+			break;
+		if (c == 0 && (p[0] & NODE_KEY_DUP))
+			*dup = 1;
+		step->key = p - pl;
+		step->child = step->key + 1 + NODE_KEY_LEN(p);
+		p = pl + step->child + NODE_CHILD_SIZE;
 	}
 
-	*id = ((uint32_t)accdb_cache_sector(idx->buf) << 16);
-	*id |= (idx->rec - idx->buf);
-
-	return 0;
+	return get_uint16(pl, step->child);
 }
 
-// reverse the above process
-int8_t
-accdb_index_from_id(struct accdb *db, struct accdb_index *idx, accdb_id_t id)
+// the number of records under the child at payload offset child
+static inline uint32_t
+node_count(const uint8_t *pl, uint16_t child)
 {
-	accdb_index_clear(idx);
-	idx->db = db;
-	idx->buf = accdb_cache_get(idx->db, id >> 16);
-	if (idx->buf == NULL)
-		return -1;
+	return get_uint32(pl, child + 2);
+}
 
-	if (buf_get_type(idx->buf) != SECT_TYPE_INDEX)
-		return -1;
+static inline void
+node_set_count(uint8_t *pl, uint16_t child, uint32_t n)
+{
+	set_uint32(pl, child + 2, n);
+}
 
-	idx->rec = idx->buf + (id & 0xffff);
+// the number of records under node
+static uint32_t
+node_sum(uint8_t *node)
+{
+	uint8_t *pl = buf_get_payload(node);
+	uint16_t off = 0, size = buf_get_size(node);
+	uint32_t n = 0;
 
-	if (idx->rec < buf_get_payload(idx->buf) ||
-	    idx->rec > buf_get_end(idx->buf))
-		return -1;
+	while (1) {
+		n += node_count(pl, off);
+		off += NODE_CHILD_SIZE;
+		if (off >= size)
+			break;
+		off += 1 + NODE_KEY_LEN(pl + off);
+	}
 
-	return 0;
+	return n;
 }
 
-uint8_t
-accdb_index_has_entry(struct accdb_index *idx)
+static void
+node_put_entry(uint8_t *node, uint16_t off, const uint8_t *key,
+	       uint16_t child, uint32_t count)
 {
-	if (!idx->rec || !idx->buf || idx->before_beginning)
-		return 0;
-	return idx->rec < buf_get_end(idx->buf);
+	uint8_t len = NODE_KEY_LEN(key);
+	uint8_t *p = buf_insert_record(node, off, 1 + len + NODE_CHILD_SIZE);
+
+	chDbgAssert(p != NULL, "node_put_entry #1", "node full");
+	memcpy(p, key, 1 + len);
+	set_uint16(p, 1 + len, child);
+	node_set_count(p, 1 + len, count);
 }
 
-int8_t
-accdb_index_next(struct accdb_index *idx)
+// the key offset closest to the middle of node, to split it at
+static uint16_t
+node_split_point(uint8_t *node)
 {
-	if (idx->blob_user)
-		accdb_cache_put(idx->blob_user);
-	if (idx->blob_pass)
-		accdb_cache_put(idx->blob_pass);
-	idx->blob_user = idx->blob_pass = NULL;
-
-	if (idx->before_beginning) {
-		idx->before_beginning = 0;
-		return 0;
+	uint8_t *pl = buf_get_payload(node);
+	uint8_t *end = buf_get_end(node);
+	uint16_t half = buf_get_size(node) / 2, best = 0, b;
+	uint8_t *p;
+
+	for (p = pl + NODE_CHILD_SIZE; p < end; p += NODE_ENTRY_SIZE(p)) {
+		b = p - pl;
+		if (best && abs(b - half) >= abs(best - half))
+			break;
+		best = b;
 	}
 
-	index_rec_next(&idx->rec);
+	return best;
+}
 
-	if (idx->rec >= buf_get_end(idx->buf)) {
-		uint16_t ptr = buf_get_next(idx->buf);
-		if (ptr == 0)
-			return 0;
-		accdb_cache_put(idx->buf);
-		idx->buf = accdb_cache_get(idx->db, ptr);
-		if (idx->buf == NULL)
-			return -1;
-		idx->rec = buf_get_payload(idx->buf);
-		if (idx->rec >= buf_get_end(idx->buf))
-			return -1;
-	}
+static inline uint8_t
+leaf_count(const uint8_t *leaf)
+{
+	return leaf[SECT_HEADER_MAX + LEAF_COUNT];
+}
 
-	return 0;
+static inline uint8_t *
+leaf_slots(uint8_t *leaf)
+{
+	return leaf + SECT_HEADER_MAX + LEAF_SLOTS;
 }
 
-int8_t
-accdb_index_prev(struct accdb_index *idx)
+static inline uint8_t *
+leaf_rec(uint8_t *leaf, uint8_t slot)
 {
-	uint8_t *pl, *end;
+	return leaf + LEAF_SLOT_OFF(leaf_slots(leaf)[slot]);
+}
 
-	if (idx->blob_user)
-		accdb_cache_put(idx->blob_user);
-	if (idx->blob_pass)
-		accdb_cache_put(idx->blob_pass);
-	idx->blob_user = idx->blob_pass = NULL;
+static inline uint16_t
+leaf_rec_size(const uint8_t *rec)
+{
+	return LEAF_REC_SIZE(index_rec_get_total_size(rec));
+}
 
-	// if this is the first record of the page, we must find the bottom
-	// record of the previous page
-	if (idx->rec == buf_get_payload(idx->buf)) {
-		uint8_t *buf;
-		uint16_t prev;
-		prev = buf_get_prev(idx->buf);
-		if (!prev) {
-			idx->before_beginning = 1;
-			return 0;
+// the sector offset of the lowest record
+static uint16_t
+leaf_heap(uint8_t *leaf)
+{
+	uint8_t *slots = leaf_slots(leaf);
+	uint8_t n = leaf_count(leaf), i, low = 0xff;
+
+	if (n == 0)
+		return VFS_SECT_SIZE;
+	for (i = 0; i < n; ++i)
+		if (slots[i] < low)
+			low = slots[i];
+	return LEAF_SLOT_OFF(low);
+}
+
+static void
+leaf_init(uint8_t *leaf)
+{
+	buf_get_payload(leaf)[LEAF_COUNT] = 0;
+	buf_set_size(leaf, LEAF_SLOTS);
+	accdb_cache_dirty(leaf);
+}
+
+static uint8_t *
+leaf_allocate(struct accdb *db)
+{
+	uint8_t *leaf = accdb_allocate_buf(db, SECT_TYPE_LEAF);
+
+	if (leaf != NULL)
+		leaf_init(leaf);
+	return leaf;
+}
+
+// squeeze the holes out of the heap, moving the records up to the end of
+// the sector, highest first
+static void
+leaf_compact(uint8_t *leaf)
+{
+	uint8_t *slots = leaf_slots(leaf);
+	uint16_t top = VFS_SECT_SIZE, len;
+	uint8_t n = leaf_count(leaf), i, j, at = 0, best, below = 0xff;
+
+	for (i = 0; i < n; ++i) {
+		best = 0;
+		for (j = 0; j < n; ++j) {
+			if (slots[j] <= below && slots[j] > best) {
+				best = slots[j];
+				at = j;
+			}
 		}
-		buf = accdb_cache_get(idx->db, prev);
-		if (buf == NULL)
-			return -1;
-		idx->rec = buf_get_end(buf);
-		accdb_cache_put(idx->buf);
-		idx->buf = buf;
+		len = leaf_rec_size(leaf + LEAF_SLOT_OFF(best));
+		top -= len;
+		memmove(leaf + top, leaf + LEAF_SLOT_OFF(best), len);
+		slots[at] = top / 2;
+		below = best - 1;
 	}
+}
 
-	pl = buf_get_payload(idx->buf);
-	end = buf_get_end(idx->buf);
-	
-	while (pl + index_rec_get_total_size(pl) < idx->rec) {
-		chDbgAssert(pl < end, "accdb_index_prev #1",
-			    "rec past the end");
-		index_rec_next(&pl);
+// make room for a len byte record at slot, moving the slots from there
+// on up one. NULL if the leaf is full.
+static uint8_t *
+leaf_insert(uint8_t *leaf, uint8_t slot, uint8_t len)
+{
+	uint8_t *slots = leaf_slots(leaf);
+	uint8_t n = leaf_count(leaf);
+	uint16_t size = LEAF_REC_SIZE(len), heap;
+
+	if (buf_get_available(leaf) < size + 1)
+		return NULL;
+	heap = leaf_heap(leaf);
+	if (heap - (slots + n + 1 - leaf) < size) {
+		leaf_compact(leaf);
+		heap = leaf_heap(leaf);
 	}
+	heap -= size;
+	memmove(slots + slot + 1, slots + slot, n - slot);
+	slots[slot] = heap / 2;
+	buf_get_payload(leaf)[LEAF_COUNT] = n + 1;
+	buf_set_size(leaf, buf_get_size(leaf) + size + 1);
+	accdb_cache_dirty(leaf);
+
+	return leaf + heap;
+}
 
-	idx->rec = pl;
+// drop the record at slot. its bytes are a hole until the next
+// leaf_compact.
+static void
+leaf_remove(uint8_t *leaf, uint8_t slot)
+{
+	uint8_t *slots = leaf_slots(leaf);
+	uint8_t n = leaf_count(leaf);
+	uint16_t size = leaf_rec_size(leaf_rec(leaf, slot));
+
+	chDbgAssert(slot < n, "leaf_remove #1", "no such slot");
+	memmove(slots + slot, slots + slot + 1, n - slot - 1);
+	buf_get_payload(leaf)[LEAF_COUNT] = n - 1;
+	buf_set_size(leaf, buf_get_size(leaf) - size - 1);
+	accdb_cache_dirty(leaf);
+}
 
-	return 0;
+// move the records from slot b on to right, an empty leaf
+static void
+leaf_move(uint8_t *leaf, uint8_t b, uint8_t *right)
+{
+	uint8_t n = leaf_count(leaf), i, len;
+	uint16_t size = LEAF_SLOTS;
+
+	for (i = b; i < n; ++i) {
+		len = index_rec_get_total_size(leaf_rec(leaf, i));
+		memcpy(leaf_insert(right, i - b, len), leaf_rec(leaf, i), len);
+	}
+	for (i = 0; i < b; ++i)
+		size += 1 + leaf_rec_size(leaf_rec(leaf, i));
+	buf_get_payload(leaf)[LEAF_COUNT] = b;
+	buf_set_size(leaf, size);
+	accdb_cache_dirty(leaf);
 }
 
+// the slot closest to splitting leaf in half by size, 0 if it has only
+// one record
 static uint8_t
-blob_find(uint8_t *sector, const void **data, size_t *size, uint8_t type)
+leaf_split_point(uint8_t *leaf)
 {
-	uint8_t *pl = buf_get_payload(sector);
-	uint8_t *end = buf_get_end(sector);
+	uint16_t half = (buf_get_size(leaf) - LEAF_SLOTS) / 2, b = 0, bb = 0;
+	uint8_t n = leaf_count(leaf), i, best = 0;
 
-	while (pl < end) {
-		if (blob_rec_get_type(pl) == type) {
-			if (size)
-				*size = blob_rec_get_size(pl);
-			*data = blob_rec_get_data(pl);
-			return 1;
-		}
+	for (i = 1; i < n; ++i) {
+		b += 1 + leaf_rec_size(leaf_rec(leaf, i - 1));
+		if (best && abs(b - half) >= abs(bb - half))
+			break;
+		best = i;
+		bb = b;
+	}
 
-		blob_rec_next(&pl);
+	return best;
+}
+
+// the first slot in leaf with a brief greater than brief, or with equal
+// set, not less than it
+static uint8_t
+leaf_search(uint8_t *leaf, const char *brief, uint8_t equal)
+{
+	uint8_t lo = 0, hi = leaf_count(leaf), mid;
+	int c;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		c = strcmp(index_rec_brief(leaf_rec(leaf, mid)), brief);
+		if (c > 0 || (equal && c == 0))
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
 
-	return 0;
+	return lo;
+}
+
+static const char *
+leaf_last_brief(uint8_t *leaf)
+{
+	chDbgAssert(leaf_count(leaf) > 0, "leaf_last_brief #1", "empty leaf");
+	return index_rec_brief(leaf_rec(leaf, leaf_count(leaf) - 1));
+}
+
+// point idx at slot in leaf, taking the reference to it
+static void
+index_point(struct accdb_index *idx, struct accdb *db, uint8_t *leaf,
+	    uint8_t slot)
+{
+	idx->db = db;
+	idx->buf = leaf;
+	idx->slot = slot;
+	idx->rec = slot < leaf_count(leaf) ? leaf_rec(leaf, slot) : NULL;
+}
+
+// the shortest separator s with last < s <= first
+static void
+tree_separator(uint8_t *key, const char *last, const char *first)
+{
+	size_t n = 0, flen = strlen(first);
+
+	while (last[n] != '\0' && last[n] == first[n])
+		++n;
+	if (n < flen) {
+		key[0] = ++n;
+	} else {
+		// last == first
+		n = flen;
+		key[0] = n | NODE_KEY_DUP;
+	}
+	memcpy(key + 1, first, n);
 }
 
+// walk from root to the leaf brief belongs in. the leaf is returned
+// referenced.
 static uint8_t *
-blob_list_find(struct accdb *db, const void **data, size_t *size,
-	       uint16_t ptr, uint8_t type)
+tree_descend(struct accdb *db, uint16_t root, const char *brief,
+	     struct tree_path *path)
 {
+	size_t blen = strlen(brief);
+	uint16_t sector = root;
 	uint8_t *buf;
 
-	while (ptr) {
-		buf = accdb_cache_get(db, ptr);
+	path->depth = 0;
+	path->dup = 0;
+	while (1) {
+		buf = accdb_cache_get(db, sector);
 		if (buf == NULL)
 			return NULL;
-		if (blob_find(buf, data, size, type))
+		if (buf_get_type(buf) == SECT_TYPE_LEAF && path->depth > 0)
 			return buf;
-		ptr = buf_get_next(buf);
+		if (buf_get_type(buf) != SECT_TYPE_NODE ||
+		    path->depth == ACCDB_TREE_DEPTH) {
+			accdb_cache_put(buf);
+			return NULL;
+		}
+		path->step[path->depth].sector = sector;
+		sector = node_find_child(buf, brief, blen,
+					 &path->step[path->depth], &path->dup);
+		path->depth++;
 		accdb_cache_put(buf);
 	}
-
-	return NULL;
 }
 
-int8_t
-accdb_index_get_brief(struct accdb_index *idx, const char **brief)
+// fill in path from node down to leaf, which holds brief. returns 1 when
+// leaf is under node, 0 when it isn't. only duplicates of brief make it
+// look under more than the one child a descent would take.
+static int8_t
+tree_find_path_from(struct accdb *db, uint16_t sector, const char *brief,
+		    size_t blen, uint16_t leaf, struct tree_path *path)
 {
-	const char *user, *pass;
-	uint16_t ptr;
+	struct tree_step *step;
+	uint8_t *node, *pl, *p;
+	uint16_t child, key;
+	int8_t rv;
 
-	if (idx->rec == NULL || !accdb_index_has_entry(idx))
+	if (path->depth == ACCDB_TREE_DEPTH)
+		return -1;
+	node = accdb_cache_get(db, sector);
+	if (node == NULL)
 		return -1;
+	if (buf_get_type(node) != SECT_TYPE_NODE) {
+		accdb_cache_put(node);
+		return 0;
+	}
+	step = &path->step[path->depth++];
+	step->sector = sector;
+	child = node_find_child(node, brief, blen, step, &path->dup);
+	accdb_cache_put(node);
 
-	if (index_rec_get_extended(idx->rec)) {
-		if (index_rec_parse_extended(idx->rec, brief, &ptr) < 0)
-			return -1;
-	} else {
-		if (index_rec_parse(idx->rec, brief, &user, &pass) < 0)
+	while (1) {
+		if (child == leaf)
+			return 1;
+		rv = tree_find_path_from(db, child, brief, blen, leaf, path);
+		if (rv != 0)
+			return rv;
+
+		// the child to the left, if the key between them is brief
+		if (step->key == 0)
+			break;
+		node = accdb_cache_get(db, sector);
+		if (node == NULL)
 			return -1;
+		pl = buf_get_payload(node);
+		p = pl + step->key;
+		if (!(p[0] & NODE_KEY_DUP) || node_key_cmp(brief, blen, p)) {
+			accdb_cache_put(node);
+			break;
+		}
+		step->child = step->key - NODE_CHILD_SIZE;
+		for (key = 0, p = pl + NODE_CHILD_SIZE; p - pl < step->key;
+		     p += NODE_ENTRY_SIZE(p))
+			key = p - pl;
+		step->key = key;
+		child = get_uint16(pl, step->child);
+		accdb_cache_put(node);
 	}
 
+	path->depth--;
 	return 0;
 }
 
-int8_t
-accdb_index_get_entry(struct accdb_index *idx, const char **brief,
-		      const char **user, const char **pass)
+static int8_t
+tree_find_path(struct accdb *db, uint16_t root, const char *brief,
+	       uint16_t leaf, struct tree_path *path)
 {
-	if (idx->rec == NULL || !accdb_index_has_entry(idx))
+	path->depth = 0;
+	path->dup = 0;
+	if (tree_find_path_from(db, root, brief, strlen(brief),
+				leaf, path) != 1)
 		return -1;
-
-	if (index_rec_get_extended(idx->rec)) {
-		uint16_t ptr;
-		if (index_rec_parse_extended(idx->rec, brief, &ptr) < 0)
-			return -1;
-		*user = NULL;
-		*pass = NULL;
-		if (!idx->blob_user) {
-			idx->blob_user = blob_list_find(idx->db,
-							(const void **)user,
-							NULL, ptr,
-							REC_BLOB_USERNAME);
-			if (idx->blob_user == NULL)
-				return -1;
-		}
-		if (!idx->blob_pass) {
-			idx->blob_pass = blob_list_find(idx->db,
-							(const void **)pass,
-							NULL, ptr,
-							REC_BLOB_PASSWORD);
-			if (idx->blob_pass == NULL)
-				return -1;
-		}
-		if (!*user && !*pass) {
-			chDbgAssert(idx->blob_user != NULL, "get entry #1",
-				    "no user blob");
-			chDbgAssert(idx->blob_pass != NULL, "get entry #2",
-				    "no pass blob");
-			blob_find(idx->blob_user, (const void **)user, NULL,
-				  REC_BLOB_USERNAME);
-			blob_find(idx->blob_pass, (const void **)pass, NULL,
-				  REC_BLOB_PASSWORD);
-		}
-		if (!*user || !*pass)
-			return -1;
-	} else {
-		if (index_rec_parse(idx->rec, brief, user, pass) < 0)
-			return -1;
-	}
-
 	return 0;
 }
 
+// add delta to the count of every child path took
 static int8_t
-blob_create(struct accdb *db, const char *user, const char *pass, uint16_t *ptr)
+tree_count_add(struct accdb *db, struct tree_path *path, int8_t delta)
 {
-	size_t blen;
-	uint8_t *rec, *blob1, *blob2;
+	uint8_t *node, *pl;
+	uint8_t d;
 
-	blob1 = blob2 = NULL;
+	for (d = 0; d < path->depth; ++d) {
+		node = accdb_cache_get(db, path->step[d].sector);
+		if (node == NULL)
+			return -1;
+		pl = buf_get_payload(node);
+		node_set_count(pl, path->step[d].child,
+			       node_count(pl, path->step[d].child) + delta);
+		accdb_cache_put_dirty(node);
+	}
 
-	blob1 = accdb_allocate_buf(db, SECT_TYPE_BLOB);
-	if (blob1 == NULL)
-		goto out;
+	return 0;
+}
 
-	blen = strlen(user) + 1;		
-	rec = buf_allocate_record(blob1, blen + 2);
-	if (rec == NULL)
-		goto out;
-	if (blob_rec_create(rec, REC_BLOB_USERNAME, user, blen) < 0)
-		goto out;
+// the first leaf under root or, with last set, the last one. it's
+// returned referenced. path, if given, gets the way down to it.
+static uint8_t *
+tree_edge(struct accdb *db, uint16_t root, uint8_t last,
+	  struct tree_path *path)
+{
+	struct tree_step *step;
+	uint16_t sector = root, off, key;
+	uint8_t *buf, *pl;
+	uint8_t depth = 0;
 
-	blen = strlen(pass) + 1;
-	rec = buf_allocate_record(blob1, blen + 2);
-	if (rec == NULL) {
-		blob2 = accdb_allocate_buf(db, SECT_TYPE_BLOB);
-		if (blob2 == NULL)
-			goto out;
-		rec = buf_allocate_record(blob2, blen + 2);
-		if (rec == NULL)
-			goto out;
-		if (accdb_list_append(db, blob1, blob2) < 0)
-			goto out;
+	while (1) {
+		buf = accdb_cache_get(db, sector);
+		if (buf == NULL)
+			return NULL;
+		if (buf_get_type(buf) == SECT_TYPE_LEAF && depth > 0)
+			break;
+		if (buf_get_type(buf) != SECT_TYPE_NODE ||
+		    depth == ACCDB_TREE_DEPTH) {
+			accdb_cache_put(buf);
+			return NULL;
+		}
+		pl = buf_get_payload(buf);
+		off = key = 0;
+		while (last && off + NODE_CHILD_SIZE < buf_get_size(buf)) {
+			key = off + NODE_CHILD_SIZE;
+			off = key + 1 + NODE_KEY_LEN(pl + key);
+		}
+		if (path != NULL) {
+			step = &path->step[depth];
+			step->sector = sector;
+			step->child = off;
+			step->key = key;
+		}
+		sector = get_uint16(pl, off);
+		accdb_cache_put(buf);
+		depth++;
 	}
-	if (blob_rec_create(rec, REC_BLOB_PASSWORD, pass, blen) < 0)
-		goto out;
 
-	chDbgAssert(blob1, "create_blob #1", "");
-	*ptr = accdb_cache_sector(blob1);
+	if (path != NULL) {
+		path->depth = depth;
+		path->dup = 0;
+	}
+	return buf;
+}
 
-	if (blob1)
-		accdb_cache_put_dirty(blob1);
-	if (blob2)
-		accdb_cache_put_dirty(blob2);
+// put separator key, and child to the right of it, into the last node of
+// path, after the child that was taken. the two now hold nleft and nright
+// records. full nodes are split, and their middle key goes up a level, or
+// with append set, for a path down the right edge of the tree, their last
+// key.
+static int8_t
+tree_insert_sep(struct accdb *db, struct tree_path *path,
+		const uint8_t *key, uint16_t child, uint32_t nleft,
+		uint32_t nright, uint8_t append)
+{
+	uint8_t up[2][REC_INDEX_ENTRY_MAX];
+	uint8_t *node, *right, *pl, *p;
+	uint16_t off, m, mend, size;
+	uint8_t d = path->depth, u = 0;
+
+	while (d-- > 0) {
+		node = accdb_cache_get(db, path->step[d].sector);
+		if (node == NULL)
+			return -1;
+		node_set_count(buf_get_payload(node), path->step[d].child,
+			       nleft);
+		off = path->step[d].child + NODE_CHILD_SIZE;
+		if (buf_get_available(node) >=
+		    1 + NODE_KEY_LEN(key) + NODE_CHILD_SIZE) {
+			node_put_entry(node, off, key, child, nright);
+			accdb_cache_put_dirty(node);
+			return 0;
+		}
 
-	return 0;
+		if (d == 0) {
+			// the root stays put. its contents move to a new only
+			// child, which is split below with the root as parent.
+			right = accdb_allocate_buf(db, SECT_TYPE_NODE);
+			if (right == NULL) {
+				accdb_cache_put(node);
+				return -1;
+			}
+			memcpy(buf_get_payload(right), buf_get_payload(node),
+			       buf_get_size(node));
+			buf_set_size(right, buf_get_size(node));
+			buf_set_size(node, NODE_CHILD_SIZE);
+			set_uint16(buf_get_payload(node), 0,
+				   accdb_cache_sector(right));
+			node_set_count(buf_get_payload(node), 0,
+				       node_sum(right));
+			accdb_cache_put_dirty(node);
+			node = right;
+			path->step[d].child = path->step[d].key = 0;
+			d++;
+		}
 
-out:
-	if (blob1)
-		accdb_deallocate_buf(db, blob1);
-	if (blob2)
-		accdb_deallocate_buf(db, blob2);
+		right = accdb_allocate_buf(db, SECT_TYPE_NODE);
+		if (right == NULL) {
+			accdb_cache_put(node);
+			return -1;
+		}
+		pl = buf_get_payload(node);
+		size = buf_get_size(node);
+		if (append && off == size) {
+			m = NODE_CHILD_SIZE;
+			for (p = pl + NODE_CHILD_SIZE; p < pl + size;
+			     p += NODE_ENTRY_SIZE(p))
+				m = p - pl;
+		} else {
+			m = node_split_point(node);
+		}
+		mend = m + 1 + NODE_KEY_LEN(pl + m);
+		memcpy(up[u], pl + m, mend - m);
+		memcpy(buf_get_payload(right), pl + mend, size - mend);
+		buf_set_size(right, size - mend);
+		buf_set_size(node, m);
+		if (off <= m)
+			node_put_entry(node, off, key, child, nright);
+		else
+			node_put_entry(right, off - mend, key, child,
+				       nright);
+		nleft = node_sum(node);
+		nright = node_sum(right);
+		accdb_cache_put_dirty(node);
+		key = up[u];
+		u ^= 1;
+		child = accdb_cache_sector(right);
+		accdb_cache_put_dirty(right);
+	}
 
 	return -1;
 }
 
-int8_t
-accdb_add(struct accdb *db, struct accdb_index *idx,
-	  const char *brief, const char *user, const char *pass)
+// a new leaf after leaf on the list, or NULL
+static uint8_t *
+leaf_after(struct accdb *db, uint8_t *leaf)
 {
-	uint8_t len;
-	enum index_type type;
-	uint16_t ptr = 0, blob = 0;
+	uint8_t *right = leaf_allocate(db);
 
-	type = index_rec_find_type(brief, user, pass, &len);
-	if (type == INDEX_INVALID)
-		return -1;
+	if (right == NULL)
+		return NULL;
+	if (accdb_list_append(db, leaf, right) < 0) {
+		accdb_deallocate_buf(db, right);
+		return NULL;
+	}
 
-	if (accdb_index_init_internal(db, idx) < 0)
-		return -1;
+	return right;
+}
 
-	if (type == INDEX_EXT) {
-		if (blob_create(db, user, pass, &blob) < 0)
-			goto out;
+// split leaf, which path leads to, with right, an empty leaf from
+// leaf_after, taking the upper half, and put rec, len bytes long, at slot
+// at. with replace set, it takes the place of the record at that slot,
+// and the counts stay as they are. a record for the end of the last leaf,
+// as a sorted load adds, starts right on its own, so the leaves left
+// behind are full. idx is left on rec, and takes the references to both.
+static int8_t
+leaf_split_insert(struct accdb *db, uint16_t root, struct tree_path *path,
+		  uint8_t *leaf, uint8_t *right, uint8_t at,
+		  const uint8_t *rec, uint8_t len, uint8_t replace,
+		  struct accdb_index *idx)
+{
+	uint8_t key[REC_INDEX_ENTRY_MAX];
+	uint16_t sector;
+	uint8_t b, left, append, nleft, nright;
+
+	if (replace)
+		leaf_remove(leaf, at);
+	append = at == leaf_count(leaf) && !buf_get_next(right);
+	b = append ? at : leaf_split_point(leaf);
+	leaf_move(leaf, b, right);
+	left = at < b || (at == b &&
+			  buf_get_available(leaf) >= LEAF_REC_SIZE(len) + 1);
+	if (left)
+		memcpy(leaf_insert(leaf, at, len), rec, len);
+	else
+		memcpy(leaf_insert(right, at - b, len), rec, len);
+	tree_separator(key, leaf_last_brief(leaf),
+		       index_rec_brief(leaf_rec(right, 0)));
+	sector = accdb_cache_sector(right);
+	if (root == INDEX_START(db) && !buf_get_next(right))
+		db->tail = sector;
+	nleft = leaf_count(leaf);
+	nright = leaf_count(right);
+	if (left) {
+		accdb_cache_put_dirty(right);
+		index_point(idx, db, leaf, at);
+	} else {
+		accdb_cache_put_dirty(leaf);
+		index_point(idx, db, right, at - b);
 	}
 
-	// traverse the index, looking for space for the new entry
-	idx->rec = NULL;
-	while (1) {
-		idx->rec = buf_allocate_record(idx->buf, len);
-		ptr = buf_get_next(idx->buf);
-		if (idx->rec || !ptr)
-			break;
-		accdb_cache_put(idx->buf);
-		idx->buf = accdb_cache_get(db, ptr);
-		if (idx->buf == NULL)
-			goto out;
-	} 
-
-	// no space, make a new index sector
-	if (!idx->rec) {
-		uint8_t *tmp = accdb_allocate_buf(db, SECT_TYPE_INDEX);
-		if (tmp == NULL)
-			goto out;
-		if (accdb_list_append(db, idx->buf, tmp) < 0) {
-			accdb_deallocate_buf(db, tmp);
-			goto out;
-		}
-		accdb_cache_put(idx->buf);
-		//accdb_cache_flush(db);
-		idx->buf = tmp;
-		idx->rec = buf_allocate_record(idx->buf, len);
-		if (idx->rec == NULL)
-			goto out;
-	}
-
-	if (type == INDEX_EXT) {
-		chDbgAssert(blob != 0, "accdb_add #1", "");
-		if (index_rec_create_extended(idx->rec, brief, blob) < 0)
-			goto out;
-	} else {
-		if (index_rec_create(idx->rec, brief, user, pass) < 0)
-			goto out;
-	}
-
-	// idx will now point to the new record
-
-	return 0;
-
-out:
-	accdb_index_clear(idx);
-
-	return -1;
+	if (!replace && tree_count_add(db, path, 1) < 0)
+		return -1;
+	return tree_insert_sep(db, path, key, sector, nleft, nright, append);
 }
 
+// put the index record rec, len bytes long, in its place in the tree. idx
+// is left pointing at it.
 static int8_t
-convert_to_extended(struct accdb_index *idx)
+tree_insert(struct accdb *db, uint16_t root, struct accdb_index *idx,
+	    const uint8_t *rec, uint8_t len)
 {
-	const char *brief, *user, *pass;
-	uint16_t blob;
-	uint8_t *modp, *endp;
-	
-	if (index_rec_parse(idx->rec, &brief, &user, &pass) < 0)
-		return -1;
-	
-	if (blob_create(idx->db, user, pass, &blob) < 0)
-		return -1;
-
-	endp = idx->rec + index_rec_get_total_size(idx->rec);
-	modp = idx->rec + 1 + strlen(brief) + 1;
+	struct tree_path path;
+	uint8_t *leaf, *right, *edge;
+	uint8_t at;
 
-	// we assert here that it's possible to convert any short index
-	// entry to an extended entry in place, assuming the brief stays
-	// the same. the 16-bit pointer would take up the same amount of
-	// space as a blank username and password.
-
-	chDbgAssert(endp - modp >= 2, "convert_to_extended #1", "");
-	set_uint16(modp, 0, blob);
-	modp += 2;
+	accdb_index_clear(idx);
+	// a record for the end of the index goes straight into the last
+	// leaf, when there's room, with no keys to compare on the way down:
+	// only the counts down the right edge change. it's only looked at
+	// while it's cached, as it is when adding in order, so adds in any
+	// other order don't pay a read for it.
+	if (root == INDEX_START(db) && db->tail &&
+	    accdb_hash_find(db, db->tail)) {
+		leaf = accdb_cache_get(db, db->tail);
+		if (leaf == NULL)
+			return -1;
+		if (buf_get_available(leaf) >= LEAF_REC_SIZE(len) + 1 &&
+		    (leaf_count(leaf) == 0 || strcmp(index_rec_brief(rec),
+					leaf_last_brief(leaf)) >= 0)) {
+			edge = tree_edge(db, root, 1, &path);
+			if (edge == NULL)
+				goto fail;
+			accdb_cache_put(edge);
+			chDbgAssert(edge == leaf, "tree_insert #1",
+				    "tail isn't the last leaf");
+			if (tree_count_add(db, &path, 1) < 0)
+				goto fail;
+			at = leaf_count(leaf);
+			memcpy(leaf_insert(leaf, at, len), rec, len);
+			index_point(idx, db, leaf, at);
+			return 0;
+		}
+		accdb_cache_put(leaf);
+	}
 
-	// shave off the unused part of the new record
-	if (modp < endp) {
-		buf_deallocate_record(idx->buf, modp,
-				      endp - modp);
+	leaf = tree_descend(db, root, index_rec_brief(rec), &path);
+	if (leaf == NULL)
+		return -1;
+	if (root == INDEX_START(db) && !buf_get_next(leaf))
+		db->tail = accdb_cache_sector(leaf);
+	at = leaf_search(leaf, index_rec_brief(rec), 0);
+
+	if (buf_get_available(leaf) >= LEAF_REC_SIZE(len) + 1) {
+		if (tree_count_add(db, &path, 1) < 0)
+			goto fail;
+		memcpy(leaf_insert(leaf, at, len), rec, len);
+		index_point(idx, db, leaf, at);
+		return 0;
 	}
 
-	index_rec_set_extended(idx->rec, 1);
-	index_rec_set_size(idx->rec, modp - idx->rec - 1);
-	accdb_cache_dirty(idx->buf);
+	right = leaf_after(db, leaf);
+	if (right == NULL)
+		goto fail;
+	return leaf_split_insert(db, root, &path, leaf, right, at, rec, len,
+				 0, idx);
 
-	return 0;
+fail:
+	accdb_cache_put(leaf);
+	return -1;
 }
 
-int8_t
-accdb_add_note(struct accdb_index *idx, void *data, size_t size)
+// drop the child path ends at from its parent, along with any node that
+// leaves without children. the records under it have to be gone, or
+// counted under another child, already.
+static int8_t
+tree_remove_child(struct accdb *db, struct tree_path *path)
 {
-	uint16_t blob = 0;
-	const char *brief;
-	uint8_t *buf, *note;
-
-	if (!accdb_index_has_entry(idx))
-		return -1;
-	if (size > REC_BLOB_ENTRY_MAX)
-		return -1;
-	if (index_rec_get_extended(idx->rec) == 0 &&
-	    convert_to_extended(idx) < 0)
-		return -1;
-	if (index_rec_parse_extended(idx->rec, &brief, &blob) < 0)
-		return -1;
-	
-	chDbgAssert(blob != 0, "accdb_add_note #1", "");	
-	// search for free spot in blob list for new note
-	note = NULL;
-	buf = NULL;
-	while (!note && blob) {
-		if (buf)
-			accdb_cache_put(buf);
-		buf = accdb_cache_get(idx->db, blob);
-		if (buf == NULL)
-			return -1;
-		note = buf_allocate_record(buf, size + 2);
-		blob = buf_get_next(buf);
-	}
-
-	// no space, create new blob
-	if (!note) {
-		uint8_t *tmp;
-
-		chDbgAssert(buf != NULL, "accdb_add_note #2", "");
-		tmp = accdb_allocate_buf(idx->db, SECT_TYPE_BLOB);
-		if (!tmp)
-			return -1;
-		if (accdb_list_append(idx->db, buf, tmp) < 0) {
-			accdb_deallocate_buf(idx->db, tmp);
+	struct tree_step *step;
+	uint8_t *node;
+	uint8_t d = path->depth;
+
+	while (d-- > 0) {
+		step = &path->step[d];
+		node = accdb_cache_get(db, step->sector);
+		if (node == NULL)
 			return -1;
+		if (buf_get_size(node) == NODE_CHILD_SIZE) {
+			// that was its only child
+			chDbgAssert(d != 0,
+				    "tree_remove_child #1", "root emptied");
+			if (accdb_deallocate_buf(db, node) < 0)
+				return -1;
+			continue;
 		}
-		note = buf_allocate_record(tmp, size + 2);
-		if (note == NULL) {
-			accdb_deallocate_buf(idx->db, tmp);
-			return -1;
+		if (step->key == 0) {
+			// the next child takes the first one's place
+			buf_deallocate_section(node, 0, NODE_CHILD_SIZE + 1 +
+				NODE_KEY_LEN(buf_get_payload(node) +
+					     NODE_CHILD_SIZE));
+		} else {
+			buf_deallocate_section(node, step->key, step->child +
+					       NODE_CHILD_SIZE - step->key);
 		}
-		accdb_cache_put_dirty(buf);
-		buf = tmp;
+		accdb_cache_put_dirty(node);
+		break;
 	}
-	
-	chDbgAssert(buf != NULL, "accdb_add_note #3", "");
-	if (blob_rec_create(note, REC_BLOB_NOTE, data, size) < 0)
-		return -1;
-	accdb_cache_put_dirty(buf);
 
 	return 0;
 }
 
-int8_t
-accdb_index_next_note(struct accdb_index *idx, const void **note, size_t *size)
+// lower the tree while the root has only one child, and it's a node
+static int8_t
+tree_collapse(struct accdb *db, uint16_t sector)
 {
-	uint8_t *rec, *end;
-
-	if (!index_rec_get_extended(idx->rec))
-		return -1;
-
-	if (idx->blob_note == NULL || *note == NULL) {
-		const char *brief;
-		uint16_t blob = 0;
-		*note = NULL;
-		if (index_rec_parse_extended(idx->rec, &brief, &blob) < 0)
-			return -1;
-		if (idx->blob_note)
-			accdb_cache_put(idx->blob_note);
-		idx->blob_note = blob_list_find(idx->db, note, size, blob,
-						REC_BLOB_NOTE);
-		return 0;
-	}
+	uint8_t *root, *child;
+	int8_t rv = 0;
 
-	chDbgAssert(idx->blob_note, "accdb_index_next_note #1", "");
-	rec = ((uint8_t *)*note) - 2;
-	end = buf_get_end(idx->blob_note);
-	if (rec < buf_get_payload(idx->blob_note) || rec >= end)
+	root = accdb_cache_get(db, sector);
+	if (root == NULL)
 		return -1;
-
-	blob_rec_next(&rec);
-	if (rec >= end) {
-		*note = NULL;
-		accdb_cache_put(idx->blob_note);
-		idx->blob_note = blob_list_find(idx->db, note, size,
-						buf_get_next(idx->blob_note),
-						REC_BLOB_NOTE);
-	} else {
-		// username and password blobs are always the first
-		// to appear in the blob list, so if this is not the
-		// case, something's wrong.
-		if (blob_rec_get_type(rec) != REC_BLOB_NOTE)
-			return -1;
-		*note = blob_rec_get_data(rec);
-		*size = blob_rec_get_size(rec);
+	while (buf_get_size(root) == NODE_CHILD_SIZE) {
+		child = accdb_cache_get(db, get_uint16(buf_get_payload(root),
+						       0));
+		if (child == NULL) {
+			rv = -1;
+			break;
+		}
+		if (buf_get_type(child) != SECT_TYPE_NODE) {
+			accdb_cache_put(child);
+			break;
+		}
+		memcpy(buf_get_payload(root), buf_get_payload(child),
+		       buf_get_size(child));
+		buf_set_size(root, buf_get_size(child));
+		accdb_cache_dirty(root);
+		if (accdb_deallocate_buf(db, child) < 0) {
+			rv = -1;
+			break;
+		}
 	}
+	accdb_cache_put(root);
 
-	return 0;
-}
-
-static int8_t
-chuser_in_place(struct accdb_index *idx, const char *user, const char *pass)
-{
-}
-
-int8_t
-accdb_chuser(struct accdb_index *idx, const char *new_user)
-{
-	return 0;
-}
-
-int8_t
-accdb_chpass(struct accdb_index *idx, const char *new_pass)
-{
-	return 0;
+	return rv;
 }
 
-
-// note: the index is moved to the next available record.
-// the rules for adjustment are:
-//	1. if record(s) exist after the removed record in the same page,
+// remove the record idx points at from the tree at root, and move idx
+// on to the next one. the rules for adjustment are:
+//	1. if record(s) exist after the removed record in the same leaf,
 //	   nothing is done, except to move the record pointer to the next
 //	   record.
 //	2. if the removed record is the last on the page, and there is a
@@ -1516,318 +2821,4594 @@ accdb_chpass(struct accdb_index *idx, const char *new_pass)
 //	   no more pages in the index, the index points to the end of the
 //	   of that final page.
 //	
-int8_t
-accdb_del(struct accdb_index *idx)
+static int8_t
+tree_delete(struct accdb *db, uint16_t root, struct accdb_index *idx)
 {
-	struct accdb *db;
-	uint8_t *buf, *rec;
+	struct tree_path path;
+	uint8_t *buf;
 	uint16_t next;
 	uint16_t prev;
+	uint8_t slot, empty;
 
-	if (!accdb_index_has_entry(idx))
-		return -1;
-
-	db = idx->db;
 	buf = accdb_cache_ref(idx->buf);
-	rec = idx->rec;
+	slot = idx->slot;
 	accdb_index_clear(idx);
 	next = buf_get_next(buf);
 	prev = buf_get_prev(buf);
 
-	if (index_rec_get_extended(rec)) {
-		const char *brief;
-		uint16_t ptr;
-
-		if (index_rec_parse_extended(rec, &brief, &ptr) < 0)
-			return -1;
-		if (accdb_list_clear(db, ptr) < 0)
-			return -1;
+	// the counts on the way to it go down by one, and a leaf that's
+	// emptied goes, unless it's the only one. find the way while its
+	// brief is still there to go by.
+	empty = leaf_count(buf) == 1 && (prev || next);
+	if (tree_find_path(db, root, index_rec_brief(leaf_rec(buf, slot)),
+			   accdb_cache_sector(buf), &path) < 0 ||
+	    tree_count_add(db, &path, -1) < 0) {
+		accdb_cache_put(buf);
+		return -1;
 	}
-	
-	buf_deallocate_record(buf, rec, index_rec_get_total_size(rec));
 
-	if (buf_get_size(buf) == 0 && prev != 0) {
-		// remove this index page if it's empty (and not INDEX_START)
-		chDbgAssert(accdb_cache_sector(buf) != INDEX_START(db),
-			    "accdb_del #1", "can't remove START");
+	leaf_remove(buf, slot);
+
+	if (empty) {
+		if (root == INDEX_START(db)) {
+			find_invalidate(db);
+			db->compact_next = 0;
+			db->tail = 0;
+		}
 		if (accdb_list_remove(db, buf) < 0)
 			return -1;
 		if (accdb_deallocate_buf(db, buf) < 0)
 			return -1;
+		if (tree_remove_child(db, &path) < 0 ||
+		    tree_collapse(db, root) < 0)
+			return -1;
 
 		if (next) {
 			buf = accdb_cache_get(db, next);
 			if (buf == NULL)
 				return -1;
-			rec = buf_get_payload(buf);
+			slot = 0;
 		} else {
-			chDbgAssert(prev, "accdb_del #2", "");
+			chDbgAssert(prev, "tree_delete #1", "");
 			buf = accdb_cache_get(db, prev);
 			if (buf == NULL)
 				return -1;
-			rec = buf_get_end(buf);
+			slot = leaf_count(buf);
 		}
-	} else if (rec >= buf_get_end(buf) && next) {
+	} else if (slot >= leaf_count(buf) && next) {
 		accdb_cache_put(buf);
 		buf = accdb_cache_get(db, next);
 		if (!buf)
 			return -1;
-		rec = buf_get_payload(buf);
+		slot = 0;
 	}
 
 	// reconstruct the index
-	idx->db = db;
-	idx->buf = buf;
-	idx->rec = rec;
+	index_point(idx, db, buf, slot);
 
 	return 0;
 }
 
-int8_t
-accdb_open(struct accdb *db, struct file *fp, struct pool *pool)
+// point idx at the first record with a brief not less than brief, or at
+// the end of the last leaf if there's none. with accdb_index_next, this
+// makes a range scan.
+static int8_t
+tree_seek(struct accdb *db, uint16_t root, struct accdb_index *idx,
+	  const char *brief)
 {
-	db->fp = fp;
-	db->strategy = CACHE_MRU;
-	db->pool = pool;
-	db->cleanup.cb = (try_free_cb)accdb_cache_do_cleanup;
-	db->cleanup.arg = db;
-	pool_add_cleanup(pool, &db->cleanup);
-	accdb_cache_init(db);
-	db->sect_start = vfs_start_sector(fp);
-	
+	struct tree_path path;
+	uint8_t *buf, *tmp;
+	uint16_t ptr;
+	uint8_t slot, s;
+
+	accdb_index_clear(idx);
+	buf = tree_descend(db, root, brief, &path);
+	if (buf == NULL)
+		return -1;
+	slot = leaf_search(buf, brief, 1);
+
+	// duplicates of brief can start in a leaf to the left
+	while (path.dup && slot == 0 && (ptr = buf_get_prev(buf)) != 0) {
+		tmp = accdb_cache_get(db, ptr);
+		if (tmp == NULL)
+			goto fail;
+		s = leaf_search(tmp, brief, 1);
+		if (s == leaf_count(tmp)) {
+			accdb_cache_put(tmp);
+			break;
+		}
+		accdb_cache_put(buf);
+		buf = tmp;
+		slot = s;
+	}
+
+	// nothing here, it's the first record of the next leaf
+	if (slot == leaf_count(buf) && (ptr = buf_get_next(buf)) != 0) {
+		accdb_cache_put(buf);
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return -1;
+		slot = 0;
+	}
+
+	index_point(idx, db, buf, slot);
+
 	return 0;
+
+fail:
+	accdb_cache_put(buf);
+	return -1;
 }
 
 int8_t
-accdb_close(struct accdb *db)
+accdb_index_seek_brief(struct accdb *db, struct accdb_index *idx,
+		       const char *brief)
 {
-	size_t i;
+	return tree_seek(db, INDEX_START(db), idx, brief);
+}
 
-	if (accdb_cache_clear(db) < 0)
+// point idx at the first record for brief. -1 if there's none.
+int8_t
+accdb_index_lookup(struct accdb *db, struct accdb_index *idx,
+		   const char *brief)
+{
+	if (accdb_index_seek_brief(db, idx, brief) < 0)
+		return -1;
+	if (!accdb_index_has_entry(idx) ||
+	    strcmp(index_rec_brief(idx->rec), brief) != 0) {
+		accdb_index_clear(idx);
 		return -1;
-
-	pool_del_cleanup(db->pool, &db->cleanup);
-
-	for (i = 0; i < ACCDB_CACHE_SIZE; ++i) {
-		struct sector *s = &db->cache[i];
-		if (s->buf)
-			pool_deallocate_block(db->pool, s->buf);
 	}
 
 	return 0;
 }
 
-//// Self-Tests ////
+int8_t
+accdb_index_init(struct accdb *db, struct accdb_index *idx)
+{
+	return accdb_index_seek_brief(db, idx, "");
+}
 
-void
-test_accdb(struct accdb *db)
+// the number of records in the index. the first call after open adds up
+// the counts in the root. after that, accdb_add and accdb_del keep it.
+int8_t
+accdb_count(struct accdb *db, uint32_t *count)
 {
-	size_t i;
-	char brief[32], user[32], pass[32];
-	char *bigbuf;
-	const char *briefp, *userp, *passp;
-	struct accdb_index idx;
-	accdb_id_t *id;
-	const void *note;
-	size_t size;
+	uint8_t *root;
 
-	bigbuf = (char*)pool_allocate_block(db->pool, NULL);
-	v_assert(bigbuf != NULL);
+	if (db->count == ACCDB_COUNT_UNKNOWN) {
+		root = accdb_cache_get(db, INDEX_START(db));
+		if (root == NULL)
+			return -1;
+		if (buf_get_type(root) != SECT_TYPE_NODE) {
+			accdb_cache_put(root);
+			return -1;
+		}
+		db->count = node_sum(root);
+		accdb_cache_put(root);
+	}
+	*count = db->count;
 
-	// sizeof(accdb_id_t) == 4
-	// 4 * 128 == 512
+	return 0;
+}
+
+// point idx at record n of the index, counting from 0, or past the last
+// one if there aren't that many. it goes down the tree by the counts of
+// the children, so it reads a page per level, and no records are looked
+// at.
+int8_t
+accdb_index_seek(struct accdb *db, struct accdb_index *idx, uint32_t n)
+{
+	uint16_t sector = INDEX_START(db), off, size;
+	uint8_t *buf, *pl;
+	uint8_t depth = 0;
+
+	accdb_index_clear(idx);
+	while (1) {
+		buf = accdb_cache_get(db, sector);
+		if (buf == NULL)
+			return -1;
+		if (buf_get_type(buf) == SECT_TYPE_LEAF && depth > 0)
+			break;
+		if (buf_get_type(buf) != SECT_TYPE_NODE ||
+		    depth == ACCDB_TREE_DEPTH) {
+			accdb_cache_put(buf);
+			return -1;
+		}
+		// the child record n is under, or the last one
+		pl = buf_get_payload(buf);
+		size = buf_get_size(buf);
+		off = 0;
+		while (n >= node_count(pl, off) &&
+		       off + NODE_CHILD_SIZE < size) {
+			n -= node_count(pl, off);
+			off += NODE_CHILD_SIZE;
+			off += 1 + NODE_KEY_LEN(pl + off);
+		}
+		sector = get_uint16(pl, off);
+		accdb_cache_put(buf);
+		depth++;
+	}
+
+	if (n > leaf_count(buf))
+		n = leaf_count(buf);
+	index_point(idx, db, buf, n);
+
+	return 0;
+}
+
+/*
+Find
+
+accdb_find answers from a table in RAM before going down the tree. Each
+slot holds 16 bits of a hash of a brief and the leaf a record with that
+brief was last seen in, so a hit costs reading one leaf. Leaves split and
+records move, so the leaf is searched, and when the brief isn't there, or
+duplicates of it may start in an earlier leaf, the tree is used instead.
+
+The table is built by walking the leaves on the first accdb_find after
+open, format, or a leaf being freed, since a freed leaf still looks like
+one. accdb_add puts new briefs in it. Slots for deleted records stay until
+the next build. While it holds every brief, a hash with no slot is an
+answer too: there's no such record, and nothing is read.
+
+It gets at most ACCDB_FIND_BUDGET bytes, or what accdb_find_budget gives
+it. With more records than slots, the same memory becomes a Bloom filter
+of the briefs, FIND_BLOOM_K bits each. That can't say where a record is,
+but a brief with any of its bits clear has no record, again without
+reading anything, and everything else goes down the tree. Deleted briefs
+keep their bits, which only costs false positives, until the budget is
+changed or the db is formatted.
+*/
+
+// slots filled before the table is rebuilt, or given up on
+#define FIND_LIMIT(n)		((n) / 2 + (n) / 4)
+#define FIND_BLOOM_K		3
+
+// FNV-1a
+static uint32_t
+brief_hash(const char *brief)
+{
+	uint32_t h = 2166136261UL;
+
+	while (*brief) {
+		h ^= (uint8_t)*brief++;
+		h *= 16777619UL;
+	}
+
+	return h;
+}
+
+// 0 marks an empty slot
+static inline uint16_t
+find_tag(uint32_t h)
+{
+	return (h >> 16) ? (h >> 16) : 1;
+}
+
+// note that a brief hashing to h is in leaf sector. 0 if it's noted, -1
+// if the table is full.
+static int8_t
+find_put(struct accdb *db, uint32_t h, uint16_t sector)
+{
+	uint16_t mask = db->find_size - 1;
+	uint16_t tag = find_tag(h);
+	uint16_t i;
+
+	for (i = h & mask; db->find[i].tag; i = (i + 1) & mask) {
+		if (db->find[i].tag == tag && db->find[i].sector == sector)
+			return 0;
+	}
+	if (db->find_used >= FIND_LIMIT(db->find_size))
+		return -1;
+	db->find[i].tag = tag;
+	db->find[i].sector = sector;
+	db->find_used++;
+
+	return 0;
+}
+
+// the bits for a brief hashing to h, by double hashing
+#define FIND_BLOOM_BIT(db, h, h2, k) \
+	(((h) + (k) * (h2)) & ((uint32_t)(db)->find_size * 32 - 1))
+
+static inline uint32_t
+find_bloom_h2(uint32_t h)
+{
+	return ((h >> 17) | (h << 15)) | 1;
+}
+
+static void
+find_bloom_put(struct accdb *db, uint32_t h)
+{
+	uint8_t *bits = (uint8_t *)db->find;
+	uint32_t h2 = find_bloom_h2(h), b;
+	uint8_t k;
+
+	for (k = 0; k < FIND_BLOOM_K; ++k) {
+		b = FIND_BLOOM_BIT(db, h, h2, k);
+		bits[b >> 3] |= 1 << (b & 7);
+	}
+	if (db->find_used < 0xffff)
+		db->find_used++;
+}
+
+static uint8_t
+find_bloom_has(struct accdb *db, uint32_t h)
+{
+	uint8_t *bits = (uint8_t *)db->find;
+	uint32_t h2 = find_bloom_h2(h), b;
+	uint8_t k;
+
+	for (k = 0; k < FIND_BLOOM_K; ++k) {
+		b = FIND_BLOOM_BIT(db, h, h2, k);
+		if (!(bits[b >> 3] & (1 << (b & 7))))
+			return 0;
+	}
+
+	return 1;
+}
+
+// the table can't be trusted after this, it's built again when needed
+static inline void
+find_invalidate(struct accdb *db)
+{
+	if (db->find_state == ACCDB_FIND_BUILT)
+		db->find_state = ACCDB_FIND_UNBUILT;
+}
+
+// note a record added to the leaf it went into
+static void
+find_added(struct accdb *db, const char *brief, uint16_t sector)
+{
+	if (db->find_state == ACCDB_FIND_BLOOM)
+		find_bloom_put(db, brief_hash(brief));
+	else if (db->find_state == ACCDB_FIND_BUILT &&
+		 find_put(db, brief_hash(brief), sector) < 0)
+		db->find_state = ACCDB_FIND_UNBUILT;
+}
+
+// put every brief in the table, as find_state says. 1 if they don't fit
+// in slots.
+static int8_t
+find_walk(struct accdb *db)
+{
+	struct accdb_index idx;
+	uint8_t *buf;
+	uint16_t ptr;
+	uint32_t h;
+	uint8_t i;
+
+	memset(db->find, 0, sizeof(*db->find) * db->find_size);
+	db->find_used = 0;
+	memset(&idx, 0, sizeof(idx));
+	if (accdb_index_init(db, &idx) < 0)
+		return -1;
+	buf = accdb_cache_ref(idx.buf);
+	accdb_index_clear(&idx);
+	while (1) {
+		accdb_cache_prefetch(db, buf);
+		for (i = 0; i < leaf_count(buf); ++i) {
+			h = brief_hash(index_rec_brief(leaf_rec(buf, i)));
+			if (db->find_state == ACCDB_FIND_BLOOM) {
+				find_bloom_put(db, h);
+			} else if (find_put(db, h,
+					    accdb_cache_sector(buf)) < 0) {
+				accdb_cache_put(buf);
+				return 1;
+			}
+		}
+		ptr = buf_get_next(buf);
+		accdb_cache_put(buf);
+		if (!ptr)
+			break;
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int8_t
+find_build(struct accdb *db)
+{
+	int8_t rv;
+
+	db->find_state = ACCDB_FIND_BUILT;
+	rv = find_walk(db);
+	if (rv == 1) {
+		db->find_state = ACCDB_FIND_BLOOM;
+		rv = find_walk(db);
+	}
+	if (rv < 0)
+		db->find_state = ACCDB_FIND_UNBUILT;
+
+	return rv;
+}
+
+// the first record for brief in leaf, at slot, is the first of all unless
+// it starts the leaf and the one before ends with a duplicate of it
+static int8_t
+find_is_first(struct accdb *db, uint8_t *leaf, uint8_t slot,
+	      const char *brief)
+{
+	uint8_t *prev;
+	int8_t rv;
+
+	if (slot > 0 || buf_get_prev(leaf) == 0)
+		return 1;
+	prev = accdb_cache_get(db, buf_get_prev(leaf));
+	if (prev == NULL)
+		return -1;
+	rv = leaf_count(prev) == 0 ||
+	     strcmp(leaf_last_brief(prev), brief) != 0;
+	accdb_cache_put(prev);
+
+	return rv;
+}
+
+// give the accdb_find table bytes of RAM, 0 to go without. it's built
+// again on the next accdb_find.
+int8_t
+accdb_find_budget(struct accdb *db, size_t bytes)
+{
+	size_t n = 1;
+
+	if (db->find)
+		fast_free(db->find);
+	db->find = NULL;
+	db->find_size = 0;
+	db->find_used = 0;
+	db->find_state = ACCDB_FIND_UNBUILT;
+
+	while (n * 2 * sizeof(*db->find) <= bytes && n * 2 <= 0x8000)
+		n *= 2;
+	if (n < 4)
+		return 0;
+	db->find = fast_malloc(sizeof(*db->find) * n);
+	if (db->find == NULL)
+		return -1;
+	db->find_size = n;
+
+	return 0;
+}
+
+// point idx at the first record for brief, like accdb_index_lookup. -1
+// if there's none.
+int8_t
+accdb_find(struct accdb *db, const char *brief, struct accdb_index *idx)
+{
+	struct accdb_find_slot *slot;
+	uint32_t h = brief_hash(brief);
+	uint16_t mask = db->find_size - 1;
+	uint16_t tag = find_tag(h);
+	uint16_t i;
+	uint8_t *buf, at, seen = 0;
+
+	if (db->find != NULL && db->find_state == ACCDB_FIND_UNBUILT &&
+	    find_build(db) < 0)
+		return -1;
+
+	accdb_index_clear(idx);
+	if (db->find != NULL && db->find_state == ACCDB_FIND_BUILT) {
+		for (i = h & mask; db->find[i].tag; i = (i + 1) & mask) {
+			slot = &db->find[i];
+			if (slot->tag != tag)
+				continue;
+			seen = 1;
+			buf = accdb_cache_get(db, slot->sector);
+			if (buf == NULL)
+				return -1;
+			// a freed leaf can be anything by now
+			at = buf_get_type(buf) == SECT_TYPE_LEAF ?
+			     leaf_search(buf, brief, 1) : 0;
+			if (buf_get_type(buf) == SECT_TYPE_LEAF &&
+			    at < leaf_count(buf) &&
+			    strcmp(index_rec_brief(leaf_rec(buf, at)),
+				   brief) == 0 &&
+			    find_is_first(db, buf, at, brief) == 1) {
+				db->stats.find_table++;
+				index_point(idx, db, buf, at);
+				return 0;
+			}
+			accdb_cache_put(buf);
+		}
+		if (!seen) {
+			db->stats.find_table++;
+			return -1;
+		}
+	} else if (db->find != NULL && db->find_state == ACCDB_FIND_BLOOM &&
+		   !find_bloom_has(db, h)) {
+		db->stats.find_table++;
+		return -1;
+	}
+
+	db->stats.find_tree++;
+	if (accdb_index_lookup(db, idx, brief) < 0)
+		return -1;
+	find_added(db, brief, accdb_cache_sector(idx->buf));
+
+	return 0;
+}
+
+// start, or narrow, a search for briefs beginning with prefix. the
+// matches are walked in order with accdb_search_has_entry and
+// accdb_search_next. when prefix extends the last one, the leaf its
+// first match was in is searched before going down the tree, so typing
+// one more character usually costs no reads. adding or deleting a
+// record ends a search, see accdb_search_end.
+int8_t
+accdb_search_prefix(struct accdb *db, struct accdb_search *s,
+		    const char *prefix)
+{
+	size_t len = strlen(prefix);
+	uint8_t *buf, slot;
+
+	if (len >= sizeof(s->prefix))
+		return -1;
+
+	// everything before the last first match is less than prefix
+	if (s->first && s->len <= len &&
+	    memcmp(s->prefix, prefix, s->len) == 0) {
+		accdb_index_clear(&s->idx);
+		buf = accdb_cache_get(db, s->first);
+		if (buf == NULL)
+			return -1;
+		slot = buf_get_type(buf) == SECT_TYPE_LEAF ?
+		       leaf_search(buf, prefix, 1) : 0;
+		if (buf_get_type(buf) == SECT_TYPE_LEAF &&
+		    slot < leaf_count(buf)) {
+			index_point(&s->idx, db, buf, slot);
+			goto found;
+		}
+		accdb_cache_put(buf);
+	}
+
+	if (accdb_index_seek_brief(db, &s->idx, prefix) < 0)
+		return -1;
+
+found:
+	memcpy(s->prefix, prefix, len + 1);
+	s->len = len;
+	s->first = accdb_index_has_entry(&s->idx) ?
+		   accdb_cache_sector(s->idx.buf) : 0;
+
+	return 0;
+}
+
+uint8_t
+accdb_search_has_entry(struct accdb_search *s)
+{
+	return accdb_index_has_entry(&s->idx) &&
+	       strncmp(index_rec_brief(s->idx.rec), s->prefix, s->len) == 0;
+}
+
+int8_t
+accdb_search_next(struct accdb_search *s)
+{
+	return accdb_index_next(&s->idx);
+}
+
+void
+accdb_search_end(struct accdb_search *s)
+{
+	accdb_index_clear(&s->idx);
+	memset(s, 0, sizeof(*s));
+}
+
+// construct an id from an index as follows:
+// 	id = (sector_of_rec << 16) | slot_of_rec_in_leaf
+int8_t
+accdb_index_to_id(struct accdb_index *idx, accdb_id_t *id)
+{
+	if (idx->db == NULL || idx->buf == NULL) {
+		return -1;
+	}
+
+	*id = ((uint32_t)accdb_cache_sector(idx->buf) << 16);
+	*id |= idx->slot;
+
+	return 0;
+}
+
+// reverse the above process
+int8_t
+accdb_index_from_id(struct accdb *db, struct accdb_index *idx, accdb_id_t id)
+{
+	accdb_index_clear(idx);
+	idx->db = db;
+	idx->buf = accdb_cache_get(idx->db, id >> 16);
+	if (idx->buf == NULL)
+		return -1;
+
+	if (buf_get_type(idx->buf) != SECT_TYPE_LEAF ||
+	    (id & 0xffff) > leaf_count(idx->buf))
+		return -1;
+
+	index_point(idx, db, idx->buf, id & 0xffff);
+
+	return 0;
+}
+
+uint8_t
+accdb_index_has_entry(struct accdb_index *idx)
+{
+	if (!idx->rec || !idx->buf || idx->before_beginning)
+		return 0;
+	return idx->slot < leaf_count(idx->buf);
+}
+
+int8_t
+accdb_index_next(struct accdb_index *idx)
+{
+	if (idx->blob_user)
+		accdb_cache_put(idx->blob_user);
+	if (idx->blob_pass)
+		accdb_cache_put(idx->blob_pass);
+	idx->blob_user = idx->blob_pass = NULL;
+
+	if (idx->before_beginning) {
+		idx->before_beginning = 0;
+		return 0;
+	}
+
+	index_point(idx, idx->db, idx->buf, idx->slot + 1);
+
+	if (idx->rec == NULL) {
+		uint16_t ptr = buf_get_next(idx->buf);
+		if (ptr == 0)
+			return 0;
+		accdb_cache_put(idx->buf);
+		idx->buf = accdb_cache_get(idx->db, ptr);
+		if (idx->buf == NULL)
+			return -1;
+		accdb_cache_prefetch(idx->db, idx->buf);
+		index_point(idx, idx->db, idx->buf, 0);
+		if (idx->rec == NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+int8_t
+accdb_index_prev(struct accdb_index *idx)
+{
+	if (idx->blob_user)
+		accdb_cache_put(idx->blob_user);
+	if (idx->blob_pass)
+		accdb_cache_put(idx->blob_pass);
+	idx->blob_user = idx->blob_pass = NULL;
+
+	// if this is the first record of the page, we must find the bottom
+	// record of the previous page
+	if (idx->slot == 0) {
+		uint8_t *buf;
+		uint16_t prev;
+		prev = buf_get_prev(idx->buf);
+		if (!prev) {
+			idx->before_beginning = 1;
+			return 0;
+		}
+		buf = accdb_cache_get(idx->db, prev);
+		if (buf == NULL)
+			return -1;
+		accdb_cache_put(idx->buf);
+		index_point(idx, idx->db, buf, leaf_count(buf));
+	}
+
+	chDbgAssert(idx->slot > 0, "accdb_index_prev #1", "empty leaf");
+	index_point(idx, idx->db, idx->buf, idx->slot - 1);
+
+	return 0;
+}
+
+static uint8_t
+blob_find(uint8_t *sector, const void **data, size_t *size, uint8_t type)
+{
+	uint8_t *pl = buf_get_payload(sector);
+	uint8_t *end = buf_get_end(sector);
+
+	while (pl < end) {
+		if (blob_rec_get_type(pl) == type) {
+			if (size)
+				*size = blob_rec_get_size(pl);
+			*data = blob_rec_get_data(pl);
+			return 1;
+		}
+
+		blob_rec_next(&pl);
+	}
+
+	return 0;
+}
+
+static uint8_t *
+blob_list_find(struct accdb *db, const void **data, size_t *size,
+	       uint16_t ptr, uint8_t type)
+{
+	uint8_t *buf;
+
+	while (ptr) {
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return NULL;
+		if (blob_find(buf, data, size, type))
+			return buf;
+		accdb_cache_prefetch(db, buf);
+		ptr = buf_get_next(buf);
+		accdb_cache_put(buf);
+	}
+
+	return NULL;
+}
+
+int8_t
+accdb_index_get_brief(struct accdb_index *idx, const char **brief)
+{
+	const char *user, *pass;
+	uint16_t ptr;
+
+	if (idx->rec == NULL || !accdb_index_has_entry(idx))
+		return -1;
+
+	if (index_rec_get_extended(idx->rec)) {
+		if (index_rec_parse_extended(idx->rec, brief, &ptr) < 0)
+			return -1;
+	} else {
+		if (index_rec_parse(idx->rec, brief, &user, &pass) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// a user or password on the blob list at ptr. the page it's on stays
+// referenced in *page until idx moves.
+static int8_t
+index_blob_view(struct accdb_index *idx, uint8_t **page, uint16_t ptr,
+		uint8_t type, struct accdb_view *v)
+{
+	const void *data;
+	size_t size;
+
+	if (*page == NULL)
+		*page = blob_list_find(idx->db, &data, &size, ptr, type);
+	else if (!blob_find(*page, &data, &size, type))
+		return -1;
+	if (*page == NULL || size == 0)
+		return -1;
+	// stored with its terminator
+	v->data = data;
+	v->len = size - 1;
+
+	return 0;
+}
+
+// the brief, user and password of the entry at idx, with their lengths.
+// they're NUL terminated as well, and stay valid until idx moves.
+int8_t
+accdb_index_get_views(struct accdb_index *idx, struct accdb_view *brief,
+		      struct accdb_view *user, struct accdb_view *pass)
+{
+	struct accdb_view v[3];
+	uint16_t ptr;
+
+	if (idx->rec == NULL || !accdb_index_has_entry(idx))
+		return -1;
+
+	if (!index_rec_get_extended(idx->rec)) {
+		if (index_rec_views(idx->rec, v) < 0)
+			return -1;
+		*brief = v[0];
+		*user = v[1];
+		*pass = v[2];
+		return 0;
+	}
+
+	if (index_rec_brief_view(idx->rec, brief, &ptr) < 0 ||
+	    index_blob_view(idx, &idx->blob_user, ptr, REC_BLOB_USERNAME,
+			    user) < 0 ||
+	    index_blob_view(idx, &idx->blob_pass, ptr, REC_BLOB_PASSWORD,
+			    pass) < 0)
+		return -1;
+
+	return 0;
+}
+
+int8_t
+accdb_index_get_entry(struct accdb_index *idx, const char **brief,
+		      const char **user, const char **pass)
+{
+	struct accdb_view b, u, p;
+
+	if (accdb_index_get_views(idx, &b, &u, &p) < 0)
+		return -1;
+	*brief = b.data;
+	*user = u.data;
+	*pass = p.data;
+
+	return 0;
+}
+
+static int8_t
+blob_create(struct accdb *db, const char *user, const char *pass, uint16_t *ptr)
+{
+	size_t blen;
+	uint8_t *rec, *blob1, *blob2;
+
+	blob1 = blob2 = NULL;
+
+	blob1 = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+	if (blob1 == NULL)
+		goto out;
+
+	blen = strlen(user) + 1;		
+	rec = buf_allocate_record(blob1, blen + 2);
+	if (rec == NULL)
+		goto out;
+	if (blob_rec_create(rec, REC_BLOB_USERNAME, user, blen) < 0)
+		goto out;
+
+	blen = strlen(pass) + 1;
+	rec = buf_allocate_record(blob1, blen + 2);
+	if (rec == NULL) {
+		blob2 = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+		if (blob2 == NULL)
+			goto out;
+		rec = buf_allocate_record(blob2, blen + 2);
+		if (rec == NULL)
+			goto out;
+		if (accdb_list_append(db, blob1, blob2) < 0)
+			goto out;
+	}
+	if (blob_rec_create(rec, REC_BLOB_PASSWORD, pass, blen) < 0)
+		goto out;
+
+	chDbgAssert(blob1, "create_blob #1", "");
+	*ptr = accdb_cache_sector(blob1);
+	buf_set_prev(blob1, accdb_cache_sector(blob2 ? blob2 : blob1));
+
+	if (blob1)
+		accdb_cache_put_dirty(blob1);
+	if (blob2)
+		accdb_cache_put_dirty(blob2);
+
+	return 0;
+
+out:
+	if (blob1)
+		accdb_deallocate_buf(db, blob1);
+	if (blob2)
+		accdb_deallocate_buf(db, blob2);
+
+	return -1;
+}
+
+/*
+User index
+
+An optional second tree, made with the same code as the index, lists the
+records by user. Its root is wherever it was allocated, and the index
+root's next link points to it, 0 when there's none. A record in it is a
+normal index record whose brief is
+
+	user \001 brief
+
+and whose user and password are empty, so a user's records are together
+and in brief order. The user is cut to ACCDB_USER_KEY_MAX characters and the
+brief to what's left of REC_INDEX_ENTRY_MAX, so an entry can stand for
+several records. They're told apart by going to the index, where the
+full user and brief are. A user holding \001 could confuse it.
+
+accdb_add and accdb_del keep it up to date, before flushing like
+everything else. There's no journal, so after a crash accdb_user_index
+can turn it off and on again to rebuild it.
+*/
+
+#define USER_KEY_SEP		'\001'
+// room for the brief in an entry with a klen long key
+#define USER_BRIEF_MAX(klen)	(REC_INDEX_ENTRY_MAX - 4 - (klen))
+
+// the sector of the user index root, 0 if there's none
+static int8_t
+user_index_root(struct accdb *db, uint16_t *root)
+{
+	uint8_t *buf = accdb_cache_get(db, INDEX_START(db));
+
+	if (buf == NULL)
+		return -1;
+	*root = buf_get_next(buf);
+	accdb_cache_put(buf);
+
+	return 0;
+}
+
+// the start of a user's entries, with the separator, in key. returns its
+// length.
+static size_t
+user_key(char *key, const char *user)
+{
+	size_t klen = strlen(user);
+
+	if (klen > ACCDB_USER_KEY_MAX)
+		klen = ACCDB_USER_KEY_MAX;
+	memcpy(key, user, klen);
+	key[klen] = USER_KEY_SEP;
+	key[klen + 1] = '\0';
+
+	return klen + 1;
+}
+
+// the brief part of a user index entry for user and brief. key must have
+// room for REC_INDEX_ENTRY_MAX bytes.
+static void
+user_entry(char *key, const char *user, const char *brief)
+{
+	size_t klen = user_key(key, user);
+	size_t blen = strlen(brief);
+
+	if (blen > USER_BRIEF_MAX(klen - 1))
+		blen = USER_BRIEF_MAX(klen - 1);
+	memcpy(key + klen, brief, blen);
+	key[klen + blen] = '\0';
+}
+
+// brief is one of those the cut brief part of an entry, cut short when
+// it's max long, stands for
+static uint8_t
+user_entry_match(const char *brief, const char *part, size_t max)
+{
+	size_t len = strlen(part);
+
+	if (len < max)
+		return strcmp(brief, part) == 0;
+	return strncmp(brief, part, len) == 0;
+}
+
+static int8_t
+user_index_put(struct accdb *db, uint16_t root, const char *user,
+	       const char *brief)
+{
+	struct accdb_index idx;
+	char key[REC_INDEX_ENTRY_MAX];
+	uint8_t rec[REC_INDEX_ENTRY_MAX + 1];
+	uint8_t len;
+	int8_t rv;
+
+	user_entry(key, user, brief);
+	if (index_rec_find_type(key, "", "", &len) != INDEX_NORMAL ||
+	    index_rec_create(rec, key, "", "") < 0)
+		return -1;
+	memset(&idx, 0, sizeof(idx));
+	rv = tree_insert(db, root, &idx, rec, len);
+	accdb_index_clear(&idx);
+
+	return rv;
+}
+
+// drop an entry for user and brief from the user index at root
+static int8_t
+user_index_del_entry(struct accdb *db, uint16_t root, const char *user,
+		     const char *brief)
+{
+	struct accdb_index u;
+	char key[REC_INDEX_ENTRY_MAX];
+	int8_t rv;
+
+	user_entry(key, user, brief);
+	memset(&u, 0, sizeof(u));
+	rv = tree_seek(db, root, &u, key);
+	if (rv == 0 && accdb_index_has_entry(&u) &&
+	    strcmp(index_rec_brief(u.rec), key) == 0)
+		rv = tree_delete(db, root, &u);
+	accdb_index_clear(&u);
+
+	return rv;
+}
+
+// drop the user index entry for the record idx points at
+static int8_t
+user_index_del(struct accdb_index *idx)
+{
+	const char *brief, *user, *pass;
+	uint16_t root;
+
+	if (user_index_root(idx->db, &root) < 0)
+		return -1;
+	if (root == 0)
+		return 0;
+	if (accdb_index_get_entry(idx, &brief, &user, &pass) < 0)
+		return -1;
+
+	return user_index_del_entry(idx->db, root, user, brief);
+}
+
+// free the tree under sector, one child at a time. without leaves set,
+// the leaves are left alone. csize is the size of a child in its nodes,
+// NODE_CHILD_SIZE unless it's an old tree.
+static int8_t
+tree_free(struct accdb *db, uint16_t sector, uint8_t leaves, uint8_t csize)
+{
+	uint8_t *buf, *pl;
+	uint16_t off = 0, child;
+
+	while (1) {
+		buf = accdb_cache_get(db, sector);
+		if (buf == NULL)
+			return -1;
+		if (buf_get_type(buf) != SECT_TYPE_NODE && !leaves) {
+			accdb_cache_put(buf);
+			return 0;
+		}
+		if (buf_get_type(buf) != SECT_TYPE_NODE ||
+		    off >= buf_get_size(buf))
+			break;
+		pl = buf_get_payload(buf);
+		child = get_uint16(pl, off);
+		off += csize;
+		if (off < buf_get_size(buf))
+			off += 1 + NODE_KEY_LEN(pl + off);
+		accdb_cache_put(buf);
+		if (tree_free(db, child, leaves, csize) < 0)
+			return -1;
+	}
+
+	return accdb_deallocate_buf(db, buf);
+}
+
+// turn the user index on, building it from the index, or off, freeing it
+int8_t
+accdb_user_index(struct accdb *db, uint8_t on)
+{
+	struct accdb_index idx;
+	const char *brief, *user, *pass;
+	uint8_t *head, *root;
+	uint16_t sector;
+
+	if (user_index_root(db, &sector) < 0)
+		return -1;
+	if (!!sector == !!on)
+		return 0;
+
+	if (!on) {
+		head = accdb_cache_get(db, INDEX_START(db));
+		if (head == NULL)
+			return -1;
+		buf_set_next(head, SECT_NULL);
+		accdb_cache_put_dirty(head);
+		if (tree_free(db, sector, 1, NODE_CHILD_SIZE) < 0)
+			return -1;
+		return accdb_cache_flush(db);
+	}
+
+	root = tree_create(db);
+	if (root == NULL)
+		return -1;
+	sector = accdb_cache_sector(root);
+	accdb_cache_put_dirty(root);
+
+	memset(&idx, 0, sizeof(idx));
+	if (accdb_index_init(db, &idx) < 0)
+		goto fail;
+	while (accdb_index_has_entry(&idx)) {
+		if (accdb_index_get_entry(&idx, &brief, &user, &pass) < 0 ||
+		    user_index_put(db, sector, user, brief) < 0 ||
+		    accdb_index_next(&idx) < 0)
+			goto fail;
+	}
+	accdb_index_clear(&idx);
+
+	head = accdb_cache_get(db, INDEX_START(db));
+	if (head == NULL) {
+		tree_free(db, sector, 1, NODE_CHILD_SIZE);
+		return -1;
+	}
+	buf_set_next(head, sector);
+	accdb_cache_put_dirty(head);
+
+	return accdb_cache_flush(db);
+
+fail:
+	accdb_index_clear(&idx);
+	tree_free(db, sector, 1, NODE_CHILD_SIZE);
+	return -1;
+}
+
+// point s->idx at the records the user index entry s->uidx is at stands
+// for, or end the search if it's for another user
+static int8_t
+user_search_load(struct accdb_user_search *s)
+{
+	size_t klen = strlen(s->key);
+	const char *brief;
+
+	if (!accdb_index_has_entry(&s->uidx) ||
+	    strncmp(brief = index_rec_brief(s->uidx.rec), s->key, klen)) {
+		accdb_index_clear(&s->uidx);
+		return 0;
+	}
+	strcpy(s->part, brief + klen);
+
+	return accdb_index_seek_brief(s->uidx.db, &s->idx, s->part);
+}
+
+// move s on to the next record for its user, from wherever s->idx is
+static int8_t
+user_search_walk(struct accdb_user_search *s)
+{
+	const char *brief, *user, *pass;
+	size_t klen = strlen(s->key);
+
+	while (1) {
+		while (accdb_index_has_entry(&s->idx)) {
+			if (accdb_index_get_entry(&s->idx, &brief, &user,
+						  &pass) < 0)
+				return -1;
+			if (s->uidx.db &&
+			    !user_entry_match(brief, s->part,
+					      USER_BRIEF_MAX(klen - 1)))
+				break;
+			if (strcmp(user, s->user) == 0)
+				return 0;
+			if (accdb_index_next(&s->idx) < 0)
+				return -1;
+		}
+		accdb_index_clear(&s->idx);
+		if (s->uidx.db == NULL)
+			return 0;
+
+		// on to an entry standing for other records
+		while (accdb_index_has_entry(&s->uidx) &&
+		       strncmp(brief = index_rec_brief(s->uidx.rec), s->key,
+			       klen) == 0 &&
+		       strcmp(brief + klen, s->part) == 0) {
+			if (accdb_index_next(&s->uidx) < 0)
+				return -1;
+		}
+		if (user_search_load(s) < 0)
+			return -1;
+	}
+}
+
+// point s->idx at the first record for user, in brief order. without a
+// user index, the whole index is walked. user must stay put until the
+// search ends, see accdb_user_end. like any other index, adding or
+// deleting records ends it.
+int8_t
+accdb_user_search(struct accdb *db, struct accdb_user_search *s,
+		  const char *user)
+{
+	uint16_t root;
+
+	accdb_user_end(s);
+	s->user = user;
+	user_key(s->key, user);
+	if (user_index_root(db, &root) < 0)
+		return -1;
+	if (root == 0) {
+		if (accdb_index_init(db, &s->idx) < 0)
+			return -1;
+	} else {
+		if (tree_seek(db, root, &s->uidx, s->key) < 0 ||
+		    user_search_load(s) < 0)
+			return -1;
+	}
+
+	return user_search_walk(s);
+}
+
+uint8_t
+accdb_user_has_entry(struct accdb_user_search *s)
+{
+	return accdb_index_has_entry(&s->idx);
+}
+
+int8_t
+accdb_user_next(struct accdb_user_search *s)
+{
+	if (!accdb_index_has_entry(&s->idx))
+		return -1;
+	if (accdb_index_next(&s->idx) < 0)
+		return -1;
+	return user_search_walk(s);
+}
+
+void
+accdb_user_end(struct accdb_user_search *s)
+{
+	accdb_index_clear(&s->idx);
+	accdb_index_clear(&s->uidx);
+	memset(s, 0, sizeof(*s));
+}
+
+int8_t
+accdb_add(struct accdb *db, struct accdb_index *idx,
+	  const char *brief, const char *user, const char *pass)
+{
+	uint8_t rec[REC_INDEX_ENTRY_MAX + 1];
+	uint8_t len;
+	enum index_type type;
+	uint16_t blob = 0, root;
+
+	type = index_rec_find_type(brief, user, pass, &len);
+	if (type == INDEX_INVALID)
+		return -1;
+
+	if (type == INDEX_EXT) {
+		if (blob_create(db, user, pass, &blob) < 0)
+			return -1;
+		if (index_rec_create_extended(rec, brief, blob) < 0)
+			goto out;
+	} else {
+		if (index_rec_create(rec, brief, user, pass) < 0)
+			return -1;
+	}
+
+	// idx will now point to the new record
+	if (tree_insert(db, INDEX_START(db), idx, rec, len) < 0)
+		goto out;
+	if (user_index_root(db, &root) < 0 ||
+	    (root && user_index_put(db, root, user, brief) < 0)) {
+		// take it out again, so the two agree
+		tree_delete(db, INDEX_START(db), idx);
+		accdb_index_clear(idx);
+		goto out;
+	}
+	find_added(db, brief, accdb_cache_sector(idx->buf));
+	if (db->count != ACCDB_COUNT_UNKNOWN)
+		db->count++;
+
+	return 0;
+
+out:
+	// the blob stays if the record made it in
+	if (blob && idx->buf == NULL)
+		accdb_list_clear(db, blob);
+	accdb_index_clear(idx);
+
+	return -1;
+}
+
+// add every record next hands over, until it returns 1, and flush once at
+// the end. any order works, but sorted is the fast one: every record goes
+// on the end of the last leaf, down a path that's all in the cache, and
+// tree_insert starts a new leaf when it's full instead of splitting it,
+// so they're all left full. loaded, if given, is set to the records
+// added, failure or not.
+int8_t
+accdb_bulk_load(struct accdb *db, accdb_bulk_cb next, void *arg,
+		uint32_t *loaded)
+{
+	struct accdb_index idx;
+	const char *brief, *user, *pass;
+	uint32_t n = 0;
+	int8_t rv;
+
+	memset(&idx, 0, sizeof(idx));
+	while ((rv = next(arg, &brief, &user, &pass)) == 0) {
+		if (accdb_add(db, &idx, brief, user, pass) < 0) {
+			rv = -1;
+			break;
+		}
+		// don't keep the leaf referenced, it may need to be evicted
+		accdb_index_clear(&idx);
+		n++;
+	}
+	accdb_index_clear(&idx);
+	if (loaded)
+		*loaded = n;
+	if (accdb_cache_flush(db) < 0 || rv < 0)
+		return -1;
+
+	return 0;
+}
+
+static int8_t
+convert_to_extended(struct accdb_index *idx)
+{
+	const char *brief, *user, *pass;
+	uint16_t blob;
+	uint8_t *modp, *endp;
+	
+	if (index_rec_parse(idx->rec, &brief, &user, &pass) < 0)
+		return -1;
+	
+	if (blob_create(idx->db, user, pass, &blob) < 0)
+		return -1;
+
+	endp = idx->rec + index_rec_get_total_size(idx->rec);
+	modp = idx->rec + 1 + strlen(brief) + 1;
+
+	// we assert here that it's possible to convert any short index
+	// entry to an extended entry in place, assuming the brief stays
+	// the same. the 16-bit pointer would take up the same amount of
+	// space as a blank username and password.
+
+	chDbgAssert(endp - modp >= 2, "convert_to_extended #1", "");
+	set_uint16(modp, 0, blob);
+	modp += 2;
+
+	// shave off the unused part of the new record, it's a hole in the
+	// leaf from now on
+	buf_set_size(idx->buf, buf_get_size(idx->buf) -
+		     LEAF_REC_SIZE(endp - idx->rec) +
+		     LEAF_REC_SIZE(modp - idx->rec));
+
+	index_rec_set_extended(idx->rec, 1);
+	index_rec_set_size(idx->rec, modp - idx->rec - 1);
+	accdb_cache_dirty(idx->buf);
+
+	return 0;
+}
+
+// the last page of the blob list at head, which head's prev link points
+// at, having no page before it. lists from before that have 0 there, and
+// are walked to find it.
+static int8_t
+blob_list_tail(struct accdb *db, uint8_t *head, uint16_t *tail)
+{
+	uint16_t ptr = buf_get_next(head);
+	uint8_t *buf;
+
+	*tail = buf_get_prev(head);
+	if (*tail)
+		return 0;
+	*tail = accdb_cache_sector(head);
+	while (ptr) {
+		*tail = ptr;
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return -1;
+		accdb_cache_prefetch(db, buf);
+		ptr = buf_get_next(buf);
+		accdb_cache_put(buf);
+	}
+
+	return 0;
+}
+
+// notes go on the last page of the entry's blob list, or a new one after
+// it, so adding one reads the first and last pages whatever the length,
+// and the notes stay in the order they were added
+int8_t
+accdb_add_note(struct accdb_index *idx, void *data, size_t size)
+{
+	uint16_t blob = 0, tail;
+	const char *brief;
+	uint8_t *head, *buf, *note, *tmp;
+
+	if (!accdb_index_has_entry(idx))
+		return -1;
+	if (size > REC_BLOB_ENTRY_MAX)
+		return -1;
+	if (index_rec_get_extended(idx->rec) == 0 &&
+	    convert_to_extended(idx) < 0)
+		return -1;
+	if (index_rec_parse_extended(idx->rec, &brief, &blob) < 0)
+		return -1;
+	
+	chDbgAssert(blob != 0, "accdb_add_note #1", "");	
+	head = accdb_cache_get(idx->db, blob);
+	if (head == NULL)
+		return -1;
+	if (blob_list_tail(idx->db, head, &tail) < 0)
+		goto fail;
+	buf = accdb_cache_get(idx->db, tail);
+	if (buf == NULL)
+		goto fail;
+	note = buf_allocate_record(buf, size + 2);
+
+	// no space, create new blob
+	if (!note) {
+		tmp = accdb_allocate_buf(idx->db, SECT_TYPE_BLOB);
+		if (!tmp) {
+			accdb_cache_put(buf);
+			goto fail;
+		}
+		if (accdb_list_append(idx->db, buf, tmp) < 0) {
+			accdb_deallocate_buf(idx->db, tmp);
+			accdb_cache_put(buf);
+			goto fail;
+		}
+		note = buf_allocate_record(tmp, size + 2);
+		chDbgAssert(note != NULL, "accdb_add_note #2", "");
+		accdb_cache_put_dirty(buf);
+		buf = tmp;
+	}
+	
+	if (blob_rec_create(note, REC_BLOB_NOTE, data, size) < 0) {
+		accdb_cache_put(buf);
+		goto fail;
+	}
+	buf_set_prev(head, accdb_cache_sector(buf));
+	accdb_cache_put_dirty(buf);
+	accdb_cache_put_dirty(head);
+
+	return 0;
+
+fail:
+	accdb_cache_put(head);
+	return -1;
+}
+
+int8_t
+accdb_index_next_note(struct accdb_index *idx, const void **note, size_t *size)
+{
+	uint8_t *rec, *end;
+
+	if (!index_rec_get_extended(idx->rec))
+		return -1;
+
+	if (idx->blob_note == NULL || *note == NULL) {
+		const char *brief;
+		uint16_t blob = 0;
+		*note = NULL;
+		if (index_rec_parse_extended(idx->rec, &brief, &blob) < 0)
+			return -1;
+		if (idx->blob_note)
+			accdb_cache_put(idx->blob_note);
+		idx->blob_note = blob_list_find(idx->db, note, size, blob,
+						REC_BLOB_NOTE);
+		return 0;
+	}
+
+	chDbgAssert(idx->blob_note, "accdb_index_next_note #1", "");
+	rec = ((uint8_t *)*note) - 2;
+	end = buf_get_end(idx->blob_note);
+	if (rec < buf_get_payload(idx->blob_note) || rec >= end)
+		return -1;
+
+	blob_rec_next(&rec);
+	if (rec >= end) {
+		*note = NULL;
+		accdb_cache_put(idx->blob_note);
+		idx->blob_note = blob_list_find(idx->db, note, size,
+						buf_get_next(idx->blob_note),
+						REC_BLOB_NOTE);
+	} else {
+		// username and password blobs are always the first
+		// to appear in the blob list, so if this is not the
+		// case, something's wrong.
+		if (blob_rec_get_type(rec) != REC_BLOB_NOTE)
+			return -1;
+		*note = blob_rec_get_data(rec);
+		*size = blob_rec_get_size(rec);
+	}
+
+	return 0;
+}
+
+/*
+Repacking
+
+A note goes onto the last page of its entry's blob list, or a new page
+after it, in whatever sector the allocator finds, so the lists of
+entries that grew a note at a time end up spread out over the file,
+with part empty pages. Repacking an entry copies its
+blob records, in list order, into as few pages as they fit, in a run of
+consecutive sectors when there's one, and frees the old list.
+accdb_repack_all does every entry.
+*/
+
+// the pages the blob records on the list at ptr fill, packed in order,
+// and whether the list is like that already: no more pages than that,
+// each in the sector after the one before
+static int8_t
+blob_list_measure(struct accdb *db, uint16_t ptr, uint16_t *pages,
+		  uint8_t *packed)
+{
+	uint16_t have = 0, used = SECT_PAYLOAD_MAX, prev = 0;
+	uint8_t *buf, *pl, *end;
+
+	*pages = 0;
+	*packed = 1;
+	while (ptr) {
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return -1;
+		accdb_cache_prefetch(db, buf);
+		if (prev && ptr != prev + 1)
+			*packed = 0;
+		have++;
+		end = buf_get_end(buf);
+		for (pl = buf_get_payload(buf); pl < end; blob_rec_next(&pl)) {
+			if (used + blob_rec_get_total_size(pl) >
+			    SECT_PAYLOAD_MAX) {
+				(*pages)++;
+				used = 0;
+			}
+			used += blob_rec_get_total_size(pl);
+		}
+		prev = ptr;
+		ptr = buf_get_next(buf);
+		accdb_cache_put(buf);
+	}
+	if (have != *pages)
+		*packed = 0;
+
+	return 0;
+}
+
+// the next page of a repacked list, after page if there's one, in
+// sector when it's given, which is freed again when that fails
+static uint8_t *
+blob_repack_page(struct accdb *db, uint8_t *page, uint16_t sector)
+{
+	uint8_t *buf;
+
+	if (sector) {
+		buf = accdb_cache_get(db, sector);
+		if (buf == NULL) {
+			accdb_deallocate_sector(db, sector);
+			return NULL;
+		}
+		buf_set_type_size(buf, SECT_TYPE_BLOB, 0);
+		buf_set_prev(buf, 0);
+		buf_set_next(buf, 0);
+		accdb_cache_dirty(buf);
+	} else {
+		buf = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+		if (buf == NULL)
+			return NULL;
+	}
+	if (page && accdb_list_append(db, page, buf) < 0) {
+		accdb_deallocate_buf(db, buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+// repack the blob list of the entry idx points at, see above. notes from
+// accdb_index_next_note are stale after it. a failure part way frees the
+// new pages again, and leaves the entry whole.
+int8_t
+accdb_repack(struct accdb_index *idx)
+{
+	struct accdb *db = idx->db;
+	const char *brief;
+	uint16_t blob, ptr, pages, first = 0, head = 0, sector, run_end = 0;
+	uint8_t *old, *page = NULL, *next, *pl, *end, *rec, packed;
+	uint16_t size;
+	int8_t rv;
+
+	if (!accdb_index_has_entry(idx))
+		return -1;
+	if (!index_rec_get_extended(idx->rec))
+		return 0;
+	if (index_rec_parse_extended(idx->rec, &brief, &blob) < 0)
+		return -1;
+	if (blob_list_measure(db, blob, &pages, &packed) < 0)
+		return -1;
+	if (packed)
+		return 0;
+	// without a run free, the pages go wherever they can
+	rv = accdb_allocate_run(db, pages, &first);
+	if (rv < 0)
+		return -1;
+	if (rv > 0)
+		first = 0;
+	else
+		run_end = first + pages;
+
+	// let go of the old pages
+	if (idx->blob_user)
+		accdb_cache_put(idx->blob_user);
+	if (idx->blob_pass)
+		accdb_cache_put(idx->blob_pass);
+	if (idx->blob_note)
+		accdb_cache_put(idx->blob_note);
+	idx->blob_user = idx->blob_pass = idx->blob_note = NULL;
+
+	for (ptr = blob; ptr; ) {
+		old = accdb_cache_get(db, ptr);
+		if (old == NULL)
+			goto fail;
+		accdb_cache_prefetch(db, old);
+		end = buf_get_end(old);
+		for (pl = buf_get_payload(old); pl < end; blob_rec_next(&pl)) {
+			size = blob_rec_get_total_size(pl);
+			rec = page ? buf_allocate_record(page, size) : NULL;
+			if (rec == NULL) {
+				next = blob_repack_page(db, page, first ?
+							first++ : 0);
+				if (next == NULL) {
+					accdb_cache_put(old);
+					goto fail;
+				}
+				if (page)
+					accdb_cache_put_dirty(page);
+				page = next;
+				if (!head)
+					head = accdb_cache_sector(page);
+				rec = buf_allocate_record(page, size);
+			}
+			memcpy(rec, pl, size);
+		}
+		ptr = buf_get_next(old);
+		accdb_cache_put(old);
+	}
+	chDbgAssert(page != NULL, "accdb_repack #1", "no records");
+	sector = accdb_cache_sector(page);
+	if (sector != head) {
+		accdb_cache_put_dirty(page);
+		page = accdb_cache_get(db, head);
+		if (page == NULL)
+			goto fail;
+	}
+	buf_set_prev(page, sector);
+	accdb_cache_put_dirty(page);
+
+	set_uint16((uint8_t *)brief + strlen(brief) + 1, 0, head);
+	accdb_cache_dirty(idx->buf);
+
+	return accdb_list_clear(db, blob);
+
+fail:
+	// the new list, and what's left of the run
+	if (page)
+		accdb_cache_put_dirty(page);
+	if (head)
+		accdb_list_clear(db, head);
+	while (first && first < run_end)
+		accdb_deallocate_sector(db, first++);
+	return -1;
+}
+
+// repack every entry, and flush
+int8_t
+accdb_repack_all(struct accdb *db)
+{
+	struct accdb_index idx;
+
+	memset(&idx, 0, sizeof(idx));
+	if (accdb_index_init(db, &idx) < 0)
+		return -1;
+	while (accdb_index_has_entry(&idx)) {
+		if (accdb_repack(&idx) < 0 || accdb_index_next(&idx) < 0) {
+			accdb_index_clear(&idx);
+			return -1;
+		}
+	}
+	accdb_index_clear(&idx);
+
+	return accdb_cache_flush(db);
+}
+
+/*
+Export
+
+accdb_export writes out every entry, in index order, through a callback,
+as CSV or as a binary stream of fields. The leaves are walked along
+their links, and each extended entry's blob list is walked once, its
+records written out as they're come to, so the user and password, which
+are always first on the list, go before the notes without looking for
+them. Only a leaf and a blob page are held at a time, and both chains
+are read ahead.
+
+CSV has a line per entry: brief, user, password, then a field per note.
+Fields with a comma, quote or line break in them are quoted, with quotes
+doubled. The binary format is described in accdb.h.
+*/
+
+struct export {
+	enum accdb_export_format format;
+	accdb_export_cb write;
+	void *arg;
+	uint8_t first;
+};
+
+static int8_t
+export_csv(struct export *e, const char *data, size_t len)
+{
+	size_t i, from;
+
+	if (!e->first && e->write(e->arg, ",", 1) < 0)
+		return -1;
+	e->first = 0;
+	for (i = 0; i < len; ++i)
+		if (data[i] && strchr(",\"\r\n", data[i]))
+			break;
+	if (i == len)
+		return len ? e->write(e->arg, data, len) : 0;
+
+	if (e->write(e->arg, "\"", 1) < 0)
+		return -1;
+	for (from = i = 0; i < len; ++i) {
+		if (data[i] != '"')
+			continue;
+		// the quote goes out twice, once with what's before it
+		if (e->write(e->arg, data + from, i + 1 - from) < 0)
+			return -1;
+		from = i;
+	}
+	if (e->write(e->arg, data + from, len - from) < 0)
+		return -1;
+	return e->write(e->arg, "\"", 1);
+}
+
+static int8_t
+export_field(struct export *e, enum accdb_field type, const void *data,
+	     size_t len)
+{
+	uint8_t hdr[3];
+
+	if (e->format == ACCDB_EXPORT_CSV) {
+		if (type == ACCDB_FIELD_END) {
+			e->first = 1;
+			return e->write(e->arg, "\r\n", 2);
+		}
+		return export_csv(e, data, len);
+	}
+
+	hdr[0] = type;
+	hdr[1] = len & 0xff;
+	hdr[2] = len >> 8;
+	if (e->write(e->arg, hdr, sizeof(hdr)) < 0)
+		return -1;
+	return len ? e->write(e->arg, data, len) : 0;
+}
+
+// the fields on the blob list at ptr
+static int8_t
+export_blobs(struct accdb *db, struct export *e, uint16_t ptr)
+{
+	static const uint8_t field[] = {
+		[REC_BLOB_USERNAME] = ACCDB_FIELD_USER,
+		[REC_BLOB_PASSWORD] = ACCDB_FIELD_PASS,
+		[REC_BLOB_NOTE] = ACCDB_FIELD_NOTE,
+	};
+	uint8_t *buf, *pl, *end, type;
+	size_t len;
+
+	while (ptr) {
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return -1;
+		accdb_cache_prefetch(db, buf);
+		end = buf_get_end(buf);
+		for (pl = buf_get_payload(buf); pl < end; blob_rec_next(&pl)) {
+			type = blob_rec_get_type(pl);
+			if (type > REC_BLOB_NOTE)
+				continue;
+			len = blob_rec_get_size(pl);
+			// user and password are kept with their terminator
+			if (type != REC_BLOB_NOTE && len)
+				len--;
+			if (export_field(e, field[type], blob_rec_get_data(pl),
+					 len) < 0) {
+				accdb_cache_put(buf);
+				return -1;
+			}
+		}
+		ptr = buf_get_next(buf);
+		accdb_cache_put(buf);
+	}
+
+	return 0;
+}
+
+static int8_t
+export_entry(struct accdb *db, struct export *e, const uint8_t *rec)
+{
+	struct accdb_view v[3];
+	uint16_t ptr;
+
+	if (index_rec_get_extended(rec)) {
+		if (index_rec_brief_view(rec, &v[0], &ptr) < 0 ||
+		    export_field(e, ACCDB_FIELD_BRIEF, v[0].data,
+				 v[0].len) < 0 ||
+		    export_blobs(db, e, ptr) < 0)
+			return -1;
+	} else {
+		if (index_rec_views(rec, v) < 0 ||
+		    export_field(e, ACCDB_FIELD_BRIEF, v[0].data,
+				 v[0].len) < 0 ||
+		    export_field(e, ACCDB_FIELD_USER, v[1].data,
+				 v[1].len) < 0 ||
+		    export_field(e, ACCDB_FIELD_PASS, v[2].data,
+				 v[2].len) < 0)
+			return -1;
+	}
+
+	return export_field(e, ACCDB_FIELD_END, NULL, 0);
+}
+
+// write every entry out through write, see above. a write that fails
+// stops it.
+int8_t
+accdb_export(struct accdb *db, enum accdb_export_format format,
+	     accdb_export_cb write, void *arg)
+{
+	struct export e;
+	uint8_t *leaf;
+	uint16_t ptr;
+	uint8_t i;
+
+	e.format = format;
+	e.write = write;
+	e.arg = arg;
+	e.first = 1;
+
+	leaf = tree_edge(db, INDEX_START(db), 0, NULL);
+	if (leaf == NULL)
+		return -1;
+	while (1) {
+		accdb_cache_prefetch(db, leaf);
+		for (i = 0; i < leaf_count(leaf); ++i) {
+			if (export_entry(db, &e, leaf_rec(leaf, i)) < 0) {
+				accdb_cache_put(leaf);
+				return -1;
+			}
+		}
+		ptr = buf_get_next(leaf);
+		accdb_cache_put(leaf);
+		if (!ptr)
+			return 0;
+		leaf = accdb_cache_get(db, ptr);
+		if (leaf == NULL)
+			return -1;
+	}
+}
+
+// put rec, len bytes long, in the place of the record idx points at, which
+// has the same brief. it's written over the old one when it's no bigger,
+// moved within the leaf when there's room, and otherwise the leaf is
+// split. idx is left on it, and a failure before anything has moved
+// leaves it on the old one.
+static int8_t
+index_rec_replace(struct accdb_index *idx, const uint8_t *rec, uint8_t len)
+{
+	struct tree_path path;
+	struct accdb *db = idx->db;
+	uint8_t *leaf = idx->buf, *right;
+	uint16_t old = leaf_rec_size(idx->rec), size = LEAF_REC_SIZE(len);
+
+	if (size <= old) {
+		memcpy(idx->rec, rec, len);
+		// the rest of the old one is a hole till the next leaf_compact
+		buf_set_size(leaf, buf_get_size(leaf) - old + size);
+		accdb_cache_dirty(leaf);
+		return 0;
+	}
+
+	// moved, when there's room once the old one's out
+	if (buf_get_available(leaf) + old >= size) {
+		leaf_remove(leaf, idx->slot);
+		memcpy(leaf_insert(leaf, idx->slot, len), rec, len);
+		idx->rec = leaf_rec(leaf, idx->slot);
+		return 0;
+	}
+
+	// otherwise the leaf is split around it, as tree_insert would,
+	// once there's a leaf to split it with, so a failure before that
+	// leaves the old one where it was. it would have fit if it were
+	// alone, so neither half is left empty.
+	if (tree_find_path(db, INDEX_START(db), index_rec_brief(rec),
+			   accdb_cache_sector(leaf), &path) < 0)
+		return -1;
+	right = leaf_after(db, leaf);
+	if (right == NULL)
+		return -1;
+	if (leaf_split_insert(db, INDEX_START(db), &path, leaf, right,
+			      idx->slot, rec, len, 1, idx) < 0) {
+		db->count = ACCDB_COUNT_UNKNOWN;
+		return -1;
+	}
+	find_added(db, index_rec_brief(rec), accdb_cache_sector(idx->buf));
+
+	return 0;
+}
+
+// a new blob page after buf on its list, or NULL
+static uint8_t *
+blob_page_after(struct accdb *db, uint8_t *buf)
+{
+	uint8_t *tmp = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+
+	if (tmp == NULL)
+		return NULL;
+	if (accdb_list_append(db, buf, tmp) < 0) {
+		accdb_deallocate_buf(db, tmp);
+		return NULL;
+	}
+
+	return tmp;
+}
+
+// take page, from blob_page_after, off its list again and free it
+static void
+blob_page_drop(struct accdb *db, uint8_t *page)
+{
+	if (accdb_list_remove(db, page) < 0) {
+		// an empty page on the list does no harm
+		accdb_cache_put_dirty(page);
+		return;
+	}
+	accdb_deallocate_buf(db, page);
+}
+
+// make the record of type on the blob list at ptr size bytes of data,
+// which mustn't be on the list itself. it's resized where it is when its
+// page has room. otherwise the page is split after it, and it goes on the
+// end of the first half or a page of its own between them, so the list
+// keeps its order. the new pages are had before anything is moved, so a
+// failure leaves the old record.
+static int8_t
+blob_list_set(struct accdb *db, uint16_t ptr, uint8_t type,
+	      const void *data, size_t size)
+{
+	const void *old;
+	size_t osize;
+	uint8_t *buf, *rec, *rest = NULL, *own = NULL, *last, *head;
+	uint16_t off, len;
+
+	if (size > REC_BLOB_ENTRY_MAX)
+		return -1;
+	buf = blob_list_find(db, &old, &osize, ptr, type);
+	if (buf == NULL)
+		return -1;
+	rec = (uint8_t *)old - 2;
+	off = rec - buf_get_payload(buf);
+
+	if (size <= osize) {
+		buf_deallocate_record(buf, rec + 2 + size, osize - size);
+		goto set;
+	}
+	if (buf_get_available(buf) >= size - osize) {
+		buf_insert_record(buf, off + 2 + osize, size - osize);
+		goto set;
+	}
+
+	// the records after it need a page, and it needs one of its own
+	// when it won't fit after the ones before it
+	len = buf_get_size(buf) - off - 2 - osize;
+	if (len) {
+		rest = blob_page_after(db, buf);
+		if (rest == NULL)
+			goto fail;
+	}
+	if (off + 2 + size > SECT_PAYLOAD_MAX) {
+		own = blob_page_after(db, buf);
+		if (own == NULL)
+			goto fail;
+	}
+
+	// a new page on the end is the list's new tail
+	last = rest ? rest : own;
+	if (last && !buf_get_next(last)) {
+		head = ptr == accdb_cache_sector(buf) ? accdb_cache_ref(buf) :
+		       accdb_cache_get(db, ptr);
+		if (head == NULL)
+			goto fail;
+		buf_set_prev(head, accdb_cache_sector(last));
+		accdb_cache_put_dirty(head);
+	}
+
+	if (len)
+		memcpy(buf_allocate_record(rest, len), rec + 2 + osize, len);
+	buf_deallocate_record(buf, rec, 2 + osize + len);
+	rec = buf_allocate_record(own ? own : buf, size + 2);
+
+set:
+	blob_rec_create(rec, type, data, size);
+	if (rest)
+		accdb_cache_put_dirty(rest);
+	if (own)
+		accdb_cache_put_dirty(own);
+	accdb_cache_put_dirty(buf);
+
+	return 0;
+
+fail:
+	if (own)
+		blob_page_drop(db, own);
+	if (rest)
+		blob_page_drop(db, rest);
+	accdb_cache_put(buf);
+	return -1;
+}
+
+// give the record idx points at a new user, a new password, or both, NULL
+// keeping one as it is. a record that isn't extended is rewritten in its
+// leaf, or made extended when they don't fit in it any more. an extended
+// one has them changed on its blob list, where its notes are, and stays
+// extended. neither is moved in the index, and idx is left on it. notes
+// from accdb_index_next_note are stale after it, and the next call starts
+// from the first one again.
+static int8_t
+chuser_in_place(struct accdb_index *idx, const char *user, const char *pass)
+{
+	struct accdb_view v[3];
+	uint8_t rec[REC_INDEX_ENTRY_MAX + 1];
+	uint16_t ptr, blob;
+	uint8_t len;
+
+	if (!accdb_index_has_entry(idx))
+		return -1;
+
+	// the blob pages idx holds won't have the records where they were
+	if (idx->blob_user)
+		accdb_cache_put(idx->blob_user);
+	if (idx->blob_pass)
+		accdb_cache_put(idx->blob_pass);
+	if (idx->blob_note)
+		accdb_cache_put(idx->blob_note);
+	idx->blob_user = idx->blob_pass = idx->blob_note = NULL;
+
+	if (index_rec_get_extended(idx->rec)) {
+		if (index_rec_brief_view(idx->rec, v, &ptr) < 0)
+			return -1;
+		if (user && blob_list_set(idx->db, ptr, REC_BLOB_USERNAME,
+					  user, strlen(user) + 1) < 0)
+			return -1;
+		if (pass && blob_list_set(idx->db, ptr, REC_BLOB_PASSWORD,
+					  pass, strlen(pass) + 1) < 0)
+			return -1;
+		return 0;
+	}
+
+	// the new record is made aside, from the old one's brief and
+	// whatever it keeps
+	if (index_rec_views(idx->rec, v) < 0)
+		return -1;
+	if (user == NULL)
+		user = v[1].data;
+	if (pass == NULL)
+		pass = v[2].data;
+
+	switch (index_rec_find_type(v[0].data, user, pass, &len)) {
+	case INDEX_NORMAL:
+		if (index_rec_create(rec, v[0].data, user, pass) < 0)
+			return -1;
+		break;
+	case INDEX_EXT:
+		// never bigger than what it replaces
+		if (blob_create(idx->db, user, pass, &blob) < 0)
+			return -1;
+		if (index_rec_create_extended(rec, v[0].data, blob) < 0) {
+			accdb_list_clear(idx->db, blob);
+			return -1;
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	return index_rec_replace(idx, rec, len);
+}
+
+// give the record idx points at a new user, see chuser_in_place, and
+// move its user index entry. the new entry goes in first and the old one
+// comes out last, so when the record can't be changed, the user index is
+// left as it was. for an extended record, new_user mustn't be one of its
+// fields.
+int8_t
+accdb_chuser(struct accdb_index *idx, const char *new_user)
+{
+	char brief[REC_INDEX_ENTRY_MAX], old[ACCDB_USER_KEY_MAX + 1];
+	const char *b, *u, *p;
+	uint16_t root;
+	size_t len;
+
+	if (!accdb_index_has_entry(idx))
+		return -1;
+	if (user_index_root(idx->db, &root) < 0)
+		return -1;
+	if (root == 0)
+		return chuser_in_place(idx, new_user, NULL);
+
+	// entries only hold the start of the user, which is enough to find
+	// the old one by once the record has the new one
+	if (accdb_index_get_entry(idx, &b, &u, &p) < 0)
+		return -1;
+	strcpy(brief, b);
+	len = strlen(u);
+	if (len > ACCDB_USER_KEY_MAX)
+		len = ACCDB_USER_KEY_MAX;
+	memcpy(old, u, len);
+	old[len] = '\0';
+
+	if (user_index_put(idx->db, root, new_user, brief) < 0)
+		return -1;
+	if (chuser_in_place(idx, new_user, NULL) < 0) {
+		user_index_del_entry(idx->db, root, new_user, brief);
+		return -1;
+	}
+
+	return user_index_del_entry(idx->db, root, old, brief);
+}
+
+// give the record idx points at a new password, see chuser_in_place. for
+// an extended record, new_pass mustn't be one of its fields.
+int8_t
+accdb_chpass(struct accdb_index *idx, const char *new_pass)
+{
+	return chuser_in_place(idx, NULL, new_pass);
+}
+
+
+// delete the record idx points at. idx is moved to the next one, see
+// tree_delete.
+int8_t
+accdb_del(struct accdb_index *idx)
+{
+	struct accdb *db;
+	const char *brief;
+	uint16_t blob = 0;
+
+	if (!accdb_index_has_entry(idx))
+		return -1;
+
+	db = idx->db;
+	if (index_rec_get_extended(idx->rec) &&
+	    index_rec_parse_extended(idx->rec, &brief, &blob) < 0)
+		return -1;
+	if (user_index_del(idx) < 0)
+		return -1;
+	if (tree_delete(db, INDEX_START(db), idx) < 0) {
+		db->count = ACCDB_COUNT_UNKNOWN;
+		return -1;
+	}
+	if (db->count != ACCDB_COUNT_UNKNOWN)
+		db->count--;
+
+	// a failure here leaks the blob, but leaves the index whole
+	if (blob && accdb_list_clear(db, blob) < 0)
+		return -1;
+
+	return 0;
+}
+
+// put a copy of the record at p into the tree at root
+static int8_t
+index_migrate_rec(struct accdb *db, uint16_t root, const uint8_t *p)
+{
+	struct accdb_index idx;
+	uint8_t rec[REC_INDEX_ENTRY_MAX + 1];
+	uint8_t len = index_rec_get_total_size(p);
+	int8_t rv;
+
+	memset(&idx, 0, sizeof(idx));
+	memcpy(rec, p, len);
+	rv = tree_insert(db, root, &idx, rec, len);
+	accdb_index_clear(&idx);
+
+	return rv;
+}
+
+// put every record on the list of pages at ptr, flat ones or leaves,
+// into the tree at root, leaving the pages as they are
+static int8_t
+index_migrate_list(struct accdb *db, uint16_t root, uint16_t ptr)
+{
+	uint8_t *buf, *p;
+	uint8_t i;
+
+	while (ptr) {
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return -1;
+		accdb_cache_prefetch(db, buf);
+		if (buf_get_type(buf) == SECT_TYPE_LEAF) {
+			for (i = 0; i < leaf_count(buf); ++i)
+				if (index_migrate_rec(db, root,
+						      leaf_rec(buf, i)) < 0)
+					goto fail;
+		} else {
+			for (p = buf_get_payload(buf); p < buf_get_end(buf);
+			     index_rec_next(&p))
+				if (index_migrate_rec(db, root, p) < 0)
+					goto fail;
+		}
+		ptr = buf_get_next(buf);
+		accdb_cache_put(buf);
+	}
+
+	return 0;
+
+fail:
+	accdb_cache_put(buf);
+	return -1;
+}
+
+// free the list of pages at ptr
+static int8_t
+index_migrate_free(struct accdb *db, uint16_t ptr)
+{
+	uint8_t *buf;
+
+	while (ptr) {
+		buf = accdb_cache_get(db, ptr);
+		if (buf == NULL)
+			return -1;
+		ptr = buf_get_next(buf);
+		if (accdb_deallocate_buf(db, buf) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// forget a migration that failed: nothing it left in the cache is
+// written, and what's kept in memory about the file is read again
+static int8_t
+index_migrate_undo(struct accdb *db)
+{
+	accdb_cache_discard(db);
+	accdb_bitmap_reset(db);
+	find_invalidate(db);
+	db->count = ACCDB_COUNT_UNKNOWN;
+	db->compact_next = 0;
+	db->tail = 0;
+
+	return -1;
+}
+
+// swap the contents of two sectors
+static void
+buf_swap(uint8_t *a, uint8_t *b)
+{
+	uint16_t i;
+	uint8_t t;
+
+	for (i = 0; i < VFS_SECT_SIZE; ++i) {
+		t = a[i];
+		a[i] = b[i];
+		b[i] = t;
+	}
+	accdb_cache_dirty(a);
+	accdb_cache_dirty(b);
+}
+
+// convert an index in an older format, which accdb_open says
+// ACCDB_OPEN_LEGACY for. nothing else should be done with the handle
+// before this. before the tree, the index was a list of pages starting at
+// INDEX_START. before slotted leaves, the tree's leaves were such a list,
+// under a root at INDEX_START with no INDEX_VERSION, and before the
+// counts, they were leaves as now, under nodes whose children were only
+// a sector. either way the list holds every record.
+//
+// the new tree is built under a root of its own, leaving the old index
+// alone, and written out. then the new root and INDEX_START swap
+// contents, and writing INDEX_START is what switches to the new index.
+// the old pages and nodes, and any user index, are freed after that, and
+// the user index is built again. a crash, or a failure, leaves either
+// index whole, at worst with sectors marked used that nothing uses. on a
+// failure nothing left in the cache is written.
+int8_t
+accdb_index_migrate(struct accdb *db)
+{
+	uint8_t *head, *root, *buf;
+	uint16_t old, first, user = 0;
+	uint8_t tree;
+
+	head = accdb_cache_get(db, INDEX_START(db));
+	if (head == NULL)
+		return -1;
+	tree = buf_get_type(head) == SECT_TYPE_NODE;
+	if (tree && buf_get_prev(head) == INDEX_VERSION) {
+		accdb_cache_put(head);
+		return 0;
+	}
+	if (tree ? buf_get_prev(head) > INDEX_VERSION :
+	    buf_get_type(head) != SECT_TYPE_INDEX) {
+		accdb_cache_put(head);
+		return -1;
+	}
+	first = INDEX_START(db);
+	if (tree) {
+		user = buf_get_next(head);
+		first = get_uint16(buf_get_payload(head), 0);
+	}
+	accdb_cache_put(head);
+
+	// the old tree's leaves are the list, from its first one
+	while (tree) {
+		buf = accdb_cache_get(db, first);
+		if (buf == NULL)
+			return index_migrate_undo(db);
+		if (buf_get_type(buf) != SECT_TYPE_NODE) {
+			accdb_cache_put(buf);
+			break;
+		}
+		first = get_uint16(buf_get_payload(buf), 0);
+		accdb_cache_put(buf);
+	}
+
+	root = tree_create(db);
+	if (root == NULL)
+		return index_migrate_undo(db);
+	old = accdb_cache_sector(root);
+	accdb_cache_put_dirty(root);
+	if (index_migrate_list(db, old, first) < 0 ||
+	    accdb_cache_flush(db) < 0)
+		return index_migrate_undo(db);
+
+	head = accdb_cache_get(db, INDEX_START(db));
+	if (head == NULL)
+		return index_migrate_undo(db);
+	root = accdb_cache_get(db, old);
+	if (root == NULL) {
+		accdb_cache_put(head);
+		return index_migrate_undo(db);
+	}
+	buf_swap(head, root);
+	accdb_cache_put(root);
+	accdb_cache_put(head);
+	if (accdb_cache_flush(db) < 0)
+		return index_migrate_undo(db);
+
+	find_invalidate(db);
+	db->count = ACCDB_COUNT_UNKNOWN;
+	db->compact_next = 0;
+	db->tail = 0;
+	// the old root, or first page, is where the new root was. the old
+	// tree's nodes go with it, leaving its leaves.
+	if (tree) {
+		if (tree_free(db, old, 0, NODE_CHILD_SIZE_V1) < 0 ||
+		    index_migrate_free(db, first) < 0 ||
+		    (user && tree_free(db, user, 1, NODE_CHILD_SIZE_V1) < 0))
+			return index_migrate_undo(db);
+	} else if (index_migrate_free(db, old) < 0) {
+		return index_migrate_undo(db);
+	}
+	if (accdb_cache_flush(db) < 0)
+		return -1;
+
+	return user ? accdb_user_index(db, 1) : 0;
+}
+
+/*
+Compaction
+
+Deleting records leaves leaves part empty, and new leaves go wherever
+the allocator finds room, so over time the leaf list spreads out over
+the file in no order and read ahead, which only follows a link to the
+next sector, stops paying. accdb_compact walks the leaves a few at a
+time, carrying on from where the last call stopped. Each step, it
+	- takes in the records of the leaf after the current one, when they
+	  fit and the two are under the same node, and frees that leaf
+	- or, when it can't, moves the current leaf to the first free
+	  sector after the leaf before it, when that's lower than where
+	  it is or it's out of order, and goes on to the next leaf
+so a pass leaves the leaves fuller, and in runs of ascending sectors as
+far as free space allows. Only the index is done, the user index can be
+built again with accdb_user_index. Like adding and deleting, it moves
+records between leaves, so index positions and ids kept from before a
+step are stale after it. It isn't crash safe between flushes.
+*/
+
+// take in the records of the leaf after leaf, if there's room for them
+// and it's a child of the same node. 1 if it did.
+static int8_t
+compact_merge(struct accdb *db, uint8_t *leaf)
+{
+	struct tree_path path;
+	struct tree_step *step;
+	uint8_t *next, *rec, *node, *pl;
+	uint8_t i, len;
+	int8_t rv;
+
+	if (!buf_get_next(leaf))
+		return 0;
+	next = accdb_cache_get(db, buf_get_next(leaf));
+	if (next == NULL)
+		return -1;
+	if (leaf_count(next) == 0 || buf_get_size(leaf) + buf_get_size(next) -
+	    LEAF_SLOTS > SECT_PAYLOAD_MAX) {
+		accdb_cache_put(next);
+		return 0;
+	}
+	if (tree_find_path(db, INDEX_START(db),
+			   index_rec_brief(leaf_rec(next, 0)),
+			   accdb_cache_sector(next), &path) < 0) {
+		accdb_cache_put(next);
+		return -1;
+	}
+	// as the first child, it's under a different node to leaf
+	step = &path.step[path.depth - 1];
+	if (step->key == 0) {
+		accdb_cache_put(next);
+		return 0;
+	}
+	// what can fail is had first, so a failure leaves both leaves and
+	// their counts as they were. node stays referenced for
+	// tree_remove_child, which as next isn't its only child, only
+	// changes node.
+	node = accdb_cache_get(db, step->sector);
+	if (node == NULL) {
+		accdb_cache_put(next);
+		return -1;
+	}
+	if (accdb_list_remove(db, next) < 0) {
+		accdb_cache_put(node);
+		accdb_cache_put(next);
+		return -1;
+	}
+
+	// leaf is the child before it, and takes its count
+	pl = buf_get_payload(node);
+	node_set_count(pl, step->key - NODE_CHILD_SIZE,
+		       node_count(pl, step->key - NODE_CHILD_SIZE) +
+		       node_count(pl, step->child));
+	node_set_count(pl, step->child, 0);
+	for (i = 0; i < leaf_count(next); ++i) {
+		len = index_rec_get_total_size(leaf_rec(next, i));
+		rec = leaf_insert(leaf, leaf_count(leaf), len);
+		chDbgAssert(rec != NULL, "compact_merge #1", "no room");
+		memcpy(rec, leaf_rec(next, i), len);
+	}
+	accdb_cache_dirty(leaf);
+	find_invalidate(db);
+	db->tail = 0;
+	rv = tree_remove_child(db, &path);
+	accdb_cache_put_dirty(node);
+	if (rv < 0)
+		return -1;
+
+	// a failure from here on leaks next, or leaves the tree a level
+	// higher than it needs to be
+	if (accdb_deallocate_buf(db, next) < 0 ||
+	    tree_collapse(db, INDEX_START(db)) < 0)
+		return -1;
+
+	return 1;
+}
+
+// move *leaf to the first free sector after the leaf before it, if
+// that's lower than where it is or it's out of order, and point *leaf at
+// the copy
+static int8_t
+compact_move(struct accdb *db, uint8_t **leaf)
+{
+	struct tree_path path;
+	struct tree_step *step;
+	uint8_t *to, *from, *node;
+	uint16_t prev = buf_get_prev(*leaf), sector;
+	uint32_t limit = accdb_cache_sector(*leaf);
+	int8_t rv;
+
+	if (leaf_count(*leaf) == 0)
+		return 0;
+	if (limit <= prev)
+		limit = (uint32_t)ACCDB_MAX + 1;
+	rv = accdb_allocate_range(db, prev ? (uint32_t)prev + 1 : 0, limit,
+				  &sector);
+	if (rv != 0)
+		return rv < 0 ? -1 : 0;
+
+	// the way to it is needed to change the pointer to it. its parent
+	// and the new sector are had before the list changes, so a failure
+	// leaves the tree as it was, with the sector free again.
+	if (tree_find_path(db, INDEX_START(db),
+			   index_rec_brief(leaf_rec(*leaf, 0)),
+			   accdb_cache_sector(*leaf), &path) < 0)
+		goto fail;
+	step = &path.step[path.depth - 1];
+	node = accdb_cache_get(db, step->sector);
+	if (node == NULL)
+		goto fail;
+	to = accdb_cache_get(db, sector);
+	if (to == NULL) {
+		accdb_cache_put(node);
+		goto fail;
+	}
+	memcpy(to, *leaf, VFS_SECT_SIZE);
+	if (accdb_list_replace(db, *leaf, to) < 0) {
+		accdb_cache_put(node);
+		accdb_deallocate_buf(db, to);
+		return -1;
+	}
+	set_uint16(buf_get_payload(node), step->child, sector);
+	accdb_cache_put_dirty(node);
+
+	find_invalidate(db);
+	db->tail = 0;
+	// the caller's reference goes to the copy. a failure to free the
+	// old leaf only leaks it.
+	from = *leaf;
+	*leaf = to;
+	return accdb_deallocate_buf(db, from);
+
+fail:
+	accdb_deallocate_sector(db, sector);
+	return -1;
+}
+
+// do up to steps leaves of compaction, see above, and flush. 1 if there
+// are more to do, 0 when that was the end of a pass, after which the
+// next call starts another one.
+int8_t
+accdb_compact(struct accdb *db, uint16_t steps)
+{
+	uint8_t *leaf;
+	int8_t rv = 1, merged;
+
+	while (steps-- > 0) {
+		if (db->compact_next)
+			leaf = accdb_cache_get(db, db->compact_next);
+		else
+			leaf = tree_edge(db, INDEX_START(db), 0, NULL);
+		if (leaf == NULL) {
+			rv = -1;
+			break;
+		}
+		if (buf_get_type(leaf) != SECT_TYPE_LEAF) {
+			// not a leaf anymore, start again
+			accdb_cache_put(leaf);
+			db->compact_next = 0;
+			continue;
+		}
+		// a leaf that took in the next one stays for another
+		// step, it may have room for the one after as well
+		merged = compact_merge(db, leaf);
+		if (merged == 0 && compact_move(db, &leaf) < 0)
+			merged = -1;
+		if (merged < 0) {
+			accdb_cache_put(leaf);
+			db->compact_next = 0;
+			rv = -1;
+			break;
+		}
+		db->compact_next = merged ? accdb_cache_sector(leaf) :
+			buf_get_next(leaf);
+		accdb_cache_put(leaf);
+		if (!db->compact_next) {
+			rv = 0;
+			break;
+		}
+	}
+
+	if (accdb_cache_flush(db) < 0)
+		return -1;
+	return rv;
+}
+
+// open handles, most recently opened first
+static struct accdb *open_dbs;
+
+void
+accdb_stats_get(struct accdb *db, struct accdb_stats *st)
+{
+	*st = db->stats;
+}
+
+// start a new counting window
+void
+accdb_stats_reset(struct accdb *db)
+{
+	memset(&db->stats, 0, sizeof(db->stats));
+	db->stats.since = chTimeNow();
+}
+
+void
+accdb_stats_print(struct accdb *db)
+{
+	static const char *const names[ACCDB_NKINDS] = {
+		"bitmap", "index", "blob", "other"
+	};
+	const struct accdb_stats *st = &db->stats;
+	const struct accdb_kind_stats *k;
+	uint32_t hits = 0, misses = 0;
+	uint8_t i;
+
+	outf("Stats over %lu ms\r\n",
+	     (unsigned long)((uint64_t)(systime_t)(chTimeNow() - st->since) *
+			     1000 / CH_FREQUENCY));
+	for (i = 0; i < ACCDB_NKINDS; ++i) {
+		k = &st->kind[i];
+		hits += k->hits;
+		misses += k->misses;
+		outf("%-6s hits: %lu, misses: %lu, read: %lu (%lu bytes), "
+		     "written: %lu (%lu bytes)\r\n", names[i],
+		     (unsigned long)k->hits, (unsigned long)k->misses,
+		     (unsigned long)k->reads,
+		     (unsigned long)ACCDB_STATS_BYTES(k->reads),
+		     (unsigned long)k->writes,
+		     (unsigned long)ACCDB_STATS_BYTES(k->writes));
+	}
+	outf("Total: %lu, Hits: %lu, Misses: %lu\r\n",
+	     (unsigned long)(hits + misses), (unsigned long)hits,
+	     (unsigned long)misses);
+	outf("Evictions: %lu, Write-backs: %lu, Reclaims: %lu\r\n",
+	     (unsigned long)st->evictions, (unsigned long)st->writebacks,
+	     (unsigned long)st->reclaims);
+	outf("Pinned: %u/%u\r\n", (unsigned)db->npinned,
+	     (unsigned)ACCDB_PIN_MAX(db->ncache));
+	outf("Read ahead: %lu, used: %lu\r\n",
+	     (unsigned long)st->readahead_sectors,
+	     (unsigned long)st->readahead_hits);
+	outf("Find: table %lu, tree %lu, brief table %u/%u%s\r\n",
+	     (unsigned long)st->find_table, (unsigned long)st->find_tree,
+	     (unsigned)db->find_used, (unsigned)db->find_size,
+	     db->find_state == ACCDB_FIND_BLOOM ? " (bloom)" : "");
+	if (st->flushes) {
+		// tenths, outf has no floating point
+		unsigned long spf = st->flush_sectors * 10UL / st->flushes;
+		unsigned long wpf = st->flush_writes * 10UL / st->flushes;
+
+		outf("Flushes: %lu, Sectors/flush: %lu.%lu, "
+		     "Writes/flush: %lu.%lu, Avg flush: %lu us\r\n",
+		     (unsigned long)st->flushes, spf / 10, spf % 10,
+		     wpf / 10, wpf % 10,
+		     (unsigned long)((uint64_t)st->flush_ticks * 1000000 /
+				     CH_FREQUENCY / st->flushes));
+	}
+}
+
+// print, and optionally reset, the stats of every open handle
+void
+accdb_stats_print_all(int reset)
+{
+	struct accdb *db;
+
+	if (open_dbs == NULL)
+		outf("no open accdb\r\n");
+	for (db = open_dbs; db != NULL; db = db->next_open) {
+		outf("accdb %p, %u cached sectors\r\n", db,
+		     (unsigned)db->ncache);
+		accdb_stats_print(db);
+		if (reset)
+			accdb_stats_reset(db);
+	}
+}
+
+// ncache is the number of sectors to cache, or 0 for ACCDB_CACHE_SIZE.
+// the pool should have ACCDB_POOL_SIZE(ncache) blocks to fill them all.
+// returns ACCDB_OPEN_LEGACY for an index in an older layout. the handle
+// is open, but only for accdb_index_migrate, which isn't done without
+// being asked, or accdb_close.
+int8_t
+accdb_open(struct accdb *db, struct file *fp, struct pool *pool,
+	   uint16_t ncache)
+{
+	uint8_t *buf, legacy = 0;
+
+	if (ncache == 0)
+		ncache = ACCDB_CACHE_SIZE;
+
+	db->fp = fp;
+	db->strategy = CACHE_LIRS;
+	db->readahead = ACCDB_READAHEAD;
+	db->pool = pool;
+	db->sect_start = vfs_start_sector(fp);
+	if (accdb_cache_init(db, ncache) < 0)
+		return -1;
+	db->cleanup.cb = (try_free_cb)accdb_cache_do_cleanup;
+	db->cleanup.arg = db;
+	pool_add_cleanup(pool, &db->cleanup);
+	db->autopin = 1;
+	db->pin_bitmap = BITMAP_START(db);
+	accdb_bitmap_reset(db);
+	db->find = NULL;
+	accdb_find_budget(db, ACCDB_FIND_BUDGET);
+	db->count = ACCDB_COUNT_UNKNOWN;
+	db->compact_next = 0;
+	db->tail = 0;
+
+	// look at the index without caching anything, a new db has none
+	buf = pool_allocate_block(pool, NULL);
+	if (buf != NULL) {
+		// the older layouts had a version below INDEX_VERSION in the
+		// root's prev link, 0 before the tree, which keeps sectors that
+		// were never formatted, or were under another key, from being
+		// taken for them
+		if (vfs_read_sector(fp, buf, INDEX_START(db)) == 0)
+			legacy = ((buf_get_type(buf) == SECT_TYPE_INDEX &&
+				   buf_get_prev(buf) == 0) ||
+				  (buf_get_type(buf) == SECT_TYPE_NODE &&
+				   buf_get_prev(buf) < INDEX_VERSION)) &&
+				 buf_get_size(buf) <= SECT_PAYLOAD_MAX;
+		pool_deallocate_block(pool, buf);
+	}
+	db->next_open = open_dbs;
+	open_dbs = db;
+	
+	return legacy ? ACCDB_OPEN_LEGACY : 0;
+}
+
+int8_t
+accdb_close(struct accdb *db)
+{
+	struct accdb **pp;
+	size_t i;
+	int8_t rv;
+
+	// the handle goes whether or not everything could be written
+	rv = accdb_cache_flush(db);
+	accdb_cache_unpin_all(db);
+	db->autopin = 0;
+
+	pool_del_cleanup(db->pool, &db->cleanup);
+	for (pp = &open_dbs; *pp != NULL; pp = &(*pp)->next_open) {
+		if (*pp == db) {
+			*pp = db->next_open;
+			break;
+		}
+	}
+
+	for (i = 0; i < db->ncache; ++i) {
+		struct sector *s = &db->cache[i];
+		if (s->buf)
+			pool_deallocate_block(db->pool, s->buf);
+	}
+	fast_free(db->cache);
+	fast_free(db->hash);
+	fast_free(db->ghosts);
+	fast_free(db->flush_bufs);
+	accdb_find_budget(db, 0);
+	db->cache = NULL;
+	db->hash = NULL;
+	db->ghosts = NULL;
+	db->flush_bufs = NULL;
+	db->ncache = 0;
+
+	return rv;
+}
+
+//// Self-Tests ////
+
+void
+test_accdb(struct accdb *db)
+{
+	size_t i;
+	char brief[32], user[32], pass[32];
+	char *bigbuf;
+	const char *briefp, *userp, *passp;
+	struct accdb_index idx;
+	accdb_id_t *id;
+	const void *note;
+	size_t size;
+
+	bigbuf = (char*)pool_allocate_block(db->pool, NULL);
+	v_assert(bigbuf != NULL);
+
+	// sizeof(accdb_id_t) == 4
+	// 4 * 128 == 512
 	id = (accdb_id_t *)bigbuf;
 
-	memset(&idx, 0, sizeof(struct accdb_index));
-	
-	for (i = 0; i < 128; ++i) {
-		sprintf(brief, "BRIEF%u", (unsigned)i);
-		sprintf(user, "USER%u", (unsigned)i);
-		sprintf(pass, "PASS%u", (unsigned)i);
-		v_assert(accdb_add(db, &idx, brief, user, pass) == 0);
+	memset(&idx, 0, sizeof(struct accdb_index));
+	
+	for (i = 0; i < 128; ++i) {
+		sprintf(brief, "BRIEF%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		sprintf(pass, "PASS%u", (unsigned)i);
+		v_assert(accdb_add(db, &idx, brief, user, pass) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+		v_assert(strcmp(pass, passp) == 0);
+		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+		v_assert(strcmp(brief, briefp) == 0);
+	}
+
+	// adds can move records between leaves, so ids are taken after
+	v_assert(accdb_index_init(db, &idx) == 0);
+	for (i = 0; i < 128; ++i) {
+		v_assert(accdb_index_has_entry(&idx));
+		v_assert(accdb_index_to_id(&idx, &id[i]) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+
+	for (i = 0; i < 128; ++i) {
+		sprintf(brief, "BRIEF%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		sprintf(pass, "PASS%u", (unsigned)i);
+		v_assert(accdb_index_from_id(db, &idx, id[i]) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+		v_assert(strcmp(pass, passp) == 0);
+	}
+
+	memset(bigbuf, 0, VFS_SECT_SIZE);
+	v_assert(accdb_index_init(db, &idx) == 0);
+
+	i = 0;
+	while (accdb_index_has_entry(&idx)) {
+		sprintf(brief, "BRIEF%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		sprintf(pass, "PASS%u", (unsigned)i);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		//printf("%s, %s, %s\r\n", briefp, userp, passp);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+		v_assert(strcmp(pass, passp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+		++i;
+	}
+	v_assert(i == 128);
+
+	i = 128;
+	v_assert(accdb_index_prev(&idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(i > 0);
+		--i;
+		sprintf(brief, "BRIEF%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		sprintf(pass, "PASS%u", (unsigned)i);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		//printf("%s, %s, %s\r\n", briefp, userp, passp);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+		v_assert(strcmp(pass, passp) == 0);
+		v_assert(accdb_index_prev(&idx) == 0);
+	}
+	v_assert(i == 0);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+
+	i = 0;
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_del(&idx) == 0);
+		if (++i == 64)
+			break;
+	}
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		sprintf(brief, "BRIEF%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		sprintf(pass, "PASS%u", (unsigned)i);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		//printf("%s, %s, %s\r\n", briefp, userp, passp);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+		v_assert(strcmp(pass, passp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+		++i;
+	}
+	v_assert(i == 128);
+
+	v_assert(accdb_index_prev(&idx) == 0);
+	v_assert(accdb_del(&idx) == 0);
+	v_assert(accdb_index_prev(&idx) == 0);
+	v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+	//printf("%s, %s, %s\r\n", briefp, userp, passp);
+
+	memset(bigbuf, 'B', REC_BLOB_ENTRY_MAX);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	v_assert(accdb_add_note(&idx, bigbuf, REC_BLOB_ENTRY_MAX) == 0);
+	v_assert(accdb_add_note(&idx, bigbuf, 130) == 0);
+	v_assert(accdb_add_note(&idx, bigbuf, 20) == 0);
+	v_assert(accdb_add_note(&idx, bigbuf, REC_BLOB_ENTRY_MAX) == 0);
+	
+	v_assert(accdb_index_init(db, &idx) == 0);
+	i = 64;
+	while (accdb_index_has_entry(&idx)) {
+		sprintf(brief, "BRIEF%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		sprintf(pass, "PASS%u", (unsigned)i);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		//printf("%s, %s, %s\r\n", briefp, userp, passp);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+		v_assert(strcmp(pass, passp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+		++i;
+	}
+	v_assert(i == 127);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+	note = NULL;
+	i = 0;
+	while (1) {
+		v_assert(accdb_index_next_note(&idx, &note, &size) == 0);
+		if (note == NULL)
+			break;
+		v_assert(size <= REC_BLOB_ENTRY_MAX);
+		v_assert(memcmp(note, bigbuf, size) == 0);
+		++i;
+	}
+	v_assert(i == 4);
+
+	memset(bigbuf, 'B', 130);
+	bigbuf[129] = '\0';
+
+	v_assert(accdb_add(db, &idx, "blob brief", "blob usr", bigbuf) == 0);
+	v_assert(accdb_add(db, &idx, "blob brief", "blob usr", bigbuf) == 0);
+	v_assert(accdb_add(db, &idx, "blob brief", "blob usr", bigbuf) == 0);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+
+	i = 0;
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		if (!strcmp(briefp, "blob brief")) {
+			//printf("%s, %s, '%s'\r\n", briefp, userp, passp);
+			v_assert(strcmp("blob usr", userp) == 0);
+			v_assert(strcmp(bigbuf, passp) == 0);
+			++i;
+		}
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	v_assert(i == 3);
+
+	v_assert(accdb_add(db, &idx, "blob all", bigbuf, bigbuf) == 0);
+	v_assert(accdb_index_init(db, &idx) == 0);
+
+	i = 0;
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		if (!strcmp(briefp, "blob all")) {
+			v_assert(strcmp(bigbuf, userp) == 0);
+			v_assert(strcmp(bigbuf, passp) == 0);
+			++i;
+		}
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	v_assert(i == 1);
+
+	memset(bigbuf, 'B', REC_BLOB_ENTRY_MAX);
+	bigbuf[REC_BLOB_ENTRY_MAX - 1] = '\0';
+
+	v_assert(accdb_add(db, &idx, "blob giant", bigbuf, bigbuf) == 0);
+	v_assert(accdb_cache_clear(db) == 0);
+	v_assert(accdb_index_init(db, &idx) == 0);
+
+	i = 0;
+	while (accdb_index_has_entry(&idx)) {
 		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		if (!strcmp(briefp, "blob giant")) {
+			v_assert(strcmp(bigbuf, userp) == 0);
+			v_assert(strcmp(bigbuf, passp) == 0);
+			++i;
+		}
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	v_assert(i == 1);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_del(&idx) == 0);
+	}
+
+	accdb_index_clear(&idx);
+	pool_deallocate_block(db->pool, (uint8_t *)bigbuf);
+}
+
+#define TREE_TEST_N	300
+#define TREE_TEST_DUPS	12
+// a long shared prefix makes long separators and few keys per node
+#define TREE_TEST_PREFIX \
+	"tree-test-xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" \
+	"xxxxxxxxxxxxxxxxxxxxxx-"
+
+static void
+tree_test_brief(char *brief, size_t i)
+{
+	sprintf(brief, TREE_TEST_PREFIX "%04u", (unsigned)i);
+}
+
+// turn the emptied index back into the list of pages from before the
+// tree, holding n records with pass, and write it out
+static void
+tree_test_legacy(struct accdb *db, size_t n, const char *pass)
+{
+	char brief[16], user[16];
+	uint8_t *root, *buf, *page, *p;
+	uint8_t len;
+	size_t i;
+
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	buf = accdb_cache_get(db, get_uint16(buf_get_payload(root), 0));
+	v_assert(buf != NULL);
+	v_assert(leaf_count(buf) == 0 && buf_get_next(buf) == SECT_NULL);
+	v_assert(accdb_deallocate_buf(db, buf) == 0);
+	buf_set_type_size(root, SECT_TYPE_INDEX, 0);
+	buf_set_prev(root, 0);
+	page = accdb_cache_ref(root);
+	for (i = 0; i < n; ++i) {
+		sprintf(brief, "LEGACY%u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		v_assert(index_rec_find_type(brief, user, pass, &len) ==
+			 INDEX_NORMAL);
+		p = buf_allocate_record(page, len);
+		if (p == NULL) {
+			buf = accdb_allocate_buf(db, SECT_TYPE_INDEX);
+			v_assert(buf != NULL);
+			v_assert(accdb_list_append(db, page, buf) == 0);
+			accdb_cache_put_dirty(page);
+			page = buf;
+			p = buf_allocate_record(page, len);
+		}
+		v_assert(index_rec_create(p, brief, user, pass) == 0);
+	}
+	accdb_cache_put_dirty(page);
+	accdb_cache_put_dirty(root);
+	v_assert(accdb_cache_flush(db) == 0);
+}
+
+// free sectors under the first bitmap sector, as the file has it
+static uint16_t
+tree_test_free(struct accdb *db)
+{
+	uint8_t *buf = accdb_cache_get(db, BITMAP_START(db));
+	uint16_t n;
+
+	v_assert(buf != NULL);
+	n = bitmap_count_free(buf);
+	accdb_cache_put(buf);
+
+	return n;
+}
+
+// the records under sector, checking the count of every child on the way
+static uint32_t
+tree_test_counts(struct accdb *db, uint16_t sector)
+{
+	uint8_t *buf, *pl;
+	uint16_t off = 0;
+	uint32_t n = 0, c;
+
+	buf = accdb_cache_get(db, sector);
+	v_assert(buf != NULL);
+	if (buf_get_type(buf) == SECT_TYPE_LEAF) {
+		n = leaf_count(buf);
+		accdb_cache_put(buf);
+		return n;
+	}
+	v_assert(buf_get_type(buf) == SECT_TYPE_NODE);
+	pl = buf_get_payload(buf);
+	while (1) {
+		c = tree_test_counts(db, get_uint16(pl, off));
+		v_assert(c == node_count(pl, off));
+		n += c;
+		off += NODE_CHILD_SIZE;
+		if (off >= buf_get_size(buf))
+			break;
+		off += 1 + NODE_KEY_LEN(pl + off);
+	}
+	accdb_cache_put(buf);
+
+	return n;
+}
+
+void
+test_accdb_tree(struct accdb *db)
+{
+	char brief[REC_INDEX_ENTRY_MAX], user[32], last[REC_INDEX_ENTRY_MAX];
+	const char *briefp, *userp, *passp;
+	struct accdb_index idx;
+	struct accdb_user_search us;
+	uint8_t *root, *buf, *tmp, *p;
+	struct file *fp;
+	struct pool *pool;
+	char pass[101];
+	uint8_t len;
+	uint16_t ptr, ncache, nfree;
+	uint32_t count;
+	size_t i, j, depth;
+
+	memset(&idx, 0, sizeof(idx));
+
+	// out of order, so records go in all over the tree
+	for (i = 0; i < TREE_TEST_N; ++i) {
+		j = (i * 7) % TREE_TEST_N;
+		tree_test_brief(brief, j);
+		sprintf(user, "USER%u", (unsigned)j);
+		v_assert(accdb_add(db, &idx, brief, user, "PASS") == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
 		v_assert(strcmp(brief, briefp) == 0);
 		v_assert(strcmp(user, userp) == 0);
-		v_assert(strcmp(pass, passp) == 0);
+	}
+	accdb_index_clear(&idx);
+	v_assert(tree_test_counts(db, INDEX_START(db)) == TREE_TEST_N);
+
+	depth = 0;
+	ptr = INDEX_START(db);
+	while (1) {
+		buf = accdb_cache_get(db, ptr);
+		v_assert(buf != NULL);
+		if (buf_get_type(buf) != SECT_TYPE_NODE) {
+			v_assert(buf_get_type(buf) == SECT_TYPE_LEAF);
+			accdb_cache_put(buf);
+			break;
+		}
+		ptr = get_uint16(buf_get_payload(buf), 0);
+		accdb_cache_put(buf);
+		++depth;
+	}
+	v_assert(depth >= 2);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+	for (i = 0; i < TREE_TEST_N; ++i) {
+		tree_test_brief(brief, i);
 		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
 		v_assert(strcmp(brief, briefp) == 0);
-		v_assert(accdb_index_to_id(&idx, &id[i]) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
 	}
+	v_assert(!accdb_index_has_entry(&idx));
 
-	for (i = 0; i < 128; ++i) {
-		sprintf(brief, "BRIEF%u", (unsigned)i);
+	for (i = 0; i < TREE_TEST_N; ++i) {
+		tree_test_brief(brief, i);
 		sprintf(user, "USER%u", (unsigned)i);
-		sprintf(pass, "PASS%u", (unsigned)i);
-		v_assert(accdb_index_from_id(db, &idx, id[i]) == 0);
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+		v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+	}
+
+	// between two briefs, and past all of them
+	tree_test_brief(brief, 41);
+	strcat(brief, "a");
+	v_assert(accdb_index_lookup(db, &idx, brief) == -1);
+	v_assert(accdb_index_seek_brief(db, &idx, brief) == 0);
+	tree_test_brief(brief, 42);
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	v_assert(strcmp(brief, briefp) == 0);
+	v_assert(accdb_index_seek_brief(db, &idx, "zzz") == 0);
+	v_assert(!accdb_index_has_entry(&idx));
+	v_assert(accdb_index_prev(&idx) == 0);
+	tree_test_brief(brief, TREE_TEST_N - 1);
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	v_assert(strcmp(brief, briefp) == 0);
+
+	// duplicates spread over several leaves are found from the first
+	tree_test_brief(brief, 100);
+	for (i = 0; i < TREE_TEST_DUPS; ++i) {
+		sprintf(user, "DUP%u", (unsigned)i);
+		v_assert(accdb_add(db, &idx, brief, user, "PASS") == 0);
+	}
+	v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+	for (i = 0; i < TREE_TEST_DUPS + 1; ++i) {
+		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	tree_test_brief(brief, 101);
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	v_assert(strcmp(brief, briefp) == 0);
+	tree_test_brief(brief, 100);
+	v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+	v_assert(accdb_index_prev(&idx) == 0);
+	tree_test_brief(brief, 99);
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	v_assert(strcmp(brief, briefp) == 0);
+	accdb_index_clear(&idx);
+	v_assert(tree_test_counts(db, INDEX_START(db)) ==
+		 TREE_TEST_N + TREE_TEST_DUPS);
+
+	// deleting from the middle keeps the order
+	for (i = 0; i < TREE_TEST_N; i += 3) {
+		tree_test_brief(brief, i);
+		v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+		v_assert(accdb_del(&idx) == 0);
+	}
+	v_assert(accdb_index_init(db, &idx) == 0);
+	last[0] = '\0';
+	i = 0;
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+		v_assert(strcmp(last, briefp) <= 0);
+		strcpy(last, briefp);
+		v_assert(accdb_index_next(&idx) == 0);
+		++i;
+	}
+	v_assert(i == TREE_TEST_N - (TREE_TEST_N + 2) / 3 + TREE_TEST_DUPS);
+	v_assert(tree_test_counts(db, INDEX_START(db)) == i);
+
+	// emptied, the tree is down to the root and one leaf
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	v_assert(buf_get_type(root) == SECT_TYPE_NODE);
+	v_assert(buf_get_size(root) == NODE_CHILD_SIZE);
+	v_assert(node_count(buf_get_payload(root), 0) == 0);
+	buf = accdb_cache_get(db, get_uint16(buf_get_payload(root), 0));
+	v_assert(buf != NULL);
+	v_assert(buf_get_type(buf) == SECT_TYPE_LEAF);
+	v_assert(leaf_count(buf) == 0);
+	v_assert(buf_get_size(buf) == LEAF_SLOTS);
+	v_assert(buf_get_next(buf) == SECT_NULL);
+
+	// back to the old format: an unsorted list of pages at INDEX_START
+	v_assert(accdb_deallocate_buf(db, buf) == 0);
+	buf_set_type_size(root, SECT_TYPE_INDEX, 0);
+	buf = accdb_allocate_buf(db, SECT_TYPE_INDEX);
+	v_assert(buf != NULL);
+	v_assert(accdb_list_append(db, root, buf) == 0);
+	for (i = 0; i < 10; ++i) {
+		sprintf(brief, "LEGACY%u", (unsigned)(9 - i));
+		sprintf(user, "USER%u", (unsigned)(9 - i));
+		v_assert(index_rec_find_type(brief, user, "PASS", &len) ==
+			 INDEX_NORMAL);
+		p = buf_allocate_record(i < 5 ? root : buf, len);
+		v_assert(p != NULL);
+		v_assert(index_rec_create(p, brief, user, "PASS") == 0);
+	}
+	accdb_cache_put_dirty(buf);
+	accdb_cache_put_dirty(root);
+
+	v_assert(accdb_index_migrate(db) == 0);
+	v_assert(accdb_index_migrate(db) == 0);
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	v_assert(buf_get_type(root) == SECT_TYPE_NODE);
+	accdb_cache_put(root);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	for (i = 0; i < 10; ++i) {
+		sprintf(brief, "LEGACY%u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
 		v_assert(strcmp(brief, briefp) == 0);
 		v_assert(strcmp(user, userp) == 0);
-		v_assert(strcmp(pass, passp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	v_assert(!accdb_index_has_entry(&idx));
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+
+	// opening finds an index from before the tree, and leaves it be
+	memset(pass, 'p', sizeof(pass) - 1);
+	pass[sizeof(pass) - 1] = '\0';
+	tree_test_legacy(db, 12, pass);
+	fp = db->fp;
+	pool = db->pool;
+	ncache = db->ncache;
+	v_assert(accdb_close(db) == 0);
+	v_assert(accdb_open(db, fp, pool, ncache) == ACCDB_OPEN_LEGACY);
+
+	// running out of sectors after the new root and its first leaf
+	// fails the migration half way, with nothing written
+	nfree = tree_test_free(db);
+	for (j = 0, ptr = INDEX_START(db); ptr; ++j) {
+		buf = accdb_cache_get(db, ptr);
+		v_assert(buf != NULL);
+		ptr = buf_get_next(buf);
+		accdb_cache_put(buf);
+	}
+	v_assert(j > 2);
+	for (i = 0; i < ACCDB_BITMAP_SECTORS; ++i)
+		db->bitmap_free[i] = 0;
+	db->bitmap_free[0] = 2;
+	v_assert(accdb_index_migrate(db) < 0);
+	v_assert(tree_test_free(db) == nfree);
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	v_assert(buf_get_type(root) == SECT_TYPE_INDEX);
+	accdb_cache_put(root);
+
+	v_assert(accdb_index_migrate(db) == 0);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	last[0] = '\0';
+	for (i = 0; accdb_index_has_entry(&idx); ++i) {
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(strcmp(last, briefp) < 0);
+		v_assert(strcmp(passp, pass) == 0);
+		strcpy(last, briefp);
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	v_assert(i == 12);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	// the old pages are all freed, INDEX_START and a leaf are left
+	v_assert(tree_test_free(db) == nfree + j - 2);
+
+	// a tree from before slotted leaves, whose leaves are flat pages,
+	// with a user index
+	v_assert(accdb_user_index(db, 1) == 0);
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	buf = accdb_cache_get(db, get_uint16(buf_get_payload(root), 0));
+	v_assert(buf != NULL);
+	buf_set_type_size(buf, SECT_TYPE_INDEX, 0);
+	tmp = accdb_allocate_buf(db, SECT_TYPE_INDEX);
+	v_assert(tmp != NULL);
+	v_assert(accdb_list_append(db, buf, tmp) == 0);
+	for (i = 0; i < 10; ++i) {
+		sprintf(brief, "OLD%u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		v_assert(index_rec_find_type(brief, user, "PASS", &len) ==
+			 INDEX_NORMAL);
+		p = buf_allocate_record(i < 5 ? buf : tmp, len);
+		v_assert(p != NULL);
+		v_assert(index_rec_create(p, brief, user, "PASS") == 0);
+	}
+	accdb_cache_put_dirty(tmp);
+	accdb_cache_put_dirty(buf);
+	// its nodes had only sectors for children
+	buf_set_prev(root, 0);
+	buf_set_size(root, NODE_CHILD_SIZE_V1);
+	tmp = accdb_cache_get(db, buf_get_next(root));
+	v_assert(tmp != NULL);
+	v_assert(buf_get_size(tmp) == NODE_CHILD_SIZE);
+	buf_set_size(tmp, NODE_CHILD_SIZE_V1);
+	accdb_cache_put_dirty(tmp);
+	accdb_cache_put_dirty(root);
+	v_assert(accdb_cache_flush(db) == 0);
+
+	// a failure leaves the old tree and its user index alone
+	nfree = tree_test_free(db);
+	for (i = 0; i < ACCDB_BITMAP_SECTORS; ++i)
+		db->bitmap_free[i] = 0;
+	db->bitmap_free[0] = 1;
+	v_assert(accdb_index_migrate(db) < 0);
+	v_assert(tree_test_free(db) == nfree);
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	v_assert(buf_get_type(root) == SECT_TYPE_NODE);
+	v_assert(buf_get_prev(root) == 0);
+	v_assert(buf_get_next(root) != SECT_NULL);
+	accdb_cache_put(root);
+
+	v_assert(accdb_index_migrate(db) == 0);
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	v_assert(buf_get_prev(root) == INDEX_VERSION);
+	v_assert(buf_get_next(root) != SECT_NULL);
+	accdb_cache_put(root);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	for (i = 0; i < 10; ++i) {
+		sprintf(brief, "OLD%u", (unsigned)i);
+		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	v_assert(!accdb_index_has_entry(&idx));
+	memset(&us, 0, sizeof(us));
+	v_assert(accdb_user_search(db, &us, "USER3") == 0);
+	v_assert(accdb_user_has_entry(&us));
+	v_assert(accdb_index_get_brief(&us.idx, &briefp) == 0);
+	v_assert(strcmp(briefp, "OLD3") == 0);
+	accdb_user_end(&us);
+	v_assert(accdb_user_index(db, 0) == 0);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	// two old leaves and the old user index's root and leaf went, for
+	// one new leaf
+	v_assert(tree_test_free(db) == nfree + 3);
+
+	// a tree from before the counts, with slotted leaves
+	nfree = tree_test_free(db);
+	for (i = 0; i < 10; ++i) {
+		sprintf(brief, "V1-%u", (unsigned)i);
+		v_assert(accdb_add(db, &idx, brief, "USER", "PASS") == 0);
+	}
+	accdb_index_clear(&idx);
+	root = accdb_cache_get(db, INDEX_START(db));
+	v_assert(root != NULL);
+	v_assert(buf_get_size(root) == NODE_CHILD_SIZE);
+	buf_set_size(root, NODE_CHILD_SIZE_V1);
+	buf_set_prev(root, 1);
+	accdb_cache_put_dirty(root);
+	v_assert(accdb_close(db) == 0);
+	v_assert(accdb_open(db, fp, pool, ncache) == ACCDB_OPEN_LEGACY);
+	v_assert(accdb_index_migrate(db) == 0);
+	v_assert(accdb_close(db) == 0);
+	v_assert(accdb_open(db, fp, pool, ncache) == 0);
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == 10);
+	v_assert(tree_test_counts(db, INDEX_START(db)) == 10);
+	v_assert(accdb_index_seek(db, &idx, 7) == 0);
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	v_assert(strcmp(briefp, "V1-7") == 0);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	v_assert(tree_test_free(db) == nfree);
+
+	// deleting leaves holes in a leaf, which are squeezed out when a
+	// record doesn't fit
+	buf = leaf_allocate(db);
+	v_assert(buf != NULL);
+	for (i = 0; (p = leaf_insert(buf, i, 40)) != NULL; ++i) {
+		index_rec_set_size(p, 39);
+		p[1] = 'A' + i;
+	}
+	j = i;
+	v_assert(j >= 10);
+	for (i = 0; i < j / 2; ++i)
+		leaf_remove(buf, i);
+	for (i = 0; i < j / 2; ++i) {
+		p = leaf_insert(buf, leaf_count(buf), 40);
+		v_assert(p != NULL);
+		index_rec_set_size(p, 39);
+		p[1] = 'a' + i;
+	}
+	// every other one of the first ones is left, then the new ones
+	v_assert(leaf_count(buf) == j);
+	for (i = 0; i < j; ++i) {
+		p = leaf_rec(buf, i);
+		v_assert(index_rec_get_size(p) == 39);
+		if (i < j - j / 2)
+			v_assert(p[1] == 'A' +
+				 (2 * i + 1 < j ? 2 * i + 1 : j - 1));
+		else
+			v_assert(p[1] == 'a' + i - (j - j / 2));
+	}
+	v_assert(accdb_deallocate_buf(db, buf) == 0);
+
+	// the leaf has moved, later tests count on free space being in one
+	// run after it
+	v_assert(accdb_format(db) == 0);
+}
+
+#define FIND_TEST_N	100
+
+static uint32_t
+find_test_reads(struct accdb *db)
+{
+	struct accdb_stats st;
+
+	accdb_stats_get(db, &st);
+	return st.kind[ACCDB_KIND_INDEX].hits +
+	       st.kind[ACCDB_KIND_INDEX].misses;
+}
+
+void
+test_accdb_find(struct accdb *db)
+{
+	char brief[32], user[32];
+	const char *briefp, *userp, *passp;
+	struct accdb_index idx;
+	struct accdb_stats st;
+	uint32_t reads;
+	size_t i, j;
+
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_find_budget(db, 1024) == 0);
+	v_assert(db->find_size == 256);
+
+	for (i = 0; i < FIND_TEST_N; ++i) {
+		j = (i * 37) % FIND_TEST_N;
+		sprintf(brief, "FIND%03u", (unsigned)j);
+		sprintf(user, "USER%u", (unsigned)j);
+		v_assert(accdb_add(db, &idx, brief, user, "PASS") == 0);
+	}
+	accdb_index_clear(&idx);
+
+	// the first find builds the table, after that every hit is found
+	// in the leaf it names
+	accdb_stats_reset(db);
+	for (i = 0; i < FIND_TEST_N; ++i) {
+		sprintf(brief, "FIND%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		v_assert(accdb_find(db, brief, &idx) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(strcmp(brief, briefp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+	}
+	v_assert(db->find_state == ACCDB_FIND_BUILT);
+	v_assert(db->find_used == FIND_TEST_N);
+	accdb_stats_get(db, &st);
+	v_assert(st.find_table == FIND_TEST_N);
+	v_assert(st.find_tree == 0);
+
+	// a brief with no slot costs nothing
+	reads = find_test_reads(db);
+	v_assert(accdb_find(db, "NOT THERE", &idx) == -1);
+	v_assert(!accdb_index_has_entry(&idx));
+	v_assert(find_test_reads(db) == reads);
+
+	// adds are noted, and duplicates are found from the first
+	for (i = 0; i < 3; ++i) {
+		sprintf(user, "DUP%u", (unsigned)i);
+		v_assert(accdb_add(db, &idx, "FIND050", user, "PASS") == 0);
+	}
+	v_assert(accdb_add(db, &idx, "FIND999", "USER999", "PASS") == 0);
+	v_assert(db->find_state == ACCDB_FIND_BUILT);
+	v_assert(accdb_find(db, "FIND050", &idx) == 0);
+	v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+	v_assert(strcmp(userp, "USER50") == 0);
+	v_assert(accdb_find(db, "FIND999", &idx) == 0);
+
+	// deleting records, and with them whole leaves
+	for (i = 0; i < FIND_TEST_N / 2; ++i) {
+		sprintf(brief, "FIND%03u", (unsigned)i);
+		v_assert(accdb_find(db, brief, &idx) == 0);
+		v_assert(accdb_del(&idx) == 0);
+	}
+	for (i = 0; i < FIND_TEST_N; ++i) {
+		sprintf(brief, "FIND%03u", (unsigned)i);
+		sprintf(user, "USER%u", (unsigned)i);
+		if (i < FIND_TEST_N / 2) {
+			v_assert(accdb_find(db, brief, &idx) == -1);
+			continue;
+		}
+		v_assert(accdb_find(db, brief, &idx) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(strcmp(user, userp) == 0);
+	}
+
+	// over budget, it's a Bloom filter, which turns most misses away
+	// without reads. hits go down the tree.
+	v_assert(accdb_find_budget(db, 64) == 0);
+	v_assert(db->find_size == 16);
+	accdb_stats_reset(db);
+	v_assert(accdb_find(db, "FIND075", &idx) == 0);
+	v_assert(db->find_state == ACCDB_FIND_BLOOM);
+	accdb_stats_get(db, &st);
+	v_assert(st.find_tree == 1);
+	for (i = j = 0; i < FIND_TEST_N / 2; ++i) {
+		sprintf(brief, "FIND%03u", (unsigned)i);
+		reads = find_test_reads(db);
+		v_assert(accdb_find(db, brief, &idx) == -1);
+		if (find_test_reads(db) == reads)
+			++j;
+	}
+	v_assert(j >= FIND_TEST_N / 2 - 5);
+	for (i = FIND_TEST_N / 2; i < FIND_TEST_N; ++i) {
+		sprintf(brief, "FIND%03u", (unsigned)i);
+		v_assert(accdb_find(db, brief, &idx) == 0);
+	}
+
+	// with none, the tree answers
+	v_assert(accdb_find_budget(db, 0) == 0);
+	v_assert(db->find == NULL);
+	v_assert(accdb_find(db, "FIND075", &idx) == 0);
+	v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+	v_assert(strcmp(userp, "USER75") == 0);
+
+	v_assert(accdb_find_budget(db, ACCDB_FIND_BUDGET) == 0);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+}
+
+// the number of briefs starting with prefix, counted the slow way
+static size_t
+search_test_count(struct accdb *db, const char *prefix)
+{
+	struct accdb_index idx;
+	const char *briefp;
+	size_t n = 0;
+
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+		if (strncmp(briefp, prefix, strlen(prefix)) == 0)
+			++n;
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	accdb_index_clear(&idx);
+
+	return n;
+}
+
+void
+test_accdb_search(struct accdb *db)
+{
+	static const char *const words[] = {
+		"apple", "apricot", "ban", "banana", "band", "bandana",
+		"bank", "bank", "bar", "c", NULL
+	};
+	// typed one after another, some going back
+	static const char *const typed[] = {
+		"", "b", "ba", "ban", "bank", "bank0", "bank01", "bank012",
+		"bank0123", "bank01", "bank1", "bank", "bana", "bandan",
+		"bandanas", "x", "", "a", "ap", "apr", NULL
+	};
+	struct accdb_search s;
+	struct accdb_index idx;
+	char brief[32], last[32];
+	const char *briefp;
+	size_t i, n;
+
+	memset(&idx, 0, sizeof(idx));
+	for (i = 0; words[i]; ++i)
+		v_assert(accdb_add(db, &idx, words[i], "USER", "PASS") == 0);
+	// enough behind one prefix to fill several leaves
+	for (i = 0; i < 200; ++i) {
+		sprintf(brief, "bank%03u", (unsigned)((i * 13) % 200));
+		v_assert(accdb_add(db, &idx, brief, "USER", "PASS") == 0);
 	}
+	accdb_index_clear(&idx);
+
+	memset(&s, 0, sizeof(s));
+	for (i = 0; typed[i]; ++i) {
+		v_assert(accdb_search_prefix(db, &s, typed[i]) == 0);
+		last[0] = '\0';
+		n = 0;
+		while (accdb_search_has_entry(&s)) {
+			v_assert(accdb_index_get_brief(&s.idx, &briefp) == 0);
+			v_assert(strncmp(briefp, typed[i],
+					 strlen(typed[i])) == 0);
+			v_assert(strcmp(last, briefp) <= 0);
+			strcpy(last, briefp);
+			v_assert(accdb_search_next(&s) == 0);
+			++n;
+		}
+		v_assert(n == search_test_count(db, typed[i]));
+	}
+	v_assert(accdb_search_prefix(db, &s, "bank05") == 0);
+	v_assert(accdb_search_has_entry(&s));
+	v_assert(accdb_index_get_brief(&s.idx, &briefp) == 0);
+	v_assert(strcmp(briefp, "bank050") == 0);
+	accdb_search_end(&s);
 
-	memset(bigbuf, 0, VFS_SECT_SIZE);
 	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+}
 
-	i = 0;
+// the records for user, counted the slow way
+static size_t
+user_test_count(struct accdb *db, const char *user)
+{
+	struct accdb_index idx;
+	const char *briefp, *userp, *passp;
+	size_t n = 0;
+
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_index_init(db, &idx) == 0);
 	while (accdb_index_has_entry(&idx)) {
-		sprintf(brief, "BRIEF%u", (unsigned)i);
-		sprintf(user, "USER%u", (unsigned)i);
-		sprintf(pass, "PASS%u", (unsigned)i);
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-		//printf("%s, %s, %s\r\n", briefp, userp, passp);
-		v_assert(strcmp(brief, briefp) == 0);
-		v_assert(strcmp(user, userp) == 0);
-		v_assert(strcmp(pass, passp) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		if (strcmp(userp, user) == 0)
+			++n;
 		v_assert(accdb_index_next(&idx) == 0);
-		++i;
 	}
-	v_assert(i == 128);
+	accdb_index_clear(&idx);
 
-	i = 128;
-	v_assert(accdb_index_prev(&idx) == 0);
-	while (accdb_index_has_entry(&idx)) {
-		v_assert(i > 0);
-		--i;
-		sprintf(brief, "BRIEF%u", (unsigned)i);
-		sprintf(user, "USER%u", (unsigned)i);
-		sprintf(pass, "PASS%u", (unsigned)i);
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-		//printf("%s, %s, %s\r\n", briefp, userp, passp);
-		v_assert(strcmp(brief, briefp) == 0);
-		v_assert(strcmp(user, userp) == 0);
-		v_assert(strcmp(pass, passp) == 0);
-		v_assert(accdb_index_prev(&idx) == 0);
+	return n;
+}
+
+// the records accdb_user_search finds for user, checking they're right
+static size_t
+user_test_search(struct accdb *db, const char *user)
+{
+	struct accdb_user_search s;
+	const char *briefp, *userp, *passp;
+	char last[REC_INDEX_ENTRY_MAX];
+	size_t n = 0;
+
+	memset(&s, 0, sizeof(s));
+	last[0] = '\0';
+	v_assert(accdb_user_search(db, &s, user) == 0);
+	while (accdb_user_has_entry(&s)) {
+		v_assert(accdb_index_get_entry(&s.idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(strcmp(userp, user) == 0);
+		v_assert(strcmp(last, briefp) <= 0);
+		strcpy(last, briefp);
+		v_assert(accdb_user_next(&s) == 0);
+		++n;
 	}
-	v_assert(i == 0);
+	accdb_user_end(&s);
+
+	return n;
+}
+
+void
+test_accdb_user(struct accdb *db)
+{
+	static char users[6][104], briefs[4][124];
+	char brief[32], pass[32];
+	struct accdb_index idx;
+	uint8_t *head;
+	uint16_t free_before;
+	size_t i, j, on;
+
+	memset(&idx, 0, sizeof(idx));
+	strcpy(users[0], "alice@example.com");
+	strcpy(users[1], "bob@example.com");
+	strcpy(users[2], "alice@example.co");
+	strcpy(users[3], "");
+	// the same as far as the user index sorts them
+	memset(users[4], 'u', 100);
+	strcpy(users[4] + 100, "4");
+	memset(users[5], 'u', 100);
+	strcpy(users[5] + 100, "5");
+	// cut to the same brief part for short users
+	memset(briefs[0], 'z', 120);
+	strcpy(briefs[0] + 120, "0");
+	memset(briefs[1], 'z', 120);
+	strcpy(briefs[1] + 120, "1");
+	strcpy(briefs[2], "dup");
+	strcpy(briefs[3], "dup");
+
+	free_before = db->bitmap_free[0];
+	for (on = 0; on < 2; ++on) {
+		v_assert(accdb_user_index(db, on) == 0);
+		for (i = 0; i < 60; ++i) {
+			sprintf(brief, "USER%03u", (unsigned)((i * 7) % 60));
+			sprintf(pass, "PASS%u", (unsigned)i);
+			v_assert(accdb_add(db, &idx, brief, users[i % 6],
+					   pass) == 0);
+		}
+		for (i = 0; i < 4; ++i) {
+			for (j = 0; j < 6; ++j) {
+				v_assert(accdb_add(db, &idx, briefs[i],
+						   users[j], "PASS") == 0);
+			}
+		}
+		accdb_index_clear(&idx);
+		for (j = 0; j < 6; ++j) {
+			v_assert(user_test_count(db, users[j]) == 10 + 4);
+			v_assert(user_test_search(db, users[j]) == 10 + 4);
+		}
+		v_assert(user_test_search(db, "nobody") == 0);
+
+		// deletes keep up
+		v_assert(accdb_index_init(db, &idx) == 0);
+		for (i = 0; accdb_index_has_entry(&idx); ++i) {
+			if (i % 3 == 0)
+				v_assert(accdb_del(&idx) == 0);
+			else
+				v_assert(accdb_index_next(&idx) == 0);
+		}
+		accdb_index_clear(&idx);
+		for (j = 0; j < 6; ++j) {
+			v_assert(user_test_search(db, users[j]) ==
+				 user_test_count(db, users[j]));
+		}
+
+		// turning it on builds it from what's there
+		v_assert(accdb_user_index(db, 1) == 0);
+		for (j = 0; j < 6; ++j) {
+			v_assert(user_test_search(db, users[j]) ==
+				 user_test_count(db, users[j]));
+		}
+		head = accdb_cache_get(db, INDEX_START(db));
+		v_assert(head != NULL);
+		v_assert(buf_get_next(head) != SECT_NULL);
+		accdb_cache_put(head);
+
+		v_assert(accdb_index_init(db, &idx) == 0);
+		while (accdb_index_has_entry(&idx))
+			v_assert(accdb_del(&idx) == 0);
+		accdb_index_clear(&idx);
+		v_assert(user_test_search(db, users[0]) == 0);
+		v_assert(accdb_user_index(db, 0) == 0);
+		v_assert(db->bitmap_free[0] == free_before);
+	}
+}
+
+#define CHUSER_TEST_N	40
+
+// the entry at brief has user and pass, and the notes starting with the
+// letters in notes, in order
+static void
+chuser_test_check(struct accdb *db, const char *brief, const char *user,
+		  const char *pass, const char *notes)
+{
+	struct accdb_index idx;
+	const char *briefp, *userp, *passp;
+	const void *note = NULL;
+	uint8_t *buf;
+	uint16_t ptr, tail, walked;
+	size_t size;
+
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+	v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+	v_assert(strcmp(briefp, brief) == 0);
+	v_assert(strcmp(userp, user) == 0);
+	v_assert(strcmp(passp, pass) == 0);
+	if (notes == NULL) {
+		accdb_index_clear(&idx);
+		return;
+	}
+
+	v_assert(accdb_index_next_note(&idx, &note, &size) == 0);
+	for (; *notes; ++notes) {
+		v_assert(note != NULL && *(const char *)note == *notes);
+		v_assert(accdb_index_next_note(&idx, &note, &size) == 0);
+	}
+	v_assert(note == NULL);
+
+	// the tail link is kept
+	v_assert(index_rec_parse_extended(idx.rec, &briefp, &ptr) == 0);
+	buf = accdb_cache_get(db, ptr);
+	v_assert(buf != NULL);
+	v_assert(blob_list_tail(db, buf, &tail) == 0);
+	buf_set_prev(buf, 0);
+	v_assert(blob_list_tail(db, buf, &walked) == 0);
+	buf_set_prev(buf, tail);
+	v_assert(tail == walked);
+	accdb_cache_put(buf);
+	accdb_index_clear(&idx);
+}
+
+void
+test_accdb_chuser(struct accdb *db)
+{
+	static char big[3][456], huge[REC_BLOB_ENTRY_MAX + 1];
+	char brief[16], pass[64], note[100], grow[119];
+	struct accdb_index idx;
+	const void *notep;
+	size_t nsize;
+	uint16_t bitmap_free[ACCDB_BITMAP_SECTORS];
+	uint32_t count, count_before, alloc_next;
+	uint16_t free_before, root, nfree;
+	uint8_t len;
+	size_t i;
+
+	free_before = db->bitmap_free[0];
+	memset(big[0], 'a', 150);
+	big[0][150] = '\0';
+	memset(big[1], 'b', 400);
+	big[1][400] = '\0';
+	memset(big[2], 'c', 450);
+	big[2][450] = '\0';
+
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_user_index(db, 1) == 0);
+	for (i = 0; i < CHUSER_TEST_N; ++i) {
+		sprintf(brief, "CH%03u", (unsigned)i);
+		v_assert(accdb_add(db, &idx, brief, "u", "p") == 0);
+	}
+	v_assert(accdb_count(db, &count_before) == 0);
+
+	// bigger, smaller and the same size, in place, with idx left on it
+	v_assert(accdb_index_lookup(db, &idx, "CH005") == 0);
+	v_assert(accdb_chpass(&idx, "longer") == 0);
+	v_assert(strcmp(index_rec_brief(idx.rec), "CH005") == 0);
+	v_assert(accdb_chuser(&idx, "") == 0);
+	v_assert(accdb_chuser(&idx, "v") == 0);
+	v_assert(strcmp(index_rec_brief(idx.rec), "CH005") == 0);
+	accdb_index_clear(&idx);
+	chuser_test_check(db, "CH005", "v", "longer", NULL);
+	v_assert(user_test_search(db, "v") == 1);
+	v_assert(user_test_search(db, "u") == CHUSER_TEST_N - 1);
+
+	// growing them all overflows the leaves, which split
+	for (i = 0; i < CHUSER_TEST_N; ++i) {
+		sprintf(brief, "CH%03u", (unsigned)i);
+		memset(pass, 'p', sizeof(pass) - 1);
+		sprintf(pass + 50, "%u", (unsigned)i);
+		v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+		v_assert(accdb_chpass(&idx, pass) == 0);
+		v_assert(strcmp(index_rec_brief(idx.rec), brief) == 0);
+		accdb_index_clear(&idx);
+	}
+	for (i = 0; i < CHUSER_TEST_N; ++i) {
+		sprintf(brief, "CH%03u", (unsigned)i);
+		memset(pass, 'p', sizeof(pass) - 1);
+		sprintf(pass + 50, "%u", (unsigned)i);
+		chuser_test_check(db, brief, i == 5 ? "v" : "u", pass, NULL);
+	}
+	v_assert(tree_test_counts(db, INDEX_START(db)) == CHUSER_TEST_N);
+
+	// too big for the record, it becomes extended
+	v_assert(accdb_index_lookup(db, &idx, "CH010") == 0);
+	v_assert(accdb_chuser(&idx, big[0]) == 0);
+	v_assert(index_rec_get_extended(idx.rec));
+	memset(note, 'A', sizeof(note));
+	v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
+	memset(note, 'B', sizeof(note));
+	v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
+	memset(note, 'C', sizeof(note));
+	v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
+	accdb_index_clear(&idx);
+	memset(pass, 'p', sizeof(pass) - 1);
+	sprintf(pass + 50, "10");
+	chuser_test_check(db, "CH010", big[0], pass, "ABC");
+	v_assert(user_test_search(db, big[0]) == 1);
+
+	// no room on the page, and not the two free sectors that takes: the
+	// old one stays, and a sector that was had goes back
+	memcpy(bitmap_free, db->bitmap_free, sizeof(bitmap_free));
+	alloc_next = db->alloc_next;
+	nfree = tree_test_free(db);
+	for (i = 0; i < 2; ++i) {
+		memset(db->bitmap_free, 0, sizeof(db->bitmap_free));
+		db->bitmap_free[0] = i;
+		v_assert(accdb_index_lookup(db, &idx, "CH010") == 0);
+		v_assert(accdb_chpass(&idx, big[1]) < 0);
+		accdb_index_clear(&idx);
+		memcpy(db->bitmap_free, bitmap_free, sizeof(bitmap_free));
+		db->alloc_next = alloc_next;
+		v_assert(tree_test_free(db) == nfree);
+		chuser_test_check(db, "CH010", big[0], pass, "ABC");
+	}
+
+	// a record that grows out of a full leaf, to the longest a normal
+	// one can be, with no free sector to split it with, stays where it
+	// was
+	memset(grow, 'q', sizeof(grow) - 1);
+	grow[sizeof(grow) - 1] = '\0';
+	v_assert(index_rec_find_type("CH000", "u", grow, &len) ==
+		 INDEX_NORMAL);
+	for (i = 0; i < CHUSER_TEST_N; ++i) {
+		sprintf(brief, "CH%03u", (unsigned)i);
+		v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+		if (buf_get_available(idx.buf) + leaf_rec_size(idx.rec) <
+		    LEAF_REC_SIZE(len))
+			break;
+		accdb_index_clear(&idx);
+	}
+	v_assert(i < CHUSER_TEST_N);
+	memset(db->bitmap_free, 0, sizeof(db->bitmap_free));
+	v_assert(accdb_chpass(&idx, grow) < 0);
+	accdb_index_clear(&idx);
+	memcpy(db->bitmap_free, bitmap_free, sizeof(bitmap_free));
+	db->alloc_next = alloc_next;
+	v_assert(tree_test_free(db) == nfree);
+	memset(grow, 'p', sizeof(pass) - 1);
+	sprintf(grow + 50, "%u", (unsigned)i);
+	chuser_test_check(db, brief, i == 5 ? "v" : "u", grow, NULL);
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == count_before);
+	v_assert(tree_test_counts(db, INDEX_START(db)) == CHUSER_TEST_N);
+
+	// with them, the notes after it go to a new page, and the password
+	// to one of its own between them. a walk of the notes starts again
+	// after it.
+	v_assert(accdb_index_lookup(db, &idx, "CH010") == 0);
+	notep = NULL;
+	v_assert(accdb_index_next_note(&idx, &notep, &nsize) == 0);
+	v_assert(notep != NULL && *(const char *)notep == 'A');
+	v_assert(accdb_index_next_note(&idx, &notep, &nsize) == 0);
+	v_assert(notep != NULL && *(const char *)notep == 'B');
+	v_assert(accdb_chpass(&idx, big[1]) == 0);
+	v_assert(idx.blob_note == NULL);
+	v_assert(accdb_index_next_note(&idx, &notep, &nsize) == 0);
+	v_assert(notep != NULL && *(const char *)notep == 'A');
+	accdb_index_clear(&idx);
+	chuser_test_check(db, "CH010", big[0], big[1], "ABC");
+
+	// an extended record stays so, and the rest is resized where it is
+	v_assert(accdb_index_lookup(db, &idx, "CH010") == 0);
+	v_assert(accdb_chuser(&idx, "w") == 0);
+	v_assert(index_rec_get_extended(idx.rec));
+	v_assert(accdb_chpass(&idx, big[2]) == 0);
+	accdb_index_clear(&idx);
+	chuser_test_check(db, "CH010", "w", big[2], "ABC");
+	v_assert(user_test_search(db, big[0]) == 0);
+	v_assert(user_test_search(db, "w") == 1);
+
+	// and when it goes on the end, the list has a new tail
+	v_assert(accdb_index_lookup(db, &idx, "CH012") == 0);
+	v_assert(accdb_chuser(&idx, big[0]) == 0);
+	v_assert(accdb_chpass(&idx, big[1]) == 0);
+	accdb_index_clear(&idx);
+	chuser_test_check(db, "CH012", big[0], big[1], "");
+
+	// too big for a blob record, and left as it was
+	memset(huge, 'h', sizeof(huge) - 1);
+	huge[sizeof(huge) - 1] = '\0';
+	v_assert(accdb_index_lookup(db, &idx, "CH011") == 0);
+	v_assert(accdb_chpass(&idx, huge) < 0);
+	accdb_index_clear(&idx);
+	v_assert(accdb_index_lookup(db, &idx, "CH010") == 0);
+	v_assert(accdb_chpass(&idx, huge) < 0);
+	accdb_index_clear(&idx);
+	memset(pass, 'p', sizeof(pass) - 1);
+	sprintf(pass + 50, "11");
+	chuser_test_check(db, "CH011", "u", pass, NULL);
+	chuser_test_check(db, "CH010", "w", big[2], "ABC");
+
+	// and so is the user index
+	v_assert(accdb_index_lookup(db, &idx, "CH011") == 0);
+	v_assert(accdb_chuser(&idx, huge) < 0);
+	accdb_index_clear(&idx);
+	v_assert(accdb_index_lookup(db, &idx, "CH010") == 0);
+	v_assert(accdb_chuser(&idx, huge) < 0);
+	accdb_index_clear(&idx);
+	v_assert(user_index_root(db, &root) == 0 && root != 0);
+	v_assert(tree_test_counts(db, root) == CHUSER_TEST_N);
+	v_assert(user_test_search(db, "w") == 1);
+	v_assert(user_test_search(db, "u") == CHUSER_TEST_N - 3);
+	chuser_test_check(db, "CH011", "u", pass, NULL);
+	chuser_test_check(db, "CH010", "w", big[2], "ABC");
+
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == count_before);
 
 	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	v_assert(user_test_search(db, "u") == 0);
+	v_assert(accdb_user_index(db, 0) == 0);
+	v_assert(db->bitmap_free[0] == free_before);
+}
 
-	i = 0;
-	while (accdb_index_has_entry(&idx)) {
+#define SEEK_TEST_N	150
+
+// record n is seeked to
+static void
+seek_test_check(struct accdb *db, uint32_t n, uint32_t count)
+{
+	struct accdb_index idx;
+	const char *briefp;
+	char brief[16];
+
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_index_seek(db, &idx, n) == 0);
+	if (n >= count) {
+		v_assert(!accdb_index_has_entry(&idx));
+		v_assert(accdb_index_prev(&idx) == 0);
+		n = count - 1;
+	}
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	sprintf(brief, "SEEK%03u", (unsigned)n);
+	v_assert(strcmp(brief, briefp) == 0);
+	accdb_index_clear(&idx);
+}
+
+void
+test_accdb_seek(struct accdb *db)
+{
+	struct accdb_index idx;
+	struct accdb_stats st;
+	struct tree_path path;
+	const char *briefp;
+	char brief[16];
+	uint8_t *buf;
+	uint32_t count, i;
+
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == 0);
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_index_seek(db, &idx, 0) == 0);
+	v_assert(!accdb_index_has_entry(&idx));
+
+	for (i = 0; i < SEEK_TEST_N; ++i) {
+		sprintf(brief, "SEEK%03u", (unsigned)((i * 7) % SEEK_TEST_N));
+		v_assert(accdb_add(db, &idx, brief, "USER", "PASS") == 0);
+	}
+	accdb_index_clear(&idx);
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == SEEK_TEST_N);
+	for (i = 0; i < SEEK_TEST_N + 3; ++i)
+		seek_test_check(db, i, SEEK_TEST_N);
+
+	// added up again after it's lost, it comes to the same
+	db->count = ACCDB_COUNT_UNKNOWN;
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == SEEK_TEST_N);
+
+	// any record is had with a page per level
+	buf = tree_edge(db, INDEX_START(db), 0, &path);
+	v_assert(buf != NULL);
+	accdb_cache_put(buf);
+	accdb_stats_reset(db);
+	seek_test_check(db, SEEK_TEST_N / 2, SEEK_TEST_N);
+	accdb_stats_get(db, &st);
+	v_assert(st.kind[ACCDB_KIND_INDEX].hits +
+		 st.kind[ACCDB_KIND_INDEX].misses == path.depth + 1u);
+	v_assert(tree_test_counts(db, INDEX_START(db)) == SEEK_TEST_N);
+
+	for (i = 0; i < SEEK_TEST_N; i += 2) {
+		sprintf(brief, "SEEK%03u", (unsigned)i);
+		v_assert(accdb_index_lookup(db, &idx, brief) == 0);
 		v_assert(accdb_del(&idx) == 0);
-		if (++i == 64)
+	}
+	accdb_index_clear(&idx);
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == SEEK_TEST_N / 2);
+	v_assert(tree_test_counts(db, INDEX_START(db)) == SEEK_TEST_N / 2);
+	v_assert(accdb_index_seek(db, &idx, 10) == 0);
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	v_assert(strcmp(briefp, "SEEK021") == 0);
+	v_assert(accdb_index_seek(db, &idx, SEEK_TEST_N / 2 - 10) == 0);
+	v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
+	v_assert(strcmp(briefp, "SEEK131") == 0);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == 0);
+}
+
+#define COMPACT_TEST_N	200
+
+// the leaves of the index, checking they're in ascending sectors if
+// ordered is set
+static uint32_t
+compact_test_leaves(struct accdb *db, uint8_t ordered)
+{
+	uint8_t *buf;
+	uint16_t ptr;
+	uint32_t n = 0;
+
+	buf = tree_edge(db, INDEX_START(db), 0, NULL);
+	v_assert(buf != NULL);
+	while (1) {
+		n++;
+		ptr = buf_get_next(buf);
+		v_assert(!ordered || !ptr || ptr > accdb_cache_sector(buf));
+		accdb_cache_put(buf);
+		if (!ptr)
 			break;
+		buf = accdb_cache_get(db, ptr);
+		v_assert(buf != NULL);
+	}
+
+	return n;
+}
+
+void
+test_accdb_compact(struct accdb *db)
+{
+	struct accdb_index idx;
+	const char *briefp;
+	char brief[16];
+	uint32_t count, i, before;
+	int8_t rv;
+
+	// an empty index is done at once
+	v_assert(accdb_compact(db, 1) == 0);
+	memset(&idx, 0, sizeof(idx));
+
+	for (i = 0; i < COMPACT_TEST_N; ++i) {
+		sprintf(brief, "COMP%03u",
+			(unsigned)((i * 37) % COMPACT_TEST_N));
+		v_assert(accdb_add(db, &idx, brief, "USER", "PASS") == 0);
+	}
+	for (i = 0; i < COMPACT_TEST_N; ++i) {
+		if (i % 4 == 0)
+			continue;
+		sprintf(brief, "COMP%03u", (unsigned)i);
+		v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+		v_assert(accdb_del(&idx) == 0);
 	}
+	accdb_index_clear(&idx);
+	before = compact_test_leaves(db, 0);
+
+	// a few leaves at a time, to the end of a pass
+	for (i = 0; (rv = accdb_compact(db, 3)) == 1; ++i)
+		v_assert(i < COMPACT_TEST_N);
+	v_assert(rv == 0);
+	v_assert(compact_test_leaves(db, 1) < before);
+	v_assert(tree_test_counts(db, INDEX_START(db)) == COMPACT_TEST_N / 4);
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == COMPACT_TEST_N / 4);
+	db->count = ACCDB_COUNT_UNKNOWN;
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == COMPACT_TEST_N / 4);
+
+	// still in order, and found
 	v_assert(accdb_index_init(db, &idx) == 0);
-	while (accdb_index_has_entry(&idx)) {
-		sprintf(brief, "BRIEF%u", (unsigned)i);
-		sprintf(user, "USER%u", (unsigned)i);
-		sprintf(pass, "PASS%u", (unsigned)i);
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-		//printf("%s, %s, %s\r\n", briefp, userp, passp);
+	for (i = 0; i < COMPACT_TEST_N; i += 4) {
+		sprintf(brief, "COMP%03u", (unsigned)i);
+		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
 		v_assert(strcmp(brief, briefp) == 0);
-		v_assert(strcmp(user, userp) == 0);
-		v_assert(strcmp(pass, passp) == 0);
 		v_assert(accdb_index_next(&idx) == 0);
-		++i;
 	}
-	v_assert(i == 128);
+	v_assert(!accdb_index_has_entry(&idx));
+	accdb_index_clear(&idx);
+	for (i = 0; i < COMPACT_TEST_N; ++i) {
+		sprintf(brief, "COMP%03u", (unsigned)i);
+		v_assert((accdb_index_lookup(db, &idx, brief) == 0) ==
+			 (i % 4 == 0));
+		v_assert((accdb_find(db, brief, &idx) == 0) == (i % 4 == 0));
+	}
+	accdb_index_clear(&idx);
 
-	v_assert(accdb_index_prev(&idx) == 0);
-	v_assert(accdb_del(&idx) == 0);
-	v_assert(accdb_index_prev(&idx) == 0);
-	v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-	//printf("%s, %s, %s\r\n", briefp, userp, passp);
+	// another pass finds nothing to do
+	before = compact_test_leaves(db, 1);
+	v_assert(accdb_compact(db, COMPACT_TEST_N) == 0);
+	v_assert(compact_test_leaves(db, 1) == before);
 
-	memset(bigbuf, 'B', REC_BLOB_ENTRY_MAX);
+	// down to one leaf, which goes to the lowest free sector, where
+	// it was before the test
 	v_assert(accdb_index_init(db, &idx) == 0);
-	v_assert(accdb_add_note(&idx, bigbuf, REC_BLOB_ENTRY_MAX) == 0);
-	v_assert(accdb_add_note(&idx, bigbuf, 130) == 0);
-	v_assert(accdb_add_note(&idx, bigbuf, 20) == 0);
-	v_assert(accdb_add_note(&idx, bigbuf, REC_BLOB_ENTRY_MAX) == 0);
-	
+	for (i = 1; i < COMPACT_TEST_N / 4; ++i)
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	v_assert(accdb_compact(db, COMPACT_TEST_N) == 0);
+	v_assert(compact_test_leaves(db, 1) == 1);
 	v_assert(accdb_index_init(db, &idx) == 0);
-	i = 64;
-	while (accdb_index_has_entry(&idx)) {
-		sprintf(brief, "BRIEF%u", (unsigned)i);
-		sprintf(user, "USER%u", (unsigned)i);
-		sprintf(pass, "PASS%u", (unsigned)i);
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-		//printf("%s, %s, %s\r\n", briefp, userp, passp);
+	v_assert(accdb_del(&idx) == 0);
+	v_assert(!accdb_index_has_entry(&idx));
+	accdb_index_clear(&idx);
+}
+
+#define BULK_TEST_N	300
+
+struct bulk_test {
+	uint32_t i, n;
+	int8_t step;
+	char brief[16];
+};
+
+static int8_t
+bulk_test_next(void *arg, const char **brief, const char **user,
+	       const char **pass)
+{
+	struct bulk_test *t = arg;
+
+	if (t->i == t->n)
+		return 1;
+	// a record that's too long to add
+	if (t->step == 0)
+		return -1;
+	sprintf(t->brief, "BULK%04u", (unsigned)t->i);
+	t->i += t->step;
+	*brief = t->brief;
+	*user = "USER";
+	*pass = "PASS";
+	return 0;
+}
+
+void
+test_accdb_bulk(struct accdb *db)
+{
+	struct accdb_index idx;
+	struct bulk_test t;
+	struct accdb_stats st;
+	struct tree_path path;
+	const char *briefp;
+	char brief[16];
+	uint8_t *buf;
+	uint16_t ptr;
+	uint32_t i, loaded, count;
+
+	// in order, every leaf but the last is full
+	t.i = 0;
+	t.n = BULK_TEST_N;
+	t.step = 1;
+	v_assert(accdb_bulk_load(db, bulk_test_next, &t, &loaded) == 0);
+	v_assert(loaded == BULK_TEST_N);
+	buf = tree_edge(db, INDEX_START(db), 0, NULL);
+	v_assert(buf != NULL);
+	while ((ptr = buf_get_next(buf))) {
+		v_assert(buf_get_available(buf) < LEAF_REC_SIZE(20) + 1);
+		accdb_cache_put(buf);
+		buf = accdb_cache_get(db, ptr);
+		v_assert(buf != NULL);
+	}
+	accdb_cache_put(buf);
+
+	// adding at the end looks at the last leaf, the nodes down to it
+	// for their counts, and the root for the user index, all in the
+	// cache, and nothing else, even once the leaf's been emptied and
+	// freed
+	memset(&idx, 0, sizeof(idx));
+	for (i = 0; i < 3; ++i) {
+		buf = tree_edge(db, INDEX_START(db), 1, &path);
+		v_assert(buf != NULL);
+		accdb_cache_put(buf);
+		accdb_stats_reset(db);
+		v_assert(accdb_add(db, &idx, "BULK9999", "USER", "PASS") == 0);
+		accdb_stats_get(db, &st);
+		v_assert(st.kind[ACCDB_KIND_INDEX].misses == 0);
+		v_assert(st.kind[ACCDB_KIND_INDEX].hits ==
+			 2 * path.depth + 3u);
+	}
+	v_assert(accdb_index_seek_brief(db, &idx, "BULK0270") == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+	t.i = 270;
+	v_assert(accdb_bulk_load(db, bulk_test_next, &t, &loaded) == 0);
+	v_assert(loaded == BULK_TEST_N - 270);
+	buf = tree_edge(db, INDEX_START(db), 1, &path);
+	v_assert(buf != NULL);
+	accdb_cache_put(buf);
+	accdb_stats_reset(db);
+	v_assert(accdb_add(db, &idx, "BULK9999", "USER", "PASS") == 0);
+	accdb_stats_get(db, &st);
+	v_assert(st.kind[ACCDB_KIND_INDEX].misses == 0);
+	v_assert(st.kind[ACCDB_KIND_INDEX].hits == 2 * path.depth + 3u);
+	v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+
+	// and backwards, in between them
+	t.i = 2 * BULK_TEST_N - 1;
+	t.n = BULK_TEST_N - 1;
+	t.step = -2;
+	v_assert(accdb_bulk_load(db, bulk_test_next, &t, &loaded) == 0);
+	v_assert(loaded == BULK_TEST_N / 2);
+	v_assert(accdb_count(db, &count) == 0);
+	v_assert(count == BULK_TEST_N + BULK_TEST_N / 2);
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_index_init(db, &idx) == 0);
+	for (i = 0; i < 2 * BULK_TEST_N; i += i < BULK_TEST_N ? 1 : 2) {
+		if (i == BULK_TEST_N)
+			i++;
+		sprintf(brief, "BULK%04u", (unsigned)i);
+		v_assert(accdb_index_get_brief(&idx, &briefp) == 0);
 		v_assert(strcmp(brief, briefp) == 0);
-		v_assert(strcmp(user, userp) == 0);
-		v_assert(strcmp(pass, passp) == 0);
 		v_assert(accdb_index_next(&idx) == 0);
-		++i;
 	}
-	v_assert(i == 127);
+	v_assert(!accdb_index_has_entry(&idx));
+	accdb_index_clear(&idx);
+
+	// an iterator's error stops it
+	t.i = 0;
+	t.n = 1;
+	t.step = 0;
+	v_assert(accdb_bulk_load(db, bulk_test_next, &t, &loaded) < 0);
+	v_assert(loaded == 0);
+
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+}
+
+struct export_test {
+	char buf[256];
+	size_t len, max;
+};
+
+static int8_t
+export_test_write(void *arg, const void *data, size_t len)
+{
+	struct export_test *t = arg;
+
+	if (t->len + len > t->max)
+		return -1;
+	memcpy(t->buf + t->len, data, len);
+	t->len += len;
+	return 0;
+}
+
+void
+test_accdb_export(struct accdb *db)
+{
+	static const char csv[] =
+		"\"A,1\",\"u\"\"q\",p\r\n"
+		"B,USER,PASS,n1,\"x\ny\"\r\n";
+	static const uint8_t types[] = {
+		ACCDB_FIELD_BRIEF, ACCDB_FIELD_USER, ACCDB_FIELD_PASS,
+		ACCDB_FIELD_END,
+		ACCDB_FIELD_BRIEF, ACCDB_FIELD_USER, ACCDB_FIELD_PASS,
+		ACCDB_FIELD_NOTE, ACCDB_FIELD_NOTE, ACCDB_FIELD_END
+	};
+	struct accdb_index idx;
+	struct export_test t;
+	size_t off, i;
+
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_add(db, &idx, "A,1", "u\"q", "p") == 0);
+	v_assert(accdb_add(db, &idx, "B", "USER", "PASS") == 0);
+	v_assert(accdb_add_note(&idx, "n1", 2) == 0);
+	v_assert(accdb_add_note(&idx, "x\ny", 3) == 0);
+	accdb_index_clear(&idx);
+
+	t.len = 0;
+	t.max = sizeof(t.buf);
+	v_assert(accdb_export(db, ACCDB_EXPORT_CSV, export_test_write,
+			      &t) == 0);
+	v_assert(t.len == sizeof(csv) - 1);
+	v_assert(memcmp(t.buf, csv, t.len) == 0);
+
+	t.len = 0;
+	v_assert(accdb_export(db, ACCDB_EXPORT_BINARY, export_test_write,
+			      &t) == 0);
+	for (off = i = 0; off < t.len; ++i) {
+		v_assert(i < sizeof(types));
+		v_assert((uint8_t)t.buf[off] == types[i]);
+		off += 3 + (uint8_t)t.buf[off + 1] +
+		       ((uint8_t)t.buf[off + 2] << 8);
+	}
+	v_assert(off == t.len && i == sizeof(types));
+	v_assert(memcmp(t.buf + t.len - 3 - 3 - 3, "\x03\x03\0x\ny", 6) == 0);
+
+	// a write that fails stops it
+	t.len = 0;
+	t.max = 10;
+	v_assert(accdb_export(db, ACCDB_EXPORT_CSV, export_test_write,
+			      &t) < 0);
 
 	v_assert(accdb_index_init(db, &idx) == 0);
-	note = NULL;
-	i = 0;
-	while (1) {
-		v_assert(accdb_index_next_note(&idx, &note, &size) == 0);
-		if (note == NULL)
-			break;
-		v_assert(size <= REC_BLOB_ENTRY_MAX);
-		v_assert(memcmp(note, bigbuf, size) == 0);
-		++i;
-	}
-	v_assert(i == 4);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+}
 
-	memset(bigbuf, 'B', 130);
-	bigbuf[129] = '\0';
+static void
+test_accdb_views(struct accdb *db)
+{
+	struct accdb_index idx;
+	struct accdb_view b, u, p;
+	const char *brief, *user, *pass;
+	char longuser[200];
 
-	v_assert(accdb_add(db, &idx, "blob brief", "blob usr", bigbuf) == 0);
-	v_assert(accdb_add(db, &idx, "blob brief", "blob usr", bigbuf) == 0);
-	v_assert(accdb_add(db, &idx, "blob brief", "blob usr", bigbuf) == 0);
+	memset(longuser, 'u', sizeof(longuser) - 1);
+	longuser[sizeof(longuser) - 1] = '\0';
 
-	v_assert(accdb_index_init(db, &idx) == 0);
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_add(db, &idx, "A", "us", "") == 0);
+	v_assert(accdb_add(db, &idx, "BB", longuser, "pw") == 0);
+	accdb_index_clear(&idx);
 
-	i = 0;
-	while (accdb_index_has_entry(&idx)) {
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-		if (!strcmp(briefp, "blob brief")) {
-			//printf("%s, %s, '%s'\r\n", briefp, userp, passp);
-			v_assert(strcmp("blob usr", userp) == 0);
-			v_assert(strcmp(bigbuf, passp) == 0);
-			++i;
-		}
-		v_assert(accdb_index_next(&idx) == 0);
-	}
-	v_assert(i == 3);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	v_assert(accdb_index_get_views(&idx, &b, &u, &p) == 0);
+	v_assert(b.len == 1 && memcmp(b.data, "A", 2) == 0);
+	v_assert(u.len == 2 && memcmp(u.data, "us", 3) == 0);
+	v_assert(p.len == 0 && p.data[0] == '\0');
+
+	// extended: the user and password come off the blob list
+	v_assert(accdb_index_next(&idx) == 0);
+	v_assert(index_rec_get_extended(idx.rec));
+	v_assert(accdb_index_get_views(&idx, &b, &u, &p) == 0);
+	v_assert(b.len == 2 && memcmp(b.data, "BB", 3) == 0);
+	v_assert(u.len == sizeof(longuser) - 1 &&
+		 memcmp(u.data, longuser, sizeof(longuser)) == 0);
+	v_assert(p.len == 2 && memcmp(p.data, "pw", 3) == 0);
+	// again, with the pages already held
+	v_assert(accdb_index_get_views(&idx, &b, &u, &p) == 0);
+	v_assert(u.len == sizeof(longuser) - 1 && p.len == 2);
+	v_assert(accdb_index_get_entry(&idx, &brief, &user, &pass) == 0);
+	v_assert(brief == b.data && user == u.data && pass == p.data);
+
+	v_assert(accdb_index_next(&idx) == 0);
+	v_assert(!accdb_index_has_entry(&idx));
+	v_assert(accdb_index_get_views(&idx, &b, &u, &p) < 0);
+	accdb_index_clear(&idx);
 
-	v_assert(accdb_add(db, &idx, "blob all", bigbuf, bigbuf) == 0);
 	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx))
+		v_assert(accdb_del(&idx) == 0);
+	accdb_index_clear(&idx);
+}
 
-	i = 0;
-	while (accdb_index_has_entry(&idx)) {
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-		if (!strcmp(briefp, "blob all")) {
-			v_assert(strcmp(bigbuf, userp) == 0);
-			v_assert(strcmp(bigbuf, passp) == 0);
-			++i;
-		}
-		v_assert(accdb_index_next(&idx) == 0);
-	}
-	v_assert(i == 1);
+#define REPACK_TEST_NOTES	6
 
-	memset(bigbuf, 'B', REC_BLOB_ENTRY_MAX);
-	bigbuf[REC_BLOB_ENTRY_MAX - 1] = '\0';
+// the pages of brief's blob list, whether they're consecutive sectors,
+// and the first byte of each of its notes, in order
+static uint16_t
+repack_test_list(struct accdb *db, const char *brief, uint8_t *consecutive,
+		 char *notes)
+{
+	struct accdb_index idx;
+	const char *briefp, *userp, *passp;
+	const void *note = NULL;
+	uint16_t ptr, prev = 0, pages = 0;
+	size_t size;
+	uint8_t *buf;
 
-	v_assert(accdb_add(db, &idx, "blob giant", bigbuf, bigbuf) == 0);
-	v_assert(accdb_cache_clear(db) == 0);
-	v_assert(accdb_index_init(db, &idx) == 0);
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+	v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
+	v_assert(strcmp(userp, "USER") == 0 && strcmp(passp, "PASS") == 0);
+	v_assert(index_rec_parse_extended(idx.rec, &briefp, &ptr) == 0);
+	*consecutive = 1;
+	for (; ptr; ptr = buf_get_next(buf)) {
+		if (prev && ptr != prev + 1)
+			*consecutive = 0;
+		prev = ptr;
+		pages++;
+		buf = accdb_cache_get(db, ptr);
+		v_assert(buf != NULL);
+		accdb_cache_put(buf);
+	}
+	while (1) {
+		v_assert(accdb_index_next_note(&idx, &note, &size) == 0);
+		if (note == NULL)
+			break;
+		*notes++ = *(const char *)note;
+	}
+	*notes = '\0';
+	accdb_index_clear(&idx);
 
-	i = 0;
-	while (accdb_index_has_entry(&idx)) {
-		v_assert(accdb_index_get_entry(&idx, &briefp, &userp, &passp) == 0);
-		if (!strcmp(briefp, "blob giant")) {
-			v_assert(strcmp(bigbuf, userp) == 0);
-			v_assert(strcmp(bigbuf, passp) == 0);
-			++i;
+	return pages;
+}
+
+void
+test_accdb_repack(struct accdb *db)
+{
+	struct accdb_index idx;
+	char note[300], before[2][REPACK_TEST_NOTES + 2];
+	char after[REPACK_TEST_NOTES + 3];
+	struct accdb_stats st;
+	const char *briefp;
+	uint8_t consecutive, *buf;
+	uint16_t bitmap_free[ACCDB_BITMAP_SECTORS];
+	uint16_t ptr, tail, nfree;
+	uint16_t pages[2];
+	uint32_t i, j, alloc_next;
+
+	// notes added to two entries in turn interleave their pages, and
+	// a short one fits on the last page of the first
+	memset(&idx, 0, sizeof(idx));
+	v_assert(accdb_add(db, &idx, "REPACK-A", "USER", "PASS") == 0);
+	v_assert(accdb_add(db, &idx, "REPACK-B", "USER", "PASS") == 0);
+	for (i = 0; i < REPACK_TEST_NOTES; ++i) {
+		for (j = 0; j < 2; ++j) {
+			memset(note, (j ? 'A' : 'a') + i, sizeof(note));
+			v_assert(accdb_index_lookup(db, &idx, j ? "REPACK-B" :
+						    "REPACK-A") == 0);
+			v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
 		}
-		v_assert(accdb_index_next(&idx) == 0);
 	}
-	v_assert(i == 1);
+	v_assert(accdb_index_lookup(db, &idx, "REPACK-A") == 0);
+	v_assert(accdb_add_note(&idx, note, 150) == 0);
+	accdb_index_clear(&idx);
+	pages[0] = repack_test_list(db, "REPACK-A", &consecutive, before[0]);
+	v_assert(!consecutive);
+	v_assert(pages[0] == REPACK_TEST_NOTES);
+	v_assert(strlen(before[0]) == REPACK_TEST_NOTES + 1);
+	pages[1] = repack_test_list(db, "REPACK-B", &consecutive, before[1]);
+	v_assert(!consecutive);
+
+	// with no run free, and only a sector to start the new list with,
+	// it fails part way, and that sector is free again
+	memcpy(bitmap_free, db->bitmap_free, sizeof(bitmap_free));
+	alloc_next = db->alloc_next;
+	nfree = tree_test_free(db);
+	memset(db->bitmap_free, 0, sizeof(db->bitmap_free));
+	db->bitmap_free[0] = 1;
+	v_assert(accdb_index_lookup(db, &idx, "REPACK-A") == 0);
+	v_assert(accdb_repack(&idx) < 0);
+	accdb_index_clear(&idx);
+	memcpy(db->bitmap_free, bitmap_free, sizeof(bitmap_free));
+	db->alloc_next = alloc_next;
+	v_assert(tree_test_free(db) == nfree);
+	v_assert(repack_test_list(db, "REPACK-A", &consecutive,
+				  after) == pages[0]);
+	v_assert(!consecutive);
+	v_assert(strcmp(before[0], after) == 0);
+
+	// one entry, then the rest
+	v_assert(accdb_index_lookup(db, &idx, "REPACK-A") == 0);
+	v_assert(accdb_repack(&idx) == 0);
+	accdb_index_clear(&idx);
+	v_assert(repack_test_list(db, "REPACK-A", &consecutive,
+				  after) == pages[0]);
+	v_assert(consecutive);
+	v_assert(strcmp(before[0], after) == 0);
+	v_assert(accdb_repack_all(db) == 0);
+	for (j = 0; j < 2; ++j) {
+		v_assert(repack_test_list(db, j ? "REPACK-B" : "REPACK-A",
+					  &consecutive, after) == pages[j]);
+		v_assert(consecutive);
+		v_assert(strcmp(before[j], after) == 0);
+	}
+
+	// a note goes on the end, going by the first page's link to the
+	// last, without reading the pages in between
+	v_assert(accdb_index_lookup(db, &idx, "REPACK-A") == 0);
+	accdb_stats_reset(db);
+	memset(note, 'z', sizeof(note));
+	v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
+	accdb_stats_get(db, &st);
+	v_assert(st.kind[ACCDB_KIND_BLOB].hits +
+		 st.kind[ACCDB_KIND_BLOB].misses <= 3);
+	accdb_index_clear(&idx);
+	v_assert(repack_test_list(db, "REPACK-A", &consecutive,
+				  after) == pages[0] + 1);
+	v_assert(strncmp(before[0], after, strlen(before[0])) == 0);
+	v_assert(strcmp(after + strlen(before[0]), "z") == 0);
+
+	// without the link, as lists from before it were, the list is
+	// walked instead
+	v_assert(accdb_index_lookup(db, &idx, "REPACK-B") == 0);
+	v_assert(index_rec_parse_extended(idx.rec, &briefp, &ptr) == 0);
+	buf = accdb_cache_get(db, ptr);
+	v_assert(buf != NULL);
+	buf_set_prev(buf, 0);
+	accdb_cache_put_dirty(buf);
+	v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
+	accdb_index_clear(&idx);
+	v_assert(repack_test_list(db, "REPACK-B", &consecutive,
+				  after) == pages[1] + 1);
+	v_assert(strcmp(after + strlen(before[1]), "z") == 0);
+	buf = accdb_cache_get(db, ptr);
+	v_assert(buf != NULL);
+	v_assert(blob_list_tail(db, buf, &tail) == 0);
+	buf_set_prev(buf, 0);
+	v_assert(blob_list_tail(db, buf, &ptr) == 0);
+	v_assert(tail == ptr);
+	buf_set_prev(buf, tail);
+	accdb_cache_put(buf);
 
 	v_assert(accdb_index_init(db, &idx) == 0);
-	while (accdb_index_has_entry(&idx)) {
+	while (accdb_index_has_entry(&idx))
 		v_assert(accdb_del(&idx) == 0);
-	}
-
 	accdb_index_clear(&idx);
-	pool_deallocate_block(db->pool, (uint8_t *)bigbuf);
 }
 
 void
@@ -1881,8 +7462,8 @@ test_accdb_rec(struct accdb *db)
 void
 test_accdb_allocation(struct accdb *db)
 {
-	uint8_t *b[3];
-	uint16_t s[3];
+	uint8_t *b[3], *bm;
+	uint16_t s[3], n;
 	struct sector *p;
 	unsigned i;
 
@@ -1926,6 +7507,35 @@ test_accdb_allocation(struct accdb *db)
 
 	for (i = 0; i < 3; ++i)
 		v_assert(accdb_deallocate_buf(db, b[i]) == 0);
+
+	// the free count of a bitmap sector follows allocations, and the
+	// lowest free sector comes back first
+	n = db->bitmap_free[s[0] / SECT_PER_BITMAP];
+	v_assert(n != ACCDB_FREE_UNKNOWN);
+	b[0] = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+	v_assert(b[0] != NULL);
+	v_assert(GET_SECTOR(b[0])->sector == s[0]);
+	v_assert(db->bitmap_free[s[0] / SECT_PER_BITMAP] == n - 1);
+	v_assert(accdb_deallocate_buf(db, b[0]) == 0);
+	v_assert(db->bitmap_free[s[0] / SECT_PER_BITMAP] == n);
+
+	// word at a time search
+	bm = pool_allocate_block(db->pool, NULL);
+	v_assert(bm != NULL);
+	memset(bm, 0xff, VFS_SECT_SIZE);
+	v_assert(bitmap_find_free(bm, 0) == -1);
+	v_assert(bitmap_count_free(bm) == 0);
+	bm[77] &= ~(1 << 5);
+	bm[300] &= ~1;
+	bm[VFS_SECT_SIZE - 1] &= ~0x80;
+	v_assert(bitmap_count_free(bm) == 3);
+	v_assert(bitmap_find_free(bm, 0) == 77 * 8 + 5);
+	v_assert(bitmap_find_free(bm, 77 * 8 + 5) == 77 * 8 + 5);
+	v_assert(bitmap_find_free(bm, 77 * 8 + 6) == 300 * 8);
+	v_assert(bitmap_find_free(bm, 300 * 8 + 1) == SECT_PER_BITMAP - 1);
+	bm[VFS_SECT_SIZE - 1] |= 0x80;
+	v_assert(bitmap_find_free(bm, 300 * 8 + 1) == -1);
+	pool_deallocate_block(db->pool, bm);
 }
 
 void
@@ -2083,56 +7693,428 @@ test_accdb_cache_list(struct accdb *db)
 	size_t i;
 
 	for (i = 0, s = db->mru; s; ++i, s = s->next) {
-		v_assert(i < ACCDB_CACHE_SIZE);
+		v_assert(i < db->ncache);
 		v_assert(&db->cache[i] == s);
 		v_assert(s->empty == 1);
 	}
-	v_assert(i == ACCDB_CACHE_SIZE);
+	v_assert(i == db->ncache);
 	for (i = 0, s = db->lru; s; ++i, s = s->prev) {
-		v_assert(i < ACCDB_CACHE_SIZE);
+		v_assert(i < db->ncache);
 		v_assert(s->empty == 1);
 	}
-	v_assert(i == ACCDB_CACHE_SIZE);
+	v_assert(i == db->ncache);
 	v_assert(&db->cache[i - 1] == db->lru);
 
 	accdb_cache_mru(db, &db->cache[2]);
 	for (i = 0, s = db->mru; s; ++i, s = s->next) {
-		v_assert(i < ACCDB_CACHE_SIZE);
+		v_assert(i < db->ncache);
 		v_assert(s->empty == 1);
 	}
-	v_assert(i == ACCDB_CACHE_SIZE);
+	v_assert(i == db->ncache);
 	for (i = 0, s = db->lru; s; ++i, s = s->prev) {
-		v_assert(i < ACCDB_CACHE_SIZE);
+		v_assert(i < db->ncache);
 		v_assert(s->empty == 1);
 	}
-	v_assert(i == ACCDB_CACHE_SIZE);
+	v_assert(i == db->ncache);
 	s = &db->cache[2];
 	v_assert(s->prev == NULL);
 	v_assert(db->mru == s);
 
 	accdb_cache_lru(db, &db->cache[3]);
 	for (i = 0, s = db->mru; s; ++i, s = s->next) {
-		v_assert(i < ACCDB_CACHE_SIZE);
+		v_assert(i < db->ncache);
 		v_assert(s->empty == 1);
 	}
-	v_assert(i == ACCDB_CACHE_SIZE);
+	v_assert(i == db->ncache);
 	for (i = 0, s = db->lru; s; ++i, s = s->prev) {
-		v_assert(i < ACCDB_CACHE_SIZE);
+		v_assert(i < db->ncache);
 		v_assert(s->empty == 1);
 	}
-	v_assert(i == ACCDB_CACHE_SIZE);
+	v_assert(i == db->ncache);
 	s = &db->cache[3];
 	v_assert(s->next == NULL);
 	v_assert(db->lru == s);
 }
 
+// run this on a freshly opened DB
+void
+test_accdb_cache_hash(struct accdb *db)
+{
+	struct sector s[ACCDB_CACHE_SIZE];
+	uint16_t sectors[ACCDB_CACHE_SIZE];
+	size_t i, j, n = ACCDB_HASH_SIZE(db) / 2;
+
+	v_assert(n <= ACCDB_CACHE_SIZE);
+	for (i = 0; i < ACCDB_HASH_SIZE(db); ++i)
+		v_assert(db->hash[i] == NULL);
+
+	// sectors a multiple of the table size apart tend to share
+	// probe runs, which exercises the shift on removal
+	memset(s, 0, sizeof(s));
+	for (i = 0; i < n; ++i) {
+		sectors[i] = 100 + i * ACCDB_HASH_SIZE(db);
+		s[i].sector = sectors[i];
+		accdb_hash_insert(db, &s[i]);
+	}
+	for (i = 0; i < n; ++i)
+		v_assert(accdb_hash_find(db, sectors[i]) == &s[i]);
+	v_assert(accdb_hash_find(db, 99) == NULL);
+
+	// remove from the middle out, checking the rest stay reachable
+	for (i = n / 2; i < n; ++i) {
+		accdb_hash_remove(db, &s[i]);
+		v_assert(accdb_hash_find(db, sectors[i]) == NULL);
+		for (j = 0; j < n; ++j) {
+			if (j >= n / 2 && j <= i)
+				continue;
+			v_assert(accdb_hash_find(db, sectors[j]) == &s[j]);
+		}
+	}
+	for (i = 0; i < n / 2; ++i)
+		accdb_hash_remove(db, &s[i]);
+	for (i = 0; i < ACCDB_HASH_SIZE(db); ++i)
+		v_assert(db->hash[i] == NULL);
+
+	// real sectors go in on a miss and out when the cache is cleared
+	for (i = 0; i < 4; ++i) {
+		uint8_t *buf = accdb_cache_get(db, BITMAP_START(db) + i);
+		v_assert(buf != NULL);
+		v_assert(accdb_hash_find(db, BITMAP_START(db) + i) ==
+			 GET_SECTOR(buf));
+		accdb_cache_put(buf);
+	}
+	v_assert(accdb_cache_clear(db) == 0);
+	for (i = 0; i < ACCDB_HASH_SIZE(db); ++i)
+		v_assert(db->hash[i] == NULL);
+}
+
+// run this on a formatted DB
+void
+test_accdb_cache_resize(struct accdb *db)
+{
+	uint16_t ncache = db->ncache;
+	uint16_t sect;
+	uint8_t *a, *b, *rec;
+	struct sector *s;
+	size_t i;
+
+	a = accdb_cache_get(db, INDEX_START(db));
+	v_assert(a != NULL);
+
+	// grow, the referenced slot must move with its buffer
+	v_assert(accdb_cache_resize(db, ncache + 4) == 0);
+	v_assert(db->ncache == ncache + 4);
+	for (i = 0, s = db->mru; s; ++i, s = s->next)
+		v_assert(i < db->ncache);
+	v_assert(i == db->ncache);
+	v_assert(GET_SECTOR(a)->sector == INDEX_START(db));
+	v_assert(accdb_hash_find(db, INDEX_START(db)) == GET_SECTOR(a));
+	v_assert(accdb_cache_get(db, INDEX_START(db)) == a);
+	accdb_cache_put(a);
+
+	// dirty sectors dropped by a shrink get written back
+	b = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+	v_assert(b != NULL);
+	sect = accdb_cache_sector(b);
+	rec = buf_allocate_record(b, 4);
+	v_assert(rec != NULL);
+	memcpy(rec, "KEEP", 4);
+	v_assert(accdb_cache_resize(db, 1) < 0);
+	accdb_cache_put_dirty(b);
+	v_assert(accdb_cache_resize(db, 1) == 0);
+	v_assert(db->ncache == 1);
+	v_assert(db->mru == db->lru);
+	v_assert(GET_SECTOR(a) == db->mru);
+	v_assert(accdb_hash_find(db, sect) == NULL);
+	v_assert(accdb_cache_resize(db, 0) < 0);
+
+	v_assert(accdb_cache_resize(db, ncache) == 0);
+	b = accdb_cache_get(db, sect);
+	v_assert(b != NULL);
+	v_assert(buf_get_size(b) == 4);
+	v_assert(memcmp(buf_get_payload(b), "KEEP", 4) == 0);
+	v_assert(accdb_deallocate_buf(db, b) == 0);
+	accdb_cache_put(a);
+	v_assert(accdb_cache_flush(db) == 0);
+}
+
+// run this on a formatted DB
+void
+test_accdb_cache_pin(struct accdb *db)
+{
+	uint16_t i, max, ncache = db->ncache;
+	uint16_t first = INDEX_START(db) + 1;
+	struct sector *s;
+	uint8_t *buf;
+
+	v_assert(accdb_cache_clear(db) == 0);
+	v_assert(db->npinned == 0);
+
+	// a small cache is left to the strategy
+	if (ncache < ACCDB_AUTOPIN_MIN) {
+		buf = accdb_cache_get(db, INDEX_START(db));
+		v_assert(buf != NULL);
+		accdb_cache_put(buf);
+		v_assert(!GET_SECTOR(buf)->pinned);
+		v_assert(db->npinned == 0);
+		v_assert(accdb_cache_resize(db, ACCDB_AUTOPIN_MIN) == 0);
+	}
+	max = ACCDB_PIN_MAX(db->ncache);
+	v_assert(max >= 2);
+
+	// the index head gets pinned when it's first used
+	buf = accdb_cache_get(db, INDEX_START(db));
+	v_assert(buf != NULL);
+	s = GET_SECTOR(buf);
+	accdb_cache_put(buf);
+	v_assert(s->pinned);
+	v_assert(s->refcount == 1);
+	v_assert(db->npinned == 1);
+
+	// and stays through more sectors than the cache holds
+	for (i = 0; i < db->ncache * 2; ++i) {
+		buf = accdb_cache_get(db, first + i);
+		v_assert(buf != NULL);
+		accdb_cache_put(buf);
+	}
+	v_assert(accdb_hash_find(db, INDEX_START(db)) == s);
+
+	// pool cleanup can't take it either
+	for (i = 0; i < db->ncache; ++i)
+		accdb_cache_do_cleanup(db->pool, db);
+	v_assert(s->buf != NULL);
+	v_assert(accdb_hash_find(db, INDEX_START(db)) == s);
+
+	// pins are bounded
+	for (i = db->npinned; i < max; ++i)
+		v_assert(accdb_cache_pin(db, first + i) == 0);
+	v_assert(db->npinned == max);
+	v_assert(accdb_cache_pin(db, first + max) < 0);
+	v_assert(accdb_cache_pin(db, first + 1) == 0);
+	v_assert(db->npinned == max);
+	v_assert(accdb_cache_unpin(db, first + max) < 0);
+	for (i = 1; i < max; ++i)
+		v_assert(accdb_cache_unpin(db, first + i) == 0);
+	v_assert(db->npinned == 1);
+
+	// and so does making the cache too small for them
+	if (ncache < ACCDB_AUTOPIN_MIN) {
+		v_assert(accdb_cache_resize(db, ncache) == 0);
+		v_assert(db->npinned == 0);
+		v_assert(accdb_cache_pin(db, first) == 0);
+		v_assert(db->npinned == 1);
+	}
+
+	// clearing the cache drops them all
+	v_assert(accdb_cache_clear(db) == 0);
+	v_assert(db->npinned == 0);
+	if (ncache >= ACCDB_AUTOPIN_MIN)
+		v_assert(!s->pinned);
+}
+
+// run this on a formatted DB
+void
+test_accdb_cache_flush(struct accdb *db)
+{
+	uint8_t *bufs[4], *buf;
+	uint16_t sect[4];
+	size_t i;
+	struct accdb_stats st;
+
+	v_assert(accdb_cache_flush(db) == 0);
+	for (i = 0; i < 4; ++i) {
+		bufs[i] = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+		v_assert(bufs[i] != NULL);
+		sect[i] = accdb_cache_sector(bufs[i]);
+		if (i > 0)
+			v_assert(sect[i] == sect[i - 1] + 1);
+	}
+	v_assert(accdb_cache_flush(db) == 0);
+
+	// dirty them back to front, with a gap
+	accdb_stats_reset(db);
+	for (i = 4; i-- > 0; ) {
+		if (i == 1)
+			continue;
+		memset(buf_get_payload(bufs[i]), 'a' + i, 8);
+		accdb_cache_dirty(bufs[i]);
+	}
+	v_assert(accdb_cache_flush(db) == 0);
+	accdb_stats_get(db, &st);
+	v_assert(st.flushes == 1);
+	v_assert(st.flush_writes == 2);
+	v_assert(st.flush_sectors == 3);
+	v_assert(st.kind[ACCDB_KIND_BLOB].writes == 3);
+	v_assert(st.kind[ACCDB_KIND_INDEX].writes == 0);
+
+	buf = pool_allocate_block(db->pool, NULL);
+	v_assert(buf != NULL);
+	for (i = 0; i < 4; ++i) {
+		v_assert(GET_SECTOR(bufs[i])->dirty == 0);
+		v_assert(vfs_read_sector(db->fp, buf, sect[i]) == 0);
+		v_assert(memcmp(buf, bufs[i], VFS_SECT_SIZE) == 0);
+	}
+	pool_deallocate_block(db->pool, buf);
+
+	for (i = 0; i < 4; ++i)
+		v_assert(accdb_deallocate_buf(db, bufs[i]) == 0);
+	v_assert(accdb_cache_flush(db) == 0);
+}
+
+// run this on a formatted DB
+void
+test_accdb_cache_prefetch(struct accdb *db)
+{
+	uint8_t *bufs[4], *buf;
+	uint16_t sect[4];
+	struct sector *s;
+	size_t i;
+
+	for (i = 0; i < 4; ++i) {
+		bufs[i] = accdb_allocate_buf(db, SECT_TYPE_BLOB);
+		v_assert(bufs[i] != NULL);
+		sect[i] = accdb_cache_sector(bufs[i]);
+		if (i > 0) {
+			v_assert(sect[i] == sect[i - 1] + 1);
+			buf_set_next(bufs[i - 1], sect[i]);
+		}
+		accdb_cache_put_dirty(bufs[i]);
+	}
+
+	// a chain laid out in order is read ahead from its next link
+	v_assert(accdb_cache_clear(db) == 0);
+	accdb_cache_readahead(db, 2);
+	buf = accdb_cache_get(db, sect[0]);
+	v_assert(buf != NULL);
+	accdb_cache_prefetch(db, buf);
+	accdb_cache_put(buf);
+	for (i = 1; i < 3; ++i) {
+		s = accdb_hash_find(db, sect[i]);
+		v_assert(s != NULL && s->prefetched && !s->lir);
+		v_assert(buf_get_next(s->buf) == sect[i + 1]);
+	}
+	v_assert(accdb_hash_find(db, sect[3]) == NULL);
+
+	// the first real access takes the sector out of read ahead
+	buf = accdb_cache_get(db, sect[1]);
+	v_assert(buf != NULL);
+	v_assert(!GET_SECTOR(buf)->prefetched);
+	accdb_cache_prefetch(db, buf);
+	accdb_cache_put(buf);
+	v_assert(accdb_hash_find(db, sect[3]) == NULL);
+
+	// nothing to read ahead when turned off, or when the link isn't
+	// the next sector
+	buf = accdb_cache_get(db, sect[2]);
+	v_assert(buf != NULL);
+	accdb_cache_readahead(db, 0);
+	accdb_cache_prefetch(db, buf);
+	v_assert(accdb_hash_find(db, sect[3]) == NULL);
+	accdb_cache_readahead(db, ACCDB_READAHEAD);
+	buf_set_next(buf, sect[0]);
+	accdb_cache_prefetch(db, buf);
+	v_assert(accdb_hash_find(db, sect[3]) == NULL);
+	buf_set_next(buf, sect[3]);
+	accdb_cache_prefetch(db, buf);
+	v_assert(accdb_hash_find(db, sect[3]) != NULL);
+	accdb_cache_put(buf);
+
+	for (i = 0; i < 4; ++i) {
+		buf = accdb_cache_get(db, sect[i]);
+		v_assert(buf != NULL);
+		v_assert(accdb_deallocate_buf(db, buf) == 0);
+	}
+	v_assert(accdb_cache_flush(db) == 0);
+}
+
 static void
+test_cache_touch(struct accdb *db, uint16_t sector)
+{
+	uint8_t *buf = accdb_cache_get(db, sector);
+
+	v_assert(buf != NULL);
+	accdb_cache_put(buf);
+}
+
+// run this on a formatted DB
+void
+test_accdb_cache_lirs(struct accdb *db)
+{
+	uint16_t i, pass, hot = INDEX_START(db), loop = INDEX_START(db) + 500;
+	uint16_t nlir = LIRS_LIR_MAX(db);
+	uint32_t last;
+	struct sector *s;
+
+	// a loop one sector longer than the cache misses every time under
+	// LRU, LIRS keeps hitting its LIR part
+	v_assert(accdb_cache_clear(db) == 0);
+	accdb_cache_strategy(db, CACHE_LRU);
+	for (pass = 0; pass < 3; ++pass) {
+		for (i = 0; i <= db->ncache; ++i)
+			test_cache_touch(db, loop + i);
+	}
+	v_assert(accdb_hash_find(db, loop) == NULL);
+
+	v_assert(accdb_cache_clear(db) == 0);
+	accdb_cache_strategy(db, CACHE_LIRS);
+	v_assert(db->nlir == 0 && db->hir_head == NULL);
+	for (pass = 0; pass < 3; ++pass) {
+		for (i = 0; i <= db->ncache; ++i)
+			test_cache_touch(db, loop + i);
+	}
+	v_assert(db->nlir == nlir);
+	for (i = 0; i < nlir; ++i) {
+		s = accdb_hash_find(db, loop + i);
+		v_assert(s != NULL && s->lir);
+	}
+
+	// a scan only cycles through the HIR slots, the LIR sectors stay
+	for (i = 0; i < 2 * db->ncache; ++i)
+		test_cache_touch(db, hot + 1000 + i);
+	for (i = 0; i < nlir; ++i)
+		v_assert(accdb_hash_find(db, loop + i) != NULL);
+	for (s = db->hir_head, i = 0; s; s = s->qnext, ++i)
+		v_assert(!s->lir && !s->empty);
+	v_assert(i + db->nlir == db->ncache);
+
+	// a HIR sector hit again while it's in the stack is promoted, and
+	// the bottom goes to HIR
+	test_cache_touch(db, hot);
+	s = accdb_hash_find(db, hot);
+	v_assert(s != NULL && !s->lir);
+	test_cache_touch(db, hot);
+	v_assert(s->lir);
+	v_assert(db->nlir == nlir);
+	s = accdb_hash_find(db, loop);
+	v_assert(s != NULL && !s->lir);
+
+	// a HIR sector evicted while in the stack leaves a ghost, and is
+	// promoted when it's read back in
+	for (i = 0; i < LIRS_HIR_SLOTS(db->ncache) + 1; ++i)
+		test_cache_touch(db, hot + 2000 + i);
+	v_assert(accdb_hash_find(db, hot + 2000) == NULL);
+	v_assert(ghost_take(db, hot + 2000, &last) == 1);
+	ghost_push(db, hot + 2000, last);
+	test_cache_touch(db, hot + 2000);
+	s = accdb_hash_find(db, hot + 2000);
+	v_assert(s != NULL && s->lir);
+	v_assert(ghost_take(db, hot + 2000, &last) == 0);
+
+	v_assert(accdb_cache_clear(db) == 0);
+	v_assert(db->nlir == 0 && db->hir_head == NULL);
+}
+
+void
 test_accdb_run_all(struct accdb *db)
 {
 	outf("\r\n\r\nCache list:\r\n");
 	test_accdb_cache_list(db);
 	outf("OK\r\n");
 
+	outf("\r\n\r\nCache hash:\r\n");
+	test_accdb_cache_hash(db);
+	outf("OK\r\n");
+
 	v_assert(accdb_format(db) == 0);
 
 	outf("\r\nIndex records:\r\n");
@@ -2154,6 +8136,70 @@ test_accdb_run_all(struct accdb *db)
 	outf("\r\n\r\nDB:\r\n");
 	test_accdb(db);
 	outf("OK\r\n");
+
+	outf("\r\n\r\nTree:\r\n");
+	test_accdb_tree(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nFind:\r\n");
+	test_accdb_find(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nSearch:\r\n");
+	test_accdb_search(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nUser index:\r\n");
+	test_accdb_user(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nChange user:\r\n");
+	test_accdb_chuser(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nSeek:\r\n");
+	test_accdb_seek(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nCompact:\r\n");
+	test_accdb_compact(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nRepack:\r\n");
+	test_accdb_repack(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nBulk load:\r\n");
+	test_accdb_bulk(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nExport:\r\n");
+	test_accdb_export(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nViews:\r\n");
+	test_accdb_views(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nCache resize:\r\n");
+	test_accdb_cache_resize(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nCache pin:\r\n");
+	test_accdb_cache_pin(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nCache flush:\r\n");
+	test_accdb_cache_flush(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nCache read ahead:\r\n");
+	test_accdb_cache_prefetch(db);
+	outf("OK\r\n");
+
+	outf("\r\n\r\nCache LIRS:\r\n");
+	test_accdb_cache_lirs(db);
+	outf("OK\r\n");
 }
 
 void
@@ -2164,7 +8210,7 @@ test_accdb_plaintext(const struct vfs *meth, struct pool *pool)
 
 	outf("\r\n---Plain---\r\n");
 	v_assert(vfs_open(meth, &fp, "test.db", VFS_RW) == 0);
-	accdb_open(&db, &fp, pool);
+	v_assert(accdb_open(&db, &fp, pool, 0) == 0);
 
 	test_accdb_run_all(&db);
 
@@ -2178,7 +8224,6 @@ test_accdb_plaintext(const struct vfs *meth, struct pool *pool)
 #include "vfs_crypt.h"
 #define TEST_PW "oogabooganooga"
 #define TEST_PW_LEN 14
-#define TEST_POOL_SZ (ACCDB_CACHE_SIZE + 2)
 
 void
 test_accdb_crypt(const struct vfs *meth, struct pool *pool)
@@ -2196,7 +8241,7 @@ test_accdb_crypt(const struct vfs *meth, struct pool *pool)
 	v_assert(vfs_crypt_init(&fp, pool) == 0);
 	v_assert(vfs_crypt_unlock(&fp, TEST_PW, TEST_PW_LEN) == 0);
 
-	accdb_open(&db, &fp, pool);
+	v_assert(accdb_open(&db, &fp, pool, 0) == 0);
 
 	test_accdb_run_all(&db);
 
@@ -2205,20 +8250,3 @@ test_accdb_crypt(const struct vfs *meth, struct pool *pool)
 	accdb_close(&db);
 	vfs_close(&fp);
 }
-
-#if 0
-int
-main(void)
-{
-	struct pool *p;
-
-	p = pool_init(TEST_POOL_SZ);
-	v_assert(p);
-
-	crypto_init();
-	test_accdb_plaintext(p);
-	test_accdb_crypt(p);
-
-	return 0;
-}
-#endif
@@ -27,33 +27,156 @@ struct vfs;
 struct sector {
 	uint8_t dirty:1;
 	uint8_t empty:1;
+	// CACHE_LIRS: kept in preference to HIR sectors, see accdb.c
+	uint8_t lir:1;
+	// read ahead, and not asked for since
+	uint8_t prefetched:1;
+	// holds a reference until accdb_cache_unpin
+	uint8_t pinned:1;
 	uint16_t refcount;
 	uint16_t sector;
+	// db->clock at the last access
+	uint32_t last;
 	uint8_t *buf;
 	struct sector *prev, *next;
+	// resident HIR sectors, next victim first
+	struct sector *qprev, *qnext;
 };
 
 enum cache_strategy {
 	CACHE_LRU,
-	CACHE_MRU
+	CACHE_MRU,
+	CACHE_LIRS
+};
+
+// a HIR sector that was evicted while still in the LIRS stack
+struct ghost {
+	uint16_t sector;
+	uint32_t last;
+};
+
+// sectors of allocation bitmap at the start of the db
+#define ACCDB_BITMAP_SECTORS 16
+#define ACCDB_FREE_UNKNOWN 0xffff
+#define ACCDB_COUNT_UNKNOWN 0xffffffffUL
+
+// sector kinds, as counted by struct accdb_stats
+enum accdb_kind {
+	ACCDB_KIND_BITMAP,
+	ACCDB_KIND_INDEX,
+	ACCDB_KIND_BLOB,
+	// anything else, e.g. a free sector read to be allocated
+	ACCDB_KIND_OTHER,
+	ACCDB_NKINDS
+};
+
+struct accdb_kind_stats {
+	uint32_t hits;
+	uint32_t misses;
+	// sectors read from and written to the vfs
+	uint32_t reads;
+	uint32_t writes;
+};
+
+// always on, counted since accdb_open or the last accdb_stats_reset
+struct accdb_stats {
+	systime_t since;
+	struct accdb_kind_stats kind[ACCDB_NKINDS];
+	// cached sectors dropped to make room for others
+	uint32_t evictions;
+	// dirty sectors written out one at a time to free their slot
+	uint32_t writebacks;
+	// buffers given back to the pool by the cleanup callback
+	uint32_t reclaims;
+	// accdb_cache_flush calls that wrote anything, the sectors and
+	// vfs writes they took, and the time spent in system ticks
+	uint32_t flushes;
+	uint32_t flush_sectors;
+	uint32_t flush_writes;
+	uint32_t flush_ticks;
+	// sectors read ahead, and how many of them were used
+	uint32_t readahead_sectors;
+	uint32_t readahead_hits;
+	// accdb_find calls answered from the brief table, and those that
+	// went down the tree
+	uint32_t find_table;
+	uint32_t find_tree;
+};
+
+#define ACCDB_STATS_BYTES(sectors) ((uint64_t)(sectors) * VFS_SECT_SIZE)
+
+// a brief hash, and the leaf a record with it was last seen in
+struct accdb_find_slot {
+	uint16_t tag;
+	uint16_t sector;
+};
+
+enum accdb_find_state {
+	ACCDB_FIND_UNBUILT,
+	ACCDB_FIND_BUILT,
+	// more records than slots, the table is a Bloom filter of briefs
+	ACCDB_FIND_BLOOM
 };
 
 struct accdb {
 	struct file *fp;
 	struct pool *pool;
 	struct cleanup cleanup;
-	uint8_t strategy:1;
+	uint8_t strategy:2;
 	uint8_t run_init:1;
+	// keep the index head and the bitmap sector being allocated from
+	// pinned, see accdb_cache_autopin
+	uint8_t autopin:1;
+	// sectors to read at once when walking onto an uncached link
+	uint8_t readahead;
 	uint16_t sect_start;
 	uint16_t sect_end;
-#define ACCDB_CACHE_SIZE 8
-	struct sector cache[ACCDB_CACHE_SIZE];
+	// slot descriptors, allocated at open and on resize
+	uint16_t ncache;
+	struct sector *cache;
 	struct sector *mru;
 	struct sector *lru;
-#ifdef CACHE_MEASURE
-	uint32_t cache_hits;
-	uint32_t cache_misses;
-#endif
+	// open addressed sector -> cache slot table, kept at most half
+	// full. only slots holding valid sector data are in the table.
+	uint8_t hash_bits;
+	struct sector **hash;
+	// scratch for accdb_cache_flush, dirty buffers in sector order
+	uint8_t **flush_bufs;
+	// LIRS bookkeeping, kept up to date whatever the strategy. the
+	// ghost ring holds up to ncache entries, 0 sectors are holes.
+	uint32_t clock;
+	uint16_t nlir;
+	struct sector *lir_bottom;	// NULL when it must be looked up
+	struct sector *hir_head;
+	struct sector *hir_tail;
+	struct ghost *ghosts;
+	uint16_t ghost_head;
+	uint16_t ghost_len;
+	// pinned slots, at most ACCDB_PIN_MAX(ncache)
+	uint16_t npinned;
+	uint16_t pin_bitmap;
+	// free sectors under each bitmap sector, ACCDB_FREE_UNKNOWN until
+	// it's been read, and the allocation cursor: nothing before it is
+	// free
+	uint16_t bitmap_free[ACCDB_BITMAP_SECTORS];
+	uint32_t alloc_next;
+	// open addressed brief table for accdb_find, find_size slots, or
+	// NULL. it's built on first use, see accdb_find_budget.
+	struct accdb_find_slot *find;
+	uint16_t find_size;
+	uint16_t find_used;
+	uint8_t find_state;
+	// records in the index, ACCDB_COUNT_UNKNOWN until accdb_count has
+	// added them up
+	uint32_t count;
+	// the leaf accdb_compact carries on from, 0 to start at the first
+	uint16_t compact_next;
+	// the last leaf of the index, for adds to go straight to, or 0 when
+	// it's to be found on the next add that goes down the tree
+	uint16_t tail;
+	struct accdb_stats stats;
+	// open handles, for accdb_stats_print_all
+	struct accdb *next_open;
 };
 
 struct accdb_index {
@@ -62,19 +185,131 @@ struct accdb_index {
 	uint8_t *blob_user;
 	uint8_t *blob_pass;
 	uint8_t *blob_note;
+	// the record at slot of leaf buf, NULL past the last one
 	uint8_t *rec;
+	uint8_t slot;
 	uint8_t before_beginning:1;
 };
 
 typedef uint32_t accdb_id_t;
 
+// a field of an entry, and its length, see accdb_index_get_views
+struct accdb_view {
+	const char *data;
+	size_t len;
+};
+
+// hands accdb_bulk_load its next record, 1 when there are no more, -1 to
+// stop with an error
+typedef int8_t (*accdb_bulk_cb)(void *arg, const char **brief,
+				const char **user, const char **pass);
+
+// accdb_export formats. ACCDB_EXPORT_BINARY writes each field as its
+// type, its length in 16 bits little endian, and its bytes. an entry is
+// a brief, user and password, then its notes, then an ACCDB_FIELD_END
+// with no bytes.
+enum accdb_export_format {
+	ACCDB_EXPORT_CSV,
+	ACCDB_EXPORT_BINARY
+};
+
+enum accdb_field {
+	ACCDB_FIELD_BRIEF,
+	ACCDB_FIELD_USER,
+	ACCDB_FIELD_PASS,
+	ACCDB_FIELD_NOTE,
+	ACCDB_FIELD_END = 0xff
+};
+
+// takes len bytes of accdb_export's output, -1 to stop it
+typedef int8_t (*accdb_export_cb)(void *arg, const void *data, size_t len);
+
+// characters of a user the user index sorts by
+#define ACCDB_USER_KEY_MAX 63
+
+// records for a user, see accdb_user_search
+struct accdb_user_search {
+	struct accdb_index idx;
+	// the user index entry idx is under, unused without one
+	struct accdb_index uidx;
+	const char *user;
+	char key[ACCDB_USER_KEY_MAX + 2];
+	char part[128];
+};
+
+// a search by brief prefix, zeroed before first use
+struct accdb_search {
+	struct accdb_index idx;
+	// leaf of the first match, to narrow from, or 0
+	uint16_t first;
+	uint8_t len;
+	char prefix[128];
+};
+
+// accdb_open found an index in an older layout, see accdb_index_migrate
+#define ACCDB_OPEN_LEGACY 1
+// default number of cached sectors, used when accdb_open gets 0
+#define ACCDB_CACHE_SIZE 8
+// pool blocks to provide for a cache of n sectors. the extra blocks
+// cover vfs_crypt's bounce buffer and one scratch block.
+#define ACCDB_POOL_SIZE(n) ((n) + 2)
+#define ACCDB_HASH_SIZE(db) ((size_t)1 << (db)->hash_bits)
+// most sectors that can be pinned in a cache of n
+#define ACCDB_PIN_MAX(n) ((n) / 4)
+// smallest cache the index head and allocation bitmap are pinned in
+// automatically. in fewer slots, the two pins cost more misses than they
+// save.
+#define ACCDB_AUTOPIN_MIN 16
+// default and largest accdb_cache_readahead
+#define ACCDB_READAHEAD 4
+#define ACCDB_READAHEAD_MAX 16
+// bytes of RAM accdb_open gives the accdb_find table, 0 for none
+#ifndef ACCDB_FIND_BUDGET
+#define ACCDB_FIND_BUDGET 1024
+#endif
+
 void test_accdb_plaintext(const struct vfs *meth, struct pool *pool);
 void test_accdb_crypt(const struct vfs *meth, struct pool *pool);
 
-int8_t accdb_open(struct accdb *db, struct file *fp, struct pool *pool);
+int8_t accdb_open(struct accdb *db, struct file *fp, struct pool *pool,
+		  uint16_t ncache);
 int8_t accdb_close(struct accdb *db);
+int8_t accdb_format(struct accdb *db);
+int8_t accdb_cache_flush(struct accdb *db);
+int8_t accdb_cache_resize(struct accdb *db, uint16_t ncache);
+void accdb_cache_strategy(struct accdb *db, enum cache_strategy strategy);
+void accdb_cache_readahead(struct accdb *db, uint8_t count);
+int8_t accdb_cache_pin(struct accdb *db, uint16_t sector);
+int8_t accdb_cache_unpin(struct accdb *db, uint16_t sector);
+void accdb_stats_get(struct accdb *db, struct accdb_stats *st);
+void accdb_stats_reset(struct accdb *db);
+void accdb_stats_print(struct accdb *db);
+void accdb_stats_print_all(int reset);
 
 int8_t accdb_index_init(struct accdb *db, struct accdb_index *idx);
+int8_t accdb_index_seek_brief(struct accdb *db, struct accdb_index *idx,
+			      const char *brief);
+int8_t accdb_index_lookup(struct accdb *db, struct accdb_index *idx,
+			  const char *brief);
+int8_t accdb_index_migrate(struct accdb *db);
+int8_t accdb_count(struct accdb *db, uint32_t *count);
+int8_t accdb_index_seek(struct accdb *db, struct accdb_index *idx,
+			uint32_t n);
+int8_t accdb_compact(struct accdb *db, uint16_t steps);
+int8_t accdb_find_budget(struct accdb *db, size_t bytes);
+int8_t accdb_find(struct accdb *db, const char *brief,
+		  struct accdb_index *idx);
+int8_t accdb_search_prefix(struct accdb *db, struct accdb_search *s,
+			   const char *prefix);
+uint8_t accdb_search_has_entry(struct accdb_search *s);
+int8_t accdb_search_next(struct accdb_search *s);
+void accdb_search_end(struct accdb_search *s);
+int8_t accdb_user_index(struct accdb *db, uint8_t on);
+int8_t accdb_user_search(struct accdb *db, struct accdb_user_search *s,
+			 const char *user);
+uint8_t accdb_user_has_entry(struct accdb_user_search *s);
+int8_t accdb_user_next(struct accdb_user_search *s);
+void accdb_user_end(struct accdb_user_search *s);
 void accdb_index_clear(struct accdb_index *idx);
 int8_t accdb_index_to_id(struct accdb_index *idx, accdb_id_t *id);
 int8_t accdb_index_from_id(struct accdb *db, struct accdb_index *idx, accdb_id_t id);
@@ -82,11 +317,21 @@ uint8_t accdb_index_has_entry(struct accdb_index *idx);
 int8_t accdb_index_next(struct accdb_index *idx);
 int8_t accdb_index_prev(struct accdb_index *idx);
 int8_t accdb_index_next_note(struct accdb_index *idx, const void **note, size_t *size);
+int8_t accdb_index_get_views(struct accdb_index *idx, struct accdb_view *brief,
+			     struct accdb_view *user, struct accdb_view *pass);
 int8_t accdb_index_get_entry(struct accdb_index *idx, const char **brief,
 		      const char **user, const char **pass);
 int8_t accdb_add(struct accdb *db, struct accdb_index *idx,
 	  const char *brief, const char *user, const char *pass);
+int8_t accdb_bulk_load(struct accdb *db, accdb_bulk_cb next, void *arg,
+			uint32_t *loaded);
+int8_t accdb_export(struct accdb *db, enum accdb_export_format format,
+		    accdb_export_cb write, void *arg);
 int8_t accdb_add_note(struct accdb_index *idx, void *data, size_t size);
+int8_t accdb_chuser(struct accdb_index *idx, const char *new_user);
+int8_t accdb_chpass(struct accdb_index *idx, const char *new_pass);
+int8_t accdb_repack(struct accdb_index *idx);
+int8_t accdb_repack_all(struct accdb *db);
 int8_t accdb_del(struct accdb_index *idx);
 
 #endif // _ACCDB_H_
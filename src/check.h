@@ -22,7 +22,9 @@
 #define _TEST_H_
 
 #include <stdlib.h>
+#ifndef KEEPER_HOST
 #include "ch.h"
+#endif
 
 /* Dead simple test framework. Pass the test or die!
    The state of an MCU might be ruined by a bad test,
@@ -31,8 +33,12 @@
    recover.
 */
 
+#ifdef KEEPER_HOST
+#define TEST_ABORT() do { fflush(stdout); abort(); } while (0)
+#else
 #define TEST_ABORT() do { \
 } while(1)
+#endif
 
 //#ifdef BUILD_AVR
 //#define AFMT "'%S' MEM %u LINE %u: "
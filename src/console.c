@@ -538,6 +538,12 @@ cmd_accdb(const char **argv, int argc)
 	pool_free(p);
 }
 
+static void
+cmd_accstat(const char **argv, int argc)
+{
+	accdb_stats_print_all(argc > 1 && strcmp(argv[1], "reset") == 0);
+}
+
 static void
 cmd_crypto(const char **argv, int argc)
 {
@@ -1037,6 +1043,7 @@ static const struct console_cmd command_list[] = {
 	{cmd_aes, "aes", "test aes-256-cbc"},
 	{cmd_crypto, "crypto", "test crypto subsystem"},
 	{cmd_accdb, "accdb", "test accdb subsystem"},
+	{cmd_accstat, "accstat", "accdb cache stats, [reset]"},
 	{cmd_pool, "pool", "test pool subsystem"},
 	{cmd_vfatfs, "vfatfs", "test vfatfs subsystem"},
 	{cmd_lcd, "lcd", "test lcd"},
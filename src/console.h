@@ -21,7 +21,11 @@
 #ifndef _CONSOLE_H_
 #define _CONSOLE_H_
 
+#ifdef KEEPER_HOST
+#define outf printf
+#else
 #define outf iprintf
+#endif
 
 void console_cmd_loop(void);
 
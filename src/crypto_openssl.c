@@ -24,19 +24,21 @@
 #include <assert.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
-#include "crypto.h"
-#include "vfs.h"
-#include "test.h"
+#include "keeper.h"
 
 #define SECT_SIZE VFS_SECT_SIZE
 
 struct cipher {
-	EVP_CIPHER_CTX ctx;
+	EVP_CIPHER_CTX *ctx;
 	const EVP_CIPHER *cipher;
 };
 
 static uint8_t initialized = 0;
 
+// callers that don't keep their own cipher (vfs_crypt, console) pass
+// NULL, like with the stm32 backend. they share this one.
+static struct cipher *shared_cipher = NULL;
+
 int8_t
 crypto_init(void)
 {
@@ -55,7 +57,11 @@ crypto_cipher_init(void)
 	cipher = calloc(1, sizeof(struct cipher));
 	if (cipher == NULL)
 		return NULL;
-	EVP_CIPHER_CTX_init(&cipher->ctx);
+	cipher->ctx = EVP_CIPHER_CTX_new();
+	if (cipher->ctx == NULL) {
+		free(cipher);
+		return NULL;
+	}
 	cipher->cipher = EVP_aes_256_cbc();
 
 	return cipher;
@@ -67,7 +73,7 @@ crypto_cipher_free(struct cipher *cipher)
 	assert(initialized);
 	if (!cipher)
 		return;
-	EVP_CIPHER_CTX_cleanup(&cipher->ctx);
+	EVP_CIPHER_CTX_free(cipher->ctx);
 	free(cipher);
 }
 
@@ -80,21 +86,29 @@ crypto_cipher_sector(struct cipher *cipher, void *key, void *iv, uint8_t mode,
 
 	assert(initialized);
 
-	rv = EVP_CipherInit_ex(&cipher->ctx, cipher->cipher, NULL,
+	if (cipher == NULL) {
+		if (shared_cipher == NULL)
+			shared_cipher = crypto_cipher_init();
+		if (shared_cipher == NULL)
+			return -1;
+		cipher = shared_cipher;
+	}
+
+	rv = EVP_CipherInit_ex(cipher->ctx, cipher->cipher, NULL,
 			       key, iv, mode == C_ENC? 1 : 0);
 	if (rv <= 0)
 		return -1;
-	rv = EVP_CIPHER_CTX_set_padding(&cipher->ctx, 0);
+	rv = EVP_CIPHER_CTX_set_padding(cipher->ctx, 0);
 	if (rv <= 0)
 		return -1;
-	assert(KEEPER_KEY_SIZE == EVP_CIPHER_CTX_key_length(&cipher->ctx));
-	assert(KEEPER_IV_SIZE == EVP_CIPHER_CTX_iv_length(&cipher->ctx));
+	assert(KEEPER_KEY_SIZE == EVP_CIPHER_CTX_key_length(cipher->ctx));
+	assert(KEEPER_IV_SIZE == EVP_CIPHER_CTX_iv_length(cipher->ctx));
 
-	rv = EVP_CipherUpdate(&cipher->ctx, out, &outlen, in,
+	rv = EVP_CipherUpdate(cipher->ctx, out, &outlen, in,
 			      SECT_SIZE);
 	if (rv <= 0 || outlen != SECT_SIZE)
 		return -1;
-	rv = EVP_CipherFinal_ex(&cipher->ctx, out, &outlen);
+	rv = EVP_CipherFinal_ex(cipher->ctx, out, &outlen);
 	if (rv <= 0 || outlen != 0)
 		return -1;
 	
@@ -140,7 +154,6 @@ test_crypto(void)
 	uint8_t tmp[SECT_SIZE];
 	uint8_t salt[32];
 	uint8_t digest[20];
-	int i;
 
 	memset(orig, 'F', SECT_SIZE);
 	memset(key, 'X', sizeof(key));
@@ -153,8 +166,5 @@ test_crypto(void)
 	v_assert(memcmp(orig, tmp, SECT_SIZE) == 0);
 	v_assert(crypto_get_rand_bytes(salt, sizeof(salt)) == 0);
 	v_assert(crypto_pbkdf2_sha1(key, sizeof(key), salt, sizeof(salt), digest, sizeof(digest), 100) == 0);
-	for (i = 0; i < sizeof(digest); ++i)
-		fprintf(stderr, "%02x", digest[i]);
-	fprintf(stderr, "\n");
 	crypto_cipher_free(cipher);
 }
@@ -0,0 +1,709 @@
+/* 
+ * This file is part of keeper.
+ * 
+ * Copyright 2013, cdavis
+ *  
+ * keeper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * keeper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with keeper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// keeper-bench: drives accdb on top of vfs_pc (and vfs_crypt) and reports
+// throughput, sector I/O (sectors and vfs calls) and cache hit ratio
+// for each workload, at a range of database sizes, so the scaling of every
+// operation is visible.
+//
+// usage: keeper-bench [-C] [-u] [-b plain|crypt|both] [-S lru,mru,lirs]
+//		       [-s n,n,...] [-c sectors] [-r sectors] [-p blocks]
+//		       [-f bytes] [file]
+//
+//	-b	backend(s) to run on (default both)
+//	-S	cache replacement strategies to run with (default lirs)
+//	-s	database sizes to run at (default 100,1000,10000,50000)
+//	-c	number of sectors accdb caches (default ACCDB_CACHE_SIZE)
+//	-r	sectors to read ahead on chain walks (default ACCDB_READAHEAD)
+//	-p	number of blocks in the sector pool
+//		(default ACCDB_POOL_SIZE of the cache size)
+//	-f	bytes for the accdb_find table (default ACCDB_FIND_BUDGET)
+//	-u	keep the user index
+//	-C	print CSV instead of a table
+//
+// each size runs on a freshly formatted database, in this order:
+//
+//	add	accdb_add n records
+//	lookup	accdb_index_lookup + get_entry on n random briefs
+//	find	accdb_find + get_entry on the same briefs
+//	miss	accdb_find on n random briefs that aren't there
+//	type	accdb_search_prefix on every character of PREFIX_TYPED random
+//		briefs typed out, reading the first PREFIX_SHOWN matches,
+//		per keystroke
+//	user	accdb_user_search for USER_LOOKUPS random users, walking
+//		their records
+//	scan	accdb_index_next over the whole index
+//	back	accdb_index_prev over the whole index, from the end
+//	seek	accdb_index_seek to SEEKS random ordinals
+//	note	accdb_add_note on every entry, walking the index
+//	mixed	get_entry on every entry walking the index, with an
+//		accdb_add after every MIXED_SCAN of them, after which the
+//		walk seeks back to where it was
+//	walk	accdb_index_next over the whole index, without reading
+//		the records
+//	compact	accdb_compact, COMPACT_STEPS leaves a call, to the end of
+//		a pass, counting calls
+//	rewalk	walk again, over the compacted index
+//	repack	accdb_repack_all
+//	append	accdb_add_note NOTE_APPENDS times on the first entry
+//	csv	accdb_export as CSV, the ops being entries
+//	binary	accdb_export in the binary format
+//	rotate	accdb_chpass on every entry, walking the index, to a new
+//		password as long as the old one
+//	del	accdb_del every entry from the start of the index
+//	bulk	accdb_bulk_load n records, in brief order, into the empty
+//		index
+//	bwalk	walk over the bulk loaded index
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "keeper.h"
+#include "vfs_pc.h"
+
+#define BENCH_PW "benchbenchbench"
+#define BENCH_PW_LEN 15
+#define BENCH_NOTE_SIZE 64
+#define MAX_SIZES 16
+#define MIXED_SCAN 20
+#define PREFIX_TYPED 1000
+#define PREFIX_SHOWN 2
+#define USER_LOOKUPS 100
+#define SEEKS 100
+#define COMPACT_STEPS 8
+#define NOTE_APPENDS 500
+
+static const char *strategy_names[] = {
+	[CACHE_LRU] = "lru",
+	[CACHE_MRU] = "mru",
+	[CACHE_LIRS] = "lirs",
+};
+#define NSTRATEGIES (sizeof(strategy_names) / sizeof(strategy_names[0]))
+
+// vfs_pc wrapper counting the sectors that actually hit the file.
+// vfs_crypt sits on top of this, so encrypted runs count real I/O too.
+static struct vfs count_vfs;
+static unsigned long sect_reads;
+static unsigned long sect_writes;
+static unsigned long read_calls;
+static unsigned long write_calls;
+
+static int8_t
+count_read(struct file *fp, void *buf, uint16_t index)
+{
+	sect_reads++;
+	read_calls++;
+	return pc_vfs.vread_sector(fp, buf, index);
+}
+
+static int8_t
+count_read_sectors(struct file *fp, void *const *bufs, uint16_t index,
+		   uint16_t count)
+{
+	sect_reads += count;
+	read_calls++;
+	return pc_vfs.vread_sectors(fp, bufs, index, count);
+}
+
+static int8_t
+count_write(struct file *fp, const void *buf, uint16_t index)
+{
+	sect_writes++;
+	write_calls++;
+	return pc_vfs.vwrite_sector(fp, buf, index);
+}
+
+static int8_t
+count_write_sectors(struct file *fp, const void *const *bufs, uint16_t index,
+		    uint16_t count)
+{
+	sect_writes += count;
+	write_calls++;
+	return pc_vfs.vwrite_sectors(fp, bufs, index, count);
+}
+
+static int csv = 0;
+static unsigned long readahead = ACCDB_READAHEAD;
+static unsigned long find_budget = ACCDB_FIND_BUDGET;
+static int user_index = 0;
+
+struct phase {
+	const char *backend;
+	const char *strategy;
+	unsigned long size;
+	const char *name;
+	struct timespec start;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long rcalls;
+	unsigned long wcalls;
+};
+
+static void
+phase_header(void)
+{
+	if (csv) {
+		printf("backend,strategy,records,op,ops,secs,ops_per_sec,"
+		       "reads_per_op,writes_per_op,read_calls_per_op,"
+		       "write_calls_per_op,hit_ratio\n");
+		return;
+	}
+	printf("%-6s %-5s %8s %-7s %8s %9s %12s %9s %9s %9s %9s %7s\n",
+	       "vfs", "cache", "records", "op", "ops", "secs", "ops/sec",
+	       "reads/op", "writes/op", "rcalls/op", "wcalls/op", "hit%");
+}
+
+static void
+phase_start(struct phase *ph, struct accdb *db, const char *name)
+{
+	ph->name = name;
+	ph->reads = sect_reads;
+	ph->writes = sect_writes;
+	ph->rcalls = read_calls;
+	ph->wcalls = write_calls;
+	accdb_stats_reset(db);
+	clock_gettime(CLOCK_MONOTONIC, &ph->start);
+}
+
+static void
+phase_end(struct phase *ph, struct accdb *db, unsigned long ops)
+{
+	struct timespec end;
+	double secs, rate, rpo, wpo, rcpo, wcpo, ratio;
+	unsigned long hits, misses;
+	struct accdb_stats st;
+	int i;
+
+	// count write-back as part of the phase that dirtied the sectors
+	v_assert(accdb_cache_flush(db) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - ph->start.tv_sec) +
+	       (end.tv_nsec - ph->start.tv_nsec) / 1e9;
+	rate = secs > 0 ? ops / secs : 0.0;
+	rpo = ops ? (double)(sect_reads - ph->reads) / ops : 0.0;
+	wpo = ops ? (double)(sect_writes - ph->writes) / ops : 0.0;
+	rcpo = ops ? (double)(read_calls - ph->rcalls) / ops : 0.0;
+	wcpo = ops ? (double)(write_calls - ph->wcalls) / ops : 0.0;
+	accdb_stats_get(db, &st);
+	for (hits = misses = i = 0; i < ACCDB_NKINDS; ++i) {
+		hits += st.kind[i].hits;
+		misses += st.kind[i].misses;
+	}
+	ratio = hits + misses ? (double)hits / (hits + misses) : 0.0;
+
+	if (csv) {
+		printf("%s,%s,%lu,%s,%lu,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,"
+		       "%.4f\n",
+		       ph->backend, ph->strategy, ph->size, ph->name, ops,
+		       secs, rate, rpo, wpo, rcpo, wcpo, ratio);
+	} else {
+		printf("%-6s %-5s %8lu %-7s %8lu %9.3f %12.1f %9.2f %9.2f "
+		       "%9.2f %9.2f %6.1f%%\n",
+		       ph->backend, ph->strategy, ph->size, ph->name, ops,
+		       secs, rate, rpo, wpo, rcpo, wcpo, ratio * 100);
+	}
+	fflush(stdout);
+}
+
+static void
+make_record(unsigned long i, char *brief, char *user, char *pass)
+{
+	sprintf(brief, "account%lu.example.com", i);
+	sprintf(user, "user%lu@example.com", i);
+	sprintf(pass, "pass-%08lx", (i * 2654435761UL) & 0xffffffffUL);
+}
+
+static void
+walk_index(struct accdb *db, struct phase *ph, const char *name,
+	   unsigned long count)
+{
+	struct accdb_index idx;
+	unsigned long n = 0;
+
+	memset(&idx, 0, sizeof(idx));
+	phase_start(ph, db, name);
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_next(&idx) == 0);
+		++n;
+	}
+	accdb_index_clear(&idx);
+	v_assert(n == count);
+	phase_end(ph, db, n);
+}
+
+// counts accdb_export's output, and throws it away
+static int8_t
+export_count(void *arg, const void *data, size_t len)
+{
+	(void)data;
+	*(unsigned long *)arg += len;
+	return 0;
+}
+
+struct bulk {
+	unsigned long i, n;
+	char brief[64], user[64], pass[64];
+};
+
+// make_record's records, numbered so they sort in order
+static int8_t
+bulk_next(void *arg, const char **brief, const char **user,
+	  const char **pass)
+{
+	struct bulk *b = arg;
+
+	if (b->i == b->n)
+		return 1;
+	make_record(b->i, b->brief, b->user, b->pass);
+	sprintf(b->brief, "account%08lu.example.com", b->i);
+	b->i++;
+	*brief = b->brief;
+	*user = b->user;
+	*pass = b->pass;
+	return 0;
+}
+
+static void
+run(struct accdb *db, const char *backend, unsigned long count)
+{
+	unsigned long total = count;
+	struct accdb_index idx, add_idx;
+	struct accdb_search search;
+	struct accdb_user_search us;
+	struct phase ph;
+	char brief[64], user[64], pass[64], at[64];
+	uint8_t note[BENCH_NOTE_SIZE];
+	const char *briefp, *userp, *passp;
+	unsigned long i, j, k, n;
+	uint32_t records;
+	struct bulk bulk;
+	int8_t rv;
+
+	memset(&idx, 0, sizeof(idx));
+	memset(note, 'N', sizeof(note));
+	ph.backend = backend;
+	ph.strategy = strategy_names[db->strategy];
+	ph.size = count;
+
+	phase_start(&ph, db, "add");
+	for (i = 0; i < count; ++i) {
+		make_record(i, brief, user, pass);
+		v_assert(accdb_add(db, &idx, brief, user, pass) == 0);
+	}
+	accdb_index_clear(&idx);
+	phase_end(&ph, db, count);
+
+	phase_start(&ph, db, "lookup");
+	srand(1);
+	for (i = 0; i < count; ++i) {
+		n = rand() % count;
+		make_record(n, brief, user, pass);
+		v_assert(accdb_index_lookup(db, &idx, brief) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(strcmp(briefp, brief) == 0);
+	}
+	accdb_index_clear(&idx);
+	phase_end(&ph, db, count);
+
+	// the first one builds the brief table
+	phase_start(&ph, db, "find");
+	srand(1);
+	for (i = 0; i < count; ++i) {
+		n = rand() % count;
+		make_record(n, brief, user, pass);
+		v_assert(accdb_find(db, brief, &idx) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(strcmp(briefp, brief) == 0);
+	}
+	accdb_index_clear(&idx);
+	phase_end(&ph, db, count);
+
+	phase_start(&ph, db, "miss");
+	srand(1);
+	for (i = 0; i < count; ++i) {
+		make_record(count + rand() % count, brief, user, pass);
+		v_assert(accdb_find(db, brief, &idx) == -1);
+	}
+	phase_end(&ph, db, count);
+
+	// as if typed into the lcd entry, narrowing on each character
+	phase_start(&ph, db, "type");
+	srand(2);
+	n = 0;
+	for (i = 0; i < PREFIX_TYPED; ++i) {
+		make_record(rand() % count, brief, user, pass);
+		*strchr(brief, '.') = '\0';
+		memset(&search, 0, sizeof(search));
+		for (j = 1; j <= strlen(brief); ++j, ++n) {
+			strncpy(pass, brief, j);
+			pass[j] = '\0';
+			v_assert(accdb_search_prefix(db, &search, pass) == 0);
+			v_assert(accdb_search_has_entry(&search));
+			for (k = 0; k < PREFIX_SHOWN &&
+			     accdb_search_has_entry(&search); ++k) {
+				v_assert(accdb_index_get_entry(&search.idx,
+					&briefp, &userp, &passp) == 0);
+				v_assert(accdb_search_next(&search) == 0);
+			}
+		}
+		accdb_search_end(&search);
+	}
+	phase_end(&ph, db, n);
+
+	// without the user index, each of these is a scan
+	phase_start(&ph, db, "user");
+	srand(3);
+	memset(&us, 0, sizeof(us));
+	for (i = 0; i < USER_LOOKUPS; ++i) {
+		make_record(rand() % count, brief, user, pass);
+		v_assert(accdb_user_search(db, &us, user) == 0);
+		for (n = 0; accdb_user_has_entry(&us); ++n) {
+			v_assert(accdb_index_get_entry(&us.idx, &briefp,
+						       &userp, &passp) == 0);
+			v_assert(accdb_user_next(&us) == 0);
+		}
+		v_assert(n == 1);
+	}
+	accdb_user_end(&us);
+	phase_end(&ph, db, USER_LOOKUPS);
+
+	phase_start(&ph, db, "scan");
+	n = 0;
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+		++n;
+	}
+	accdb_index_clear(&idx);
+	v_assert(n == count);
+	phase_end(&ph, db, n);
+
+	// every brief sorts before "~"
+	phase_start(&ph, db, "back");
+	n = 0;
+	v_assert(accdb_index_seek_brief(db, &idx, "~") == 0);
+	while (accdb_index_prev(&idx) == 0 && accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		++n;
+	}
+	accdb_index_clear(&idx);
+	v_assert(n == count);
+	phase_end(&ph, db, n);
+
+	// the first accdb_count adds up the leaves
+	phase_start(&ph, db, "seek");
+	srand(3);
+	v_assert(accdb_count(db, &records) == 0);
+	v_assert(records == count);
+	for (i = 0; i < SEEKS; ++i) {
+		v_assert(accdb_index_seek(db, &idx, rand() % count) == 0);
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+	}
+	accdb_index_clear(&idx);
+	phase_end(&ph, db, SEEKS);
+
+	// adding a note converts the entry to an extended record. walk the
+	// index instead of using ids.
+	phase_start(&ph, db, "note");
+	n = 0;
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+		++n;
+	}
+	accdb_index_clear(&idx);
+	v_assert(n == count);
+	phase_end(&ph, db, n);
+
+	// browsing the index resolves every entry's blob, in between the
+	// adds going back to the bitmap and down the tree. an add can move
+	// the records under idx, so the walk finds its place again by brief.
+	phase_start(&ph, db, "mixed");
+	memset(&add_idx, 0, sizeof(add_idx));
+	n = 0;
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+					       &passp) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+		if (++n % MIXED_SCAN == 0 && n <= count &&
+		    accdb_index_has_entry(&idx)) {
+			v_assert(accdb_index_get_entry(&idx, &briefp, &userp,
+						       &passp) == 0);
+			strcpy(at, briefp);
+			make_record(total++, brief, user, pass);
+			v_assert(accdb_add(db, &add_idx, brief, user,
+					   pass) == 0);
+			accdb_index_clear(&add_idx);
+			v_assert(accdb_index_seek_brief(db, &idx, at) == 0);
+			++n;
+		}
+	}
+	accdb_index_clear(&add_idx);
+	accdb_index_clear(&idx);
+	phase_end(&ph, db, n);
+
+	// the adds split leaves into whatever sectors the notes left free
+	walk_index(db, &ph, "walk", total);
+	phase_start(&ph, db, "compact");
+	n = 0;
+	do {
+		rv = accdb_compact(db, COMPACT_STEPS);
+		v_assert(rv >= 0);
+		++n;
+	} while (rv);
+	phase_end(&ph, db, n);
+	walk_index(db, &ph, "rewalk", total);
+
+	// every note fit in its entry's first page, so this is the cost of
+	// checking, mostly
+	phase_start(&ph, db, "repack");
+	v_assert(accdb_repack_all(db) == 0);
+	phase_end(&ph, db, total);
+
+	phase_start(&ph, db, "append");
+	v_assert(accdb_index_init(db, &idx) == 0);
+	for (i = 0; i < NOTE_APPENDS; ++i)
+		v_assert(accdb_add_note(&idx, note, sizeof(note)) == 0);
+	accdb_index_clear(&idx);
+	phase_end(&ph, db, NOTE_APPENDS);
+
+	phase_start(&ph, db, "csv");
+	n = 0;
+	v_assert(accdb_export(db, ACCDB_EXPORT_CSV, export_count, &n) == 0);
+	phase_end(&ph, db, total);
+	phase_start(&ph, db, "binary");
+	n = 0;
+	v_assert(accdb_export(db, ACCDB_EXPORT_BINARY, export_count,
+			      &n) == 0);
+	phase_end(&ph, db, total);
+
+	phase_start(&ph, db, "rotate");
+	n = 0;
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		sprintf(pass, "rot%010lx", n++);
+		v_assert(accdb_chpass(&idx, pass) == 0);
+		v_assert(accdb_index_next(&idx) == 0);
+	}
+	accdb_index_clear(&idx);
+	v_assert(n == total);
+	phase_end(&ph, db, n);
+
+	phase_start(&ph, db, "del");
+	n = 0;
+	v_assert(accdb_index_init(db, &idx) == 0);
+	while (accdb_index_has_entry(&idx)) {
+		v_assert(accdb_del(&idx) == 0);
+		++n;
+	}
+	accdb_index_clear(&idx);
+	v_assert(n == total);
+	phase_end(&ph, db, n);
+
+	phase_start(&ph, db, "bulk");
+	bulk.i = 0;
+	bulk.n = count;
+	v_assert(accdb_bulk_load(db, bulk_next, &bulk, &records) == 0);
+	v_assert(records == count);
+	phase_end(&ph, db, count);
+	walk_index(db, &ph, "bwalk", count);
+}
+
+static void
+run_backend(const char *path, int crypt, struct pool *pool, uint16_t ncache,
+	    enum cache_strategy strategy, const unsigned long *sizes,
+	    size_t nsizes)
+{
+	struct file fp;
+	struct accdb db;
+	size_t i;
+
+	for (i = 0; i < nsizes; ++i) {
+		unlink(path);
+		v_assert(vfs_open(&count_vfs, &fp, path, VFS_RW) == 0);
+		if (crypt) {
+			v_assert(vfs_crypt_init(&fp, pool) == 0);
+			v_assert(vfs_crypt_format(&fp, BENCH_PW,
+						  BENCH_PW_LEN) == 0);
+		}
+		v_assert(accdb_open(&db, &fp, pool, ncache) == 0);
+		accdb_cache_strategy(&db, strategy);
+		accdb_cache_readahead(&db, readahead);
+		v_assert(accdb_find_budget(&db, find_budget) == 0);
+		v_assert(accdb_format(&db) == 0);
+		v_assert(accdb_user_index(&db, user_index) == 0);
+		run(&db, crypt ? "crypt" : "plain", sizes[i]);
+		v_assert(accdb_close(&db) == 0);
+		vfs_close(&fp);
+	}
+	unlink(path);
+}
+
+static size_t
+parse_sizes(char *arg, unsigned long *sizes)
+{
+	char *p;
+	size_t n = 0;
+
+	while ((p = strsep(&arg, ",")) != NULL && n < MAX_SIZES) {
+		if (*p)
+			sizes[n++] = strtoul(p, NULL, 0);
+	}
+
+	return n;
+}
+
+// returns a bitmask of the named strategies, 0 if any name is unknown
+static unsigned
+parse_strategies(char *arg)
+{
+	char *p;
+	unsigned mask = 0;
+	size_t i;
+
+	while ((p = strsep(&arg, ",")) != NULL) {
+		if (!*p)
+			continue;
+		for (i = 0; i < NSTRATEGIES; ++i) {
+			if (strcmp(p, strategy_names[i]) == 0)
+				break;
+		}
+		if (i == NSTRATEGIES)
+			return 0;
+		mask |= 1U << i;
+	}
+
+	return mask;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-C] [-u] [-b plain|crypt|both] "
+			"[-S lru,mru,lirs] [-s n,n,...] [-c cache sectors] "
+			"[-r read ahead] [-p pool blocks] [-f find bytes] "
+			"[file]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct pool *pool;
+	const char *path = "bench.db";
+	const char *backend = "both";
+	unsigned long sizes[MAX_SIZES] = {100, 1000, 10000, 50000};
+	size_t nsizes = 4, i;
+	unsigned long ncache = ACCDB_CACHE_SIZE;
+	unsigned long pool_size = 0;
+	unsigned strategies = 1U << CACHE_LIRS;
+	int c;
+
+	while ((c = getopt(argc, argv, "Cub:S:s:c:r:p:f:")) != -1) {
+		switch (c) {
+		case 'C':
+			csv = 1;
+			break;
+		case 'u':
+			user_index = 1;
+			break;
+		case 'b':
+			backend = optarg;
+			break;
+		case 'S':
+			strategies = parse_strategies(optarg);
+			break;
+		case 's':
+			nsizes = parse_sizes(optarg, sizes);
+			break;
+		case 'c':
+			ncache = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			readahead = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pool_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			find_budget = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc)
+		path = argv[optind++];
+	if (pool_size == 0)
+		pool_size = ACCDB_POOL_SIZE(ncache);
+	if (optind != argc || nsizes == 0 || ncache == 0 || strategies == 0 ||
+	    ncache > 0xffff || pool_size > 0xffff ||
+	    readahead > ACCDB_READAHEAD_MAX)
+		usage(argv[0]);
+	for (i = 0; i < nsizes; ++i) {
+		if (sizes[i] == 0)
+			usage(argv[0]);
+	}
+	if (strcmp(backend, "plain") && strcmp(backend, "crypt") &&
+	    strcmp(backend, "both"))
+		usage(argv[0]);
+
+	count_vfs = pc_vfs;
+	count_vfs.name = "counting pc";
+	count_vfs.vread_sector = count_read;
+	count_vfs.vwrite_sector = count_write;
+	count_vfs.vread_sectors = count_read_sectors;
+	count_vfs.vwrite_sectors = count_write_sectors;
+
+	pool = pool_init(pool_size);
+	v_assert(pool != NULL);
+	v_assert(crypto_init() == 0);
+
+	if (!csv) {
+		printf("%s: pool %lu blocks, cache %lu sectors, "
+		       "read ahead %lu\n\n", path, pool_size, ncache,
+		       readahead);
+	}
+	phase_header();
+	for (i = 0; i < NSTRATEGIES; ++i) {
+		if (!(strategies & (1U << i)))
+			continue;
+		if (strcmp(backend, "crypt"))
+			run_backend(path, 0, pool, ncache, i, sizes, nsizes);
+		if (strcmp(backend, "plain"))
+			run_backend(path, 1, pool, ncache, i, sizes, nsizes);
+	}
+
+	pool_free(pool);
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+/* 
+ * This file is part of keeper.
+ * 
+ * Copyright 2013, cdavis
+ *  
+ * keeper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * keeper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with keeper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Stand-ins for the few ChibiOS services used by the storage stack
+// (pool, vfs, vfs_crypt and accdb), so it can run natively on top of
+// vfs_pc and crypto_openssl. Pulled in by keeper.h when KEEPER_HOST
+// is defined.
+
+#ifdef NDEBUG
+#define chDbgAssert(c, func, remark) ((void)0)
+#else
+#define chDbgAssert(c, func, remark)					\
+do {									\
+	if (!(c)) {							\
+		fprintf(stderr, "assert %s: %s (%s)\n",			\
+			func, remark, #c);				\
+		abort();						\
+	}								\
+} while (0)
+#endif
+
+// microsecond ticks rather than the firmware's millisecond ones
+#define CH_FREQUENCY 1000000
+typedef uint32_t systime_t;
+static inline systime_t
+chTimeNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+#define chHeapAlloc(heap, size) malloc(size)
+#define chHeapFree(p) free(p)
+
+#define fast_malloc(s) malloc(s)
+#define fast_free(p) free(p)
+static inline void *
+fast_mallocz(size_t size)
+{
+	return calloc(1, size);
+}
+
+#endif // _HOST_H_
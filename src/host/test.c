@@ -0,0 +1,51 @@
+/* 
+ * This file is part of keeper.
+ * 
+ * Copyright 2013, cdavis
+ *  
+ * keeper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * keeper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with keeper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// keeper-test: runs the self-tests of the storage stack natively, in the
+// same order as the "pool", "vfatfs", "crypto" and "accdb" console
+// commands do on the device. Files are created in the current directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "keeper.h"
+#include "vfs_pc.h"
+
+#define TEST_POOL_SZ 10
+
+int
+main(void)
+{
+	struct pool *p;
+
+	p = pool_init(TEST_POOL_SZ);
+	v_assert(p != NULL);
+	v_assert(crypto_init() == 0);
+
+	test_pool_run_all();
+	test_vfs_run_all(&pc_vfs, p);
+	test_vfs_crypt_run_all(&pc_vfs, p);
+	test_accdb_plaintext(&pc_vfs, p);
+	test_accdb_crypt(&pc_vfs, p);
+
+	pool_free(p);
+	outf("\r\nAll tests passed\r\n");
+
+	return 0;
+}
@@ -38,6 +38,16 @@ get_uint32(const uint8_t *buf, uint16_t pos)
 		buf[pos + 3]);
 } 
 
+// little endian, e.g. a word of a bitmap that's numbered lsb first
+static inline uint32_t
+get_uint32_le(const uint8_t *buf, uint16_t pos)
+{
+	return (buf[pos] |
+		((uint32_t)buf[pos + 1] << 8) |
+		((uint32_t)buf[pos + 2] << 16) |
+		((uint32_t)buf[pos + 3] << 24));
+}
+
 static inline void 
 set_uint16(uint8_t *buf, uint16_t pos, uint16_t b)
 {
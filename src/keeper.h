@@ -22,20 +22,31 @@
 #define _KEEPER_H_
 
 #include <string.h>
+#ifdef KEEPER_HOST
+#include "host.h"
+#else
 #include "ch.h"
+#endif
 #include "check.h"
 #include "console.h"
+#ifndef KEEPER_HOST
 #include "hal.h"
 #include "chrtclib.h"
+#endif
 #include "intop.h"
+#ifndef KEEPER_HOST
 #include "ff.h"
 #include "diskio.h"
+#endif
 #include "pool.h"
 #include "vfs.h"
+#ifndef KEEPER_HOST
 #include "vfs_fatfs.h"
+#endif
 #include "crypto.h"
 #include "vfs_crypt.h"
 #include "accdb.h"
+#ifndef KEEPER_HOST
 #include "hd44780.h"
 #include "buttons.h"
 
@@ -51,11 +62,13 @@ static inline void *
 fast_mallocz(size_t size)
 {
 	void *p = fast_malloc(size);
-	memset(p, 0, size);
+	if (p)
+		memset(p, 0, size);
 	return p;
 }
 
 #define _delay_ms(x) chThdSleepMilliseconds(x)
 #define _delay_us(x) halPolledDelay(US2RTT(x))
+#endif
 
 #endif // _KEEPER_H_
@@ -47,6 +47,42 @@ vfs_write_sector(struct file *fp, const void *buf, size_t amt)
 	return fp->vfs->vwrite_sector(fp, buf, amt);
 }
 
+// bufs need not be contiguous. these fall back to one read or write per
+// sector if the vfs can't do better.
+int8_t
+vfs_read_sectors(struct file *fp, void *const *bufs, uint16_t index,
+		 uint16_t count)
+{
+	uint16_t i;
+
+	if (fp->vfs->vread_sectors)
+		return fp->vfs->vread_sectors(fp, bufs, index, count);
+
+	for (i = 0; i < count; ++i) {
+		if (fp->vfs->vread_sector(fp, bufs[i], index + i) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int8_t
+vfs_write_sectors(struct file *fp, const void *const *bufs,
+		  uint16_t index, uint16_t count)
+{
+	uint16_t i;
+
+	if (fp->vfs->vwrite_sectors)
+		return fp->vfs->vwrite_sectors(fp, bufs, index, count);
+
+	for (i = 0; i < count; ++i) {
+		if (fp->vfs->vwrite_sector(fp, bufs[i], index + i) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 uint16_t
 vfs_start_sector(struct file *fp)
 {
@@ -104,22 +140,46 @@ test_vfs(const struct vfs *meth, struct pool *p)
 	pool_deallocate_block(p, buf);
 }
 
+void
+test_vfs_sectors(const struct vfs *meth, struct pool *p)
+{
+	uint8_t *bufs[3];
+	struct file f;
+	size_t i;
+
+	for (i = 0; i < 3; ++i) {
+		bufs[i] = pool_allocate_block(p, NULL);
+		v_assert(bufs[i] != NULL);
+		memset(bufs[i], 'C' + i, 512);
+	}
+
+	v_assert(vfs_open(meth, &f, TEST_FN, VFS_RW) == 0);
+	v_assert(vfs_write_sectors(&f, (const void *const *)bufs, 2, 3) == 0);
+	vfs_close(&f);
+
+	v_assert(vfs_open(meth, &f, TEST_FN, VFS_RO) == 0);
+	for (i = 0; i < 3; ++i) {
+		v_assert(vfs_read_sector(&f, bufs[i], 4 - i) == 0);
+		v_assert(test_sector_contains(bufs[i], 'E' - i) == 1);
+	}
+	v_assert(vfs_read_sectors(&f, (void *const *)bufs, 2, 3) == 0);
+	for (i = 0; i < 3; ++i)
+		v_assert(test_sector_contains(bufs[i], 'C' + i) == 1);
+	v_assert(vfs_read_sector(&f, bufs[0], 1) == 0);
+	v_assert(test_sector_contains(bufs[0], 'B') == 1);
+	vfs_close(&f);
+
+	for (i = 0; i < 3; ++i)
+		pool_deallocate_block(p, bufs[i]);
+}
+
 void
 test_vfs_run_all(const struct vfs *meth, struct pool *p)
 {
 	outf("VFS:\r\n");
 	test_vfs(meth, p);
 	outf("OK\r\n");
+	outf("VFS multi-sector write:\r\n");
+	test_vfs_sectors(meth, p);
+	outf("OK\r\n");
 }
-
-#if 0
-#include "vfs_pc.h"
-int main(void)
-{
-	struct pool *p = pool_init(4);
-	v_assert(p);
-	test_vfs_run_all(&pc_vfs, p);
-	
-	return 0;
-}
-#endif
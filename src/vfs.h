@@ -42,6 +42,11 @@ struct vfs {
 	void (*vclose)(struct file *fp);
 	int8_t (*vread_sector)(struct file *fp, void *buf, uint16_t index);
 	int8_t (*vwrite_sector)(struct file *fp, const void *buf, uint16_t index);
+	// optional, read or write count consecutive sectors starting at index
+	int8_t (*vread_sectors)(struct file *fp, void *const *bufs,
+				uint16_t index, uint16_t count);
+	int8_t (*vwrite_sectors)(struct file *fp, const void *const *bufs,
+				 uint16_t index, uint16_t count);
 	uint16_t (*vstart_sector)(struct file *fp);
 	uint16_t (*vend_sector)(struct file *fp);
 	//TODO: support enumerating dirs
@@ -52,11 +57,16 @@ int8_t vfs_open(const struct vfs *methods, struct file *fp, const char *path,
 void vfs_close(struct file *fp);
 int8_t vfs_read_sector(struct file *fp, void *buf, size_t amt);
 int8_t vfs_write_sector(struct file *fp, const void *buf, size_t amt);
+int8_t vfs_read_sectors(struct file *fp, void *const *bufs,
+			uint16_t index, uint16_t count);
+int8_t vfs_write_sectors(struct file *fp, const void *const *bufs,
+			 uint16_t index, uint16_t count);
 uint16_t vfs_start_sector(struct file *fp);
 uint16_t vfs_end_sector(struct file *fp);
 
 struct pool;
 void test_vfs(const struct vfs *meth, struct pool *p);
+void test_vfs_sectors(const struct vfs *meth, struct pool *p);
 void test_vfs_run_all(const struct vfs *meth, struct pool *p);
 
 #endif // _VFS_H_
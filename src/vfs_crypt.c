@@ -526,7 +526,7 @@ test_vfs_crypt_format(const struct vfs *meth, struct pool *p)
 
 	start = vfs_start_sector(&f); 
 	for (count = 0; count < TEST_SECT_COUNT; ++count) {
-		memset(buf, count, sizeof(buf));
+		memset(buf, count, SECT_SIZE);
 		v_assert(vfs_write_sector(&f, buf, start + count) == 0);
 	}
 
@@ -552,7 +552,7 @@ test_vfs_crypt_unlock(const struct vfs *meth, struct pool *pool)
 	for (count = 0; count < TEST_SECT_COUNT; ++count) {
 		unsigned i;
 		v_assert(vfs_read_sector(&f, buf, start + count) == 0);
-		for (i = 0; i < sizeof(buf); ++i)
+		for (i = 0; i < SECT_SIZE; ++i)
 			v_assert(buf[i] == count);
 	}
 
@@ -591,7 +591,7 @@ test_vfs_crypt_header(struct pool *pool)
 	buf = pool_allocate_block(pool, NULL);
 	v_assert(buf);
 
-	memset(buf, 0, sizeof(buf));
+	memset(buf, 0, SECT_SIZE);
 	memset(digest, 'D', sizeof(digest));
 	memset(salt1, 'S', sizeof(salt1));
 	memset(salt2, 'S', sizeof(salt2));
@@ -640,19 +640,3 @@ test_vfs_crypt_run_all(const struct vfs *meth, struct pool *p)
 	test_vfs_crypt_chpass(meth, p);
 	outf("OK\r\n");
 }
-
-#if 0
-#include "vfs_pc.h"
-int
-main(void)
-{
-	struct pool *p;
-
-	p = pool_init(8);
-	v_assert(p);
-	crypto_init();
-	test_vfs_crypt(&pc_vfs, p);
-	
-	return 0;
-}
-#endif
@@ -93,10 +93,56 @@ fatfs_write(struct file *fp, const void *buf, uint16_t index)
 	return 0;
 }
 
+// one seek for the run, f_read and f_write take consecutive sectors
+// from there
+static int8_t
+fatfs_read_sectors(struct file *fp, void *const *bufs, uint16_t index,
+		   uint16_t count)
+{
+	FRESULT rv;
+	UINT len;
+	uint16_t i;
+
+	rv = f_lseek(FP(fp), VFS_SECT_TO_OFFSET(index));
+	if (rv != FR_OK)
+		return -1;
+	for (i = 0; i < count; ++i) {
+		rv = f_read(FP(fp), bufs[i], VFS_SECT_SIZE, &len);
+		if (rv != FR_OK)
+			return -1;
+		if (len != VFS_SECT_SIZE)
+			memset(bufs[i], 0, VFS_SECT_SIZE);
+	}
+
+	return 0;
+}
+
+static int8_t
+fatfs_write_sectors(struct file *fp, const void *const *bufs, uint16_t index,
+		    uint16_t count)
+{
+	FRESULT rv;
+	UINT len;
+	uint16_t i;
+
+	rv = f_lseek(FP(fp), VFS_SECT_TO_OFFSET(index));
+	if (rv != FR_OK)
+		return -1;
+	for (i = 0; i < count; ++i) {
+		rv = f_write(FP(fp), bufs[i], VFS_SECT_SIZE, &len);
+		if (rv != FR_OK || len != VFS_SECT_SIZE)
+			return -1;
+	}
+
+	return 0;
+}
+
 struct vfs fatfs_vfs = {
 	.name = "fatfs",
 	.vopen = fatfs_open,
 	.vclose = fatfs_close,
 	.vread_sector = fatfs_read,
 	.vwrite_sector = fatfs_write,
+	.vread_sectors = fatfs_read_sectors,
+	.vwrite_sectors = fatfs_write_sectors,
 };
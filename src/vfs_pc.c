@@ -23,9 +23,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/uio.h>
 #include "vfs_pc.h"
 
 #define FD(fp) ((int)(uintptr_t)(fp->ctx))
+#define PC_IOV_MAX 64
 
 static int8_t
 pc_open(struct file *fp, const char *path, uint8_t access)
@@ -74,10 +76,68 @@ pc_write(struct file *fp, const void *buf, uint16_t index)
 	return write(FD(fp), buf, VFS_SECT_SIZE) == VFS_SECT_SIZE? 0 : -1;
 }
 
+static int8_t
+pc_read_sectors(struct file *fp, void *const *bufs, uint16_t index,
+		uint16_t count)
+{
+	struct iovec iov[PC_IOV_MAX];
+	off_t off = VFS_SECT_TO_OFFSET((off_t)index);
+	uint16_t i, n;
+	ssize_t len;
+
+	while (count) {
+		n = count < PC_IOV_MAX ? count : PC_IOV_MAX;
+		for (i = 0; i < n; ++i) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = VFS_SECT_SIZE;
+		}
+		len = preadv(FD(fp), iov, n, off);
+		if (len < 0)
+			return -1;
+		// past the end of the file reads as zeros, like pc_read
+		for (i = len / VFS_SECT_SIZE; i < n; ++i)
+			memset(bufs[i], 0, VFS_SECT_SIZE);
+		bufs += n;
+		off += (off_t)n * VFS_SECT_SIZE;
+		count -= n;
+	}
+
+	return 0;
+}
+
+static int8_t
+pc_write_sectors(struct file *fp, const void *const *bufs, uint16_t index,
+		 uint16_t count)
+{
+	struct iovec iov[PC_IOV_MAX];
+	off_t off = VFS_SECT_TO_OFFSET((off_t)index);
+	uint16_t i, n;
+	ssize_t len;
+
+	// gather each run into one pwritev
+	while (count) {
+		n = count < PC_IOV_MAX ? count : PC_IOV_MAX;
+		for (i = 0; i < n; ++i) {
+			iov[i].iov_base = (void *)bufs[i];
+			iov[i].iov_len = VFS_SECT_SIZE;
+		}
+		len = pwritev(FD(fp), iov, n, off);
+		if (len != (ssize_t)n * VFS_SECT_SIZE)
+			return -1;
+		bufs += n;
+		off += len;
+		count -= n;
+	}
+
+	return 0;
+}
+
 struct vfs pc_vfs = {
 	.name = "big pc",
 	.vopen = pc_open,
 	.vclose = pc_close,
 	.vread_sector = pc_read,
 	.vwrite_sector = pc_write,
+	.vread_sectors = pc_read_sectors,
+	.vwrite_sectors = pc_write_sectors,
 };